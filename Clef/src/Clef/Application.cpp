@@ -700,6 +700,11 @@ namespace Clef {
 		return g_Device;
 	}
 
+	uint32_t Application::getQueueFamilyIndex()
+	{
+		return g_QueueFamily;
+	}
+
 	VkCommandBuffer Application::getCommandBuffer(bool begin)
 	{
 		ImGui_ImplVulkanH_Window* wd = &g_MainWindowData;
@@ -753,6 +758,19 @@ namespace Clef {
 		vkDestroyFence(g_Device, fence, nullptr);
 	}
 
+	void Application::submitCommandBuffer(VkCommandBuffer commandBuffer, VkFence fence)
+	{
+		VkSubmitInfo end_info = {};
+		end_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		end_info.commandBufferCount = 1;
+		end_info.pCommandBuffers = &commandBuffer;
+		auto err = vkEndCommandBuffer(commandBuffer);
+		check_vk_result(err);
+
+		err = vkQueueSubmit(g_Queue, 1, &end_info, fence);
+		check_vk_result(err);
+	}
+
 
 	void Application::submitResourceFree(std::function<void()>&& func)
 	{
@@ -38,8 +38,12 @@ namespace Clef
 		static VkDevice getDevice();
 		GLFWwindow* getWindowHandle() { return m_windowHandle; }
 
+		static uint32_t getQueueFamilyIndex();
+
 		static VkCommandBuffer getCommandBuffer(bool begin);
 		static void flushCommandBuffer(VkCommandBuffer commandBuffer);
+		// Ends and submits a command buffer without waiting, fence is signaled once it has run.
+		static void submitCommandBuffer(VkCommandBuffer commandBuffer, VkFence fence);
 
 		static void submitResourceFree(std::function<void()>&& func);
 
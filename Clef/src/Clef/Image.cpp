@@ -161,7 +161,7 @@ namespace Clef {
 	void Image::release()
 	{
 		Application::submitResourceFree([sampler = m_sampler, imageView = m_imageView, image = m_image,
-			memory = m_memory, stagingBuffer = m_stagingBuffer, stagingBufferMemory = m_stagingBufferMemory]()
+			memory = m_memory, commandPool = m_commandPool, stagingBuffers = m_stagingBuffers]()
 			{
 				VkDevice device = Application::getDevice();
 
@@ -169,19 +169,31 @@ namespace Clef {
 				vkDestroyImageView(device, imageView, nullptr);
 				vkDestroyImage(device, image, nullptr);
 				vkFreeMemory(device, memory, nullptr);
-				vkDestroyBuffer(device, stagingBuffer, nullptr);
-				vkFreeMemory(device, stagingBufferMemory, nullptr);
+
+				for (const StagingBuffer& staging : stagingBuffers)
+				{
+					if (!staging.buffer)
+						continue;
+
+					vkWaitForFences(device, 1, &staging.fence, VK_TRUE, UINT64_MAX);
+					vkDestroyFence(device, staging.fence, nullptr);
+					vkDestroyBuffer(device, staging.buffer, nullptr);
+					vkFreeMemory(device, staging.memory, nullptr); // also unmaps it
+				}
+				vkDestroyCommandPool(device, commandPool, nullptr);
 			});
 
 		m_sampler = nullptr;
 		m_imageView = nullptr;
 		m_image = nullptr;
 		m_memory = nullptr;
-		m_stagingBuffer = nullptr;
-		m_stagingBufferMemory = nullptr;
+		m_commandPool = nullptr;
+		for (StagingBuffer& staging : m_stagingBuffers)
+			staging = StagingBuffer();
+		m_stagingIndex = 0;
 	}
 
-	void Image::setData(const void* data)
+	void Image::createStagingBuffer(StagingBuffer& staging)
 	{
 		VkDevice device = Application::getDevice();
 
@@ -189,52 +201,111 @@ namespace Clef {
 
 		VkResult err;
 
-		if (!m_stagingBuffer)
+		if (!m_commandPool)
 		{
-			// Create the Upload Buffer
-			{
-				VkBufferCreateInfo buffer_info = {};
-				buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-				buffer_info.size = upload_size;
-				buffer_info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-				buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-				err = vkCreateBuffer(device, &buffer_info, nullptr, &m_stagingBuffer);
-				check_vk_result(err);
-				VkMemoryRequirements req;
-				vkGetBufferMemoryRequirements(device, m_stagingBuffer, &req);
-				m_alignedSize = req.size;
-				VkMemoryAllocateInfo alloc_info = {};
-				alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-				alloc_info.allocationSize = req.size;
-				alloc_info.memoryTypeIndex = Utils::GetVulkanMemoryType(VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, req.memoryTypeBits);
-				err = vkAllocateMemory(device, &alloc_info, nullptr, &m_stagingBufferMemory);
-				check_vk_result(err);
-				err = vkBindBufferMemory(device, m_stagingBuffer, m_stagingBufferMemory, 0);
-				check_vk_result(err);
-			}
+			VkCommandPoolCreateInfo pool_info = {};
+			pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+			pool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+			pool_info.queueFamilyIndex = Application::getQueueFamilyIndex();
+			err = vkCreateCommandPool(device, &pool_info, nullptr, &m_commandPool);
+			check_vk_result(err);
+		}
 
+		// Create the Upload Buffer, mapped for as long as it lives
+		{
+			VkBufferCreateInfo buffer_info = {};
+			buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+			buffer_info.size = upload_size;
+			buffer_info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+			buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+			err = vkCreateBuffer(device, &buffer_info, nullptr, &staging.buffer);
+			check_vk_result(err);
+			VkMemoryRequirements req;
+			vkGetBufferMemoryRequirements(device, staging.buffer, &req);
+			VkMemoryAllocateInfo alloc_info = {};
+			alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+			alloc_info.allocationSize = req.size;
+			alloc_info.memoryTypeIndex = Utils::GetVulkanMemoryType(VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, req.memoryTypeBits);
+			err = vkAllocateMemory(device, &alloc_info, nullptr, &staging.memory);
+			check_vk_result(err);
+			err = vkBindBufferMemory(device, staging.buffer, staging.memory, 0);
+			check_vk_result(err);
+			err = vkMapMemory(device, staging.memory, 0, VK_WHOLE_SIZE, 0, &staging.mappedData);
+			check_vk_result(err);
 		}
 
-		// Upload to Buffer
+		// Command buffer and fence of its copies, the fence starts signaled as nothing is in flight yet
 		{
-			char* map = NULL;
-			err = vkMapMemory(device, m_stagingBufferMemory, 0, m_alignedSize, 0, (void**)(&map));
+			VkCommandBufferAllocateInfo alloc_info = {};
+			alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+			alloc_info.commandPool = m_commandPool;
+			alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+			alloc_info.commandBufferCount = 1;
+			err = vkAllocateCommandBuffers(device, &alloc_info, &staging.commandBuffer);
+			check_vk_result(err);
+
+			VkFenceCreateInfo fence_info = {};
+			fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+			fence_info.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+			err = vkCreateFence(device, &fence_info, nullptr, &staging.fence);
 			check_vk_result(err);
-			memcpy(map, data, upload_size);
+		}
+	}
+
+	void Image::setData(const void* data)
+	{
+		size_t upload_size = m_width * m_height * Utils::BytesPerPixel(m_format);
+
+		memcpy(getUploadBuffer(), data, upload_size);
+		uploadData();
+	}
+
+	void* Image::getUploadBuffer()
+	{
+		StagingBuffer& staging = m_stagingBuffers[m_stagingIndex];
+		if (!staging.buffer)
+			createStagingBuffer(staging);
+
+		// Still being copied from by the upload STAGING_BUFFER_COUNT calls ago
+		VkResult err = vkWaitForFences(Application::getDevice(), 1, &staging.fence, VK_TRUE, UINT64_MAX);
+		check_vk_result(err);
+
+		return staging.mappedData;
+	}
+
+	void Image::uploadData()
+	{
+		VkDevice device = Application::getDevice();
+
+		StagingBuffer& staging = m_stagingBuffers[m_stagingIndex];
+		m_stagingIndex = (m_stagingIndex + 1) % STAGING_BUFFER_COUNT;
+
+		VkResult err;
+
+		// Make the host writes visible, the memory need not be coherent
+		{
 			VkMappedMemoryRange range[1] = {};
 			range[0].sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
-			range[0].memory = m_stagingBufferMemory;
-			range[0].size = m_alignedSize;
+			range[0].memory = staging.memory;
+			range[0].size = VK_WHOLE_SIZE;
 			err = vkFlushMappedMemoryRanges(device, 1, range);
 			check_vk_result(err);
-			vkUnmapMemory(device, m_stagingBufferMemory);
-		}
 
+			err = vkResetFences(device, 1, &staging.fence);
+			check_vk_result(err);
+		}
 
 		// Copy to Image
 		{
-			VkCommandBuffer command_buffer = Application::getCommandBuffer(true);
+			VkCommandBuffer command_buffer = staging.commandBuffer;
+
+			VkCommandBufferBeginInfo begin_info = {};
+			begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+			begin_info.flags |= VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+			err = vkBeginCommandBuffer(command_buffer, &begin_info);
+			check_vk_result(err);
 
+			// Nothing waits for the copy on the CPU anymore, so it also has to wait for the last frame's draw to stop sampling
 			VkImageMemoryBarrier copy_barrier = {};
 			copy_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
 			copy_barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
@@ -246,7 +317,7 @@ namespace Clef {
 			copy_barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
 			copy_barrier.subresourceRange.levelCount = 1;
 			copy_barrier.subresourceRange.layerCount = 1;
-			vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_HOST_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &copy_barrier);
+			vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_HOST_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &copy_barrier);
 
 			VkBufferImageCopy region = {};
 			region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
@@ -254,7 +325,7 @@ namespace Clef {
 			region.imageExtent.width = m_width;
 			region.imageExtent.height = m_height;
 			region.imageExtent.depth = 1;
-			vkCmdCopyBufferToImage(command_buffer, m_stagingBuffer, m_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+			vkCmdCopyBufferToImage(command_buffer, staging.buffer, m_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
 
 			VkImageMemoryBarrier use_barrier = {};
 			use_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
@@ -270,7 +341,7 @@ namespace Clef {
 			use_barrier.subresourceRange.layerCount = 1;
 			vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, NULL, 0, NULL, 1, &use_barrier);
 
-			Application::flushCommandBuffer(command_buffer);
+			Application::submitCommandBuffer(command_buffer, staging.fence);
 		}
 	}
 
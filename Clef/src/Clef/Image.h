@@ -1,5 +1,6 @@
 #pragma once
 
+#include <array>
 #include <string>
 
 #include "vulkan/vulkan.h"
@@ -22,6 +23,12 @@ namespace Clef {
 
 		void setData(const void* data);
 
+		// Persistently mapped staging memory for the next upload, one whole image in this image's format.
+		// Only waits when the GPU is still copying from it, which takes STAGING_BUFFER_COUNT uploads in flight.
+		void* getUploadBuffer();
+		// Copies what was written to getUploadBuffer into the image, without waiting for the GPU.
+		void uploadData();
+
 		inline VkDescriptorSet getDescriptorSet() const { return m_descriptorSet; }
 
 		void resize(uint32_t width, uint32_t height);
@@ -33,6 +40,20 @@ namespace Clef {
 		void allocateMemory(uint64_t size);
 		void release();
 
+		// Uploads cycle through a ring of staging buffers, each with the command buffer and fence of its last copy.
+		struct StagingBuffer
+		{
+			VkBuffer buffer = nullptr;
+			VkDeviceMemory memory = nullptr;
+			void* mappedData = nullptr;
+			VkCommandBuffer commandBuffer = nullptr;
+			VkFence fence = nullptr;
+		};
+
+		void createStagingBuffer(StagingBuffer& staging);
+
+		static constexpr uint32_t STAGING_BUFFER_COUNT = 2;
+
 	private:
 		uint32_t m_width = 0, m_height = 0;
 
@@ -43,10 +64,9 @@ namespace Clef {
 
 		ImageFormat m_format = ImageFormat::None;
 
-		VkBuffer m_stagingBuffer = nullptr;
-		VkDeviceMemory m_stagingBufferMemory = nullptr;
-
-		size_t m_alignedSize = 0;
+		std::array<StagingBuffer, STAGING_BUFFER_COUNT> m_stagingBuffers;
+		uint32_t m_stagingIndex = 0;
+		VkCommandPool m_commandPool = nullptr;
 
 		VkDescriptorSet m_descriptorSet = nullptr;
 
@@ -30,6 +30,9 @@ project "Vibrato"
     systemversion "latest"
     defines { "CLEF_PLATFORM_WINDOWS" }
 
+  filter "system:linux"
+    links { "pthread" }
+
   filter "configurations:Debug"
     defines { "CLEF_DEBUG" }
     runtime "Debug"
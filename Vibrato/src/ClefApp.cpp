@@ -1,9 +1,11 @@
 #include "Clef.h"
 
-#include "Vibrato/Renderer.h"
+#include "Vibrato/RenderThread.h"
+#include "Vibrato/SceneLoader.h"
 #include "Vibrato/Utils.h"
 
 #include <memory>
+#include <string>
 #include <glm/gtc/type_ptr.hpp>
 
 using namespace Clef;
@@ -11,113 +13,252 @@ using namespace Clef;
 class VibratoLayer : public Clef::Layer
 {
 public:
-	VibratoLayer()
-		: m_camera(45.0f, 0.1f, 100.0f) 
-	{	
-		Vibrato::Material& groundMaterial = m_scene.materials.emplace_back();
-		groundMaterial.albedo = { 1.0f, 1.0f, 1.0f };
-		{
-			auto& sphere = std::make_shared<Vibrato::Sphere>();
-			sphere->position = { 0.0f, -1000.0f, 0.0f };
-			sphere->radius = 1000.0f;
-			sphere->materialIndex = (int)(m_scene.materials.size() - 1);
-			m_scene.objects.push_back(sphere);
-		}
-		
-		Vibrato::Material& lambertian = m_scene.materials.emplace_back();
-		lambertian.albedo = { 0.8f, 0.5f, 0.2f };
-		lambertian.emissionColor = { 0.8f, 0.5f, 0.2f };
-		lambertian.emissionPower = 5.0f;
-		{
-			auto& sphere = std::make_shared<Vibrato::Sphere>();
-			sphere->position = { -4.0f, 4.0f, -3.0f };
-			sphere->radius = 1.0f;
-			sphere->materialIndex = (int)(m_scene.materials.size() - 1);
-			m_scene.objects.push_back(sphere);
-		}
+	// The window opens on an empty scene right away, the scene file streams in while it loads.
+	VibratoLayer(const std::string& scenePath)
+		: m_camera(45.0f, 0.1f, 100.0f), m_scenePath(scenePath)
+	{
+		m_renderThread = std::make_unique<Vibrato::RenderThread>(Vibrato::Scene(), m_camera, m_settings);
+		m_sceneLoad = std::make_unique<Vibrato::SceneLoadTask>(m_scenePath);
+	}
 
-		/*
-		Vibrato::Material& dielectric = m_scene.materials.emplace_back();
-		dielectric.refractiveIndex = 1.5f;
-		{
-			auto& sphere = std::make_shared<Vibrato::Sphere>();
-			sphere->position = { 0.0f, 0.5f, 0.0f };
-			sphere->radius = 0.5f;
-			sphere->materialIndex = (int)(m_scene.materials.size() - 1);
-			m_scene.objects.push_back(sphere);
-		}
+	virtual void onUpdate(float ts) override
+	{
+		if (m_camera.onUpdate(ts))
+			m_renderThread->setCamera(m_camera);
 
-		Vibrato::Material& metal = m_scene.materials.emplace_back();
-		metal.albedo = { 0.7f, 0.6f, 0.5f };
-		metal.roughness = 0.0f;
-		{
-			auto& sphere = std::make_shared<Vibrato::Sphere>();
-			sphere->position = { 1.0f, 0.5f, 1.0f };
-			sphere->radius = 0.5f;
-			sphere->materialIndex = (int)(m_scene.materials.size() - 1);
-			m_scene.objects.push_back(sphere);
-		}*/
+		if (m_sceneLoad)
+			pollSceneLoad();
+	}
 
+	// Hands whatever finished loading to the render thread and adds it to the scene panel.
+	void pollSceneLoad()
+	{
+		// Read before taking fragments, once done was seen every fragment is in
+		m_loadProgress = m_sceneLoad->getProgress();
 
-		Vibrato::Material& test = m_scene.materials.emplace_back();
-		test.albedo = { 0.9f, 0.9f, 0.9f };
-		test.refractiveIndex = 2.42f;
+		for (Vibrato::SceneFragment& fragment : m_sceneLoad->takeFragments())
 		{
-			auto& testObj = Vibrato::TriangleMesh("./obj/gem.obj");
-			for (const auto& tri : testObj.triangles)
+			for (const auto& object : fragment.objects)
+				m_objects.push_back({ object->position, object->materialIndex });
+			for (const auto& mesh : fragment.meshes)
+				m_meshes.push_back({ mesh->materialIndex, mesh->getTriangleCount(), mesh->getVertexCount() });
+			m_materials.insert(m_materials.end(), fragment.materials.begin(), fragment.materials.end());
+
+			if (fragment.hasCamera)
 			{
-				tri->materialIndex = (int)(m_scene.materials.size() - 1);
-				m_scene.objects.push_back(tri);
+				const Vibrato::CameraDescription& camera = fragment.camera;
+				m_camera.setVerticalFOV(camera.verticalFOV);
+				m_camera.setView(camera.position, camera.direction);
+				m_camera.setLens(camera.aperture, camera.focusDistance);
+				m_renderThread->setCamera(m_camera);
 			}
+
+			m_renderThread->post([fragment = std::move(fragment)](Vibrato::Scene& scene, Vibrato::Camera&, Vibrato::Renderer&)
+			{
+				fragment.appendTo(scene);
+			});
 		}
-	}
 
-	virtual void onUpdate(float ts) override
-	{
-		if (m_camera.onUpdate(ts))
-			m_renderer.resetFrameIndex();
+		if (m_loadProgress.done)
+			m_sceneLoad.reset();
 	}
 
 	virtual void onUIRender() override
 	{
 		ImGui::Begin("Tunings");
 
-		auto& settings = m_renderer.getSettings();
+		auto& settings = m_settings;
+		const auto& frame = m_frameInfo;
+		bool settingsChanged = false;
+
+		ImGui::Text("Render Time: %.3fms", frame.renderTime); ImGui::SameLine();
+		ImGui::Text("%d FPS", (int)(1000 / std::max(frame.renderTime, 0.001f)));
+
+		if (ImGui::TreeNode("BVH"))
+		{
+			const auto& build = frame.buildStats;
+			const auto& traversal = frame.traversalStats;
+			float rays = (float)std::max<uint64_t>(traversal.rays, 1);
+
+			ImGui::Text("Primitives: %u", build.primitiveCount);
+			ImGui::Text("Nodes: %u (%u leaves)", build.nodeCount, build.leafCount);
+			ImGui::Text("Max Depth: %u", build.maxDepth);
+			ImGui::Text("SAH Cost: %.2f", build.sahCost);
+			ImGui::Text("Build Time: %.3fms", build.buildTimeMs);
+			ImGui::Text("Refits: %u (last %.3fms)", build.refitCount, build.refitTimeMs);
+			ImGui::Text("Traversal: %s, %u nodes", frame.traversalKernel, frame.wideBvhNodeCount);
+			ImGui::Text("Lights: %u (%u nodes)", frame.lightCount, frame.lightNodeCount);
+			ImGui::Text("Nodes / Ray: %.2f", traversal.nodesVisited / rays);
+			ImGui::Text("Tests / Ray: %.2f", traversal.primitiveTests / rays);
+			ImGui::TreePop();
+		}
+
+		settingsChanged |= ImGui::Checkbox("Accumulate Frames", &(settings.accumulate));
+
+		const char* integrators[] = { "Mega Kernel", "Wavefront" };
+		int integrator = (int)settings.integrator;
+		if (ImGui::Combo("Integrator", &integrator, integrators, IM_ARRAYSIZE(integrators)))
+		{
+			settings.integrator = (Vibrato::Renderer::Integrator)integrator;
+			settingsChanged = true;
+			m_renderThread->resetFrameIndex();
+		}
+		settingsChanged |= ImGui::Checkbox("Packet Primary Rays", &(settings.packetTracing));
+		if (ImGui::Checkbox("Light Sampling", &(settings.lightSampling)))
+		{
+			settingsChanged = true;
+			m_renderThread->resetFrameIndex();
+		}
+
+		const char* samplers[] = { "Random", "Sobol", "Blue Noise" };
+		int sampler = (int)settings.sampler;
+		if (ImGui::Combo("Sampler", &sampler, samplers, IM_ARRAYSIZE(samplers)))
+		{
+			settings.sampler = (Vibrato::Sampler::Type)sampler;
+			settingsChanged = true;
+			m_renderThread->resetFrameIndex();
+		}
+
+		const char* filters[] = { "Box", "Tent", "Blackman-Harris" };
+		int filter = (int)settings.filter;
+		if (ImGui::Combo("Pixel Filter", &filter, filters, IM_ARRAYSIZE(filters)))
+		{
+			settings.filter = (Vibrato::Renderer::PixelFilter)filter;
+			settingsChanged = true;
+			m_renderThread->resetFrameIndex();
+		}
+
+		const char* tonemaps[] = { "Gamma 2", "sRGB", "ACES" };
+		int tonemap = (int)settings.tonemap;
+		if (ImGui::Combo("Tonemap", &tonemap, tonemaps, IM_ARRAYSIZE(tonemaps)))
+		{
+			settings.tonemap = (Vibrato::Tonemap)tonemap;
+			settingsChanged = true;
+		}
+		ImGui::Text("Resolve: %.3fms (%s)", frame.resolveTime, Vibrato::ResolveKernels::getKernelName());
 
-		ImGui::Text("Render Time: %.3fms", m_lastRenderTime); ImGui::SameLine();
-		ImGui::Text("%d FPS", (int)(1000 / m_lastRenderTime));
+		float aperture = m_camera.getAperture();
+		float focusDistance = m_camera.getFocusDistance();
+		bool lensChanged = ImGui::DragFloat("Aperture", &aperture, 0.005f, 0.0f, 2.0f);
+		lensChanged |= ImGui::DragFloat("Focus Distance", &focusDistance, 0.05f, 0.01f, 100.0f);
+		if (lensChanged)
+		{
+			m_camera.setLens(aperture, focusDistance);
+			m_renderThread->setCamera(m_camera);
+		}
 
-		ImGui::Checkbox("Accumulate Frames", &(settings.accumulate));
+		if (ImGui::TreeNode("Scheduler"))
+		{
+			const char* tileOrders[] = { "Scanline", "Morton", "Hilbert" };
+			int tileOrder = (int)settings.tileOrder;
+			if (ImGui::Combo("Tile Order", &tileOrder, tileOrders, IM_ARRAYSIZE(tileOrders)))
+			{
+				settings.tileOrder = (Vibrato::Renderer::TileOrder)tileOrder;
+				settingsChanged = true;
+			}
 
-		ImGui::InputInt("Rays Per Pixel", &(settings.samplesPerPixel));
-		ImGui::InputInt("Ray Bounces", &(settings.bounces));
+			settingsChanged |= ImGui::InputInt("Tile Size", &(settings.tileSize));
+			settingsChanged |= ImGui::InputInt("Threads (0 = all)", &(settings.threadCount));
+			ImGui::TreePop();
+		}
+
+		settingsChanged |= ImGui::InputInt("Rays Per Pixel", &(settings.samplesPerPixel));
+		settingsChanged |= ImGui::InputInt("Ray Bounces", &(settings.bounces));
+		if (ImGui::Checkbox("Russian Roulette", &(settings.russianRoulette)))
+		{
+			settingsChanged = true;
+			m_renderThread->resetFrameIndex();
+		}
+		settingsChanged |= ImGui::InputInt("Roulette Depth", &(settings.rouletteDepth));
+		ImGui::Text("Path Length: %.2f", frame.averagePathLength);
+
+		if (ImGui::Checkbox("Adaptive Sampling", &(settings.adaptiveSampling)))
+		{
+			settingsChanged = true;
+			m_renderThread->resetFrameIndex();
+		}
+		if (settings.adaptiveSampling)
+		{
+			settingsChanged |= ImGui::DragFloat("Noise Threshold", &(settings.noiseThreshold), 0.0005f, 0.0f, 0.1f, "%.4f");
+			settingsChanged |= ImGui::InputInt("Min Samples", &(settings.adaptiveMinSamples));
+			settingsChanged |= ImGui::Checkbox("Sample Heatmap", &(settings.sampleHeatmap));
+			ImGui::Text("Active Pixels: %u", frame.activePixelCount);
+		}
+
+		// Applied between frames on the render thread
+		if (settingsChanged)
+			m_renderThread->setSettings(settings);
 
 		if (ImGui::Button("Render"))
 		{
-			m_renderer.resetFrameIndex();
-			render();
+			m_renderThread->resetFrameIndex();
 		}
 		ImGui::SameLine();
 		if (ImGui::Button("Save"))
 		{
-			m_renderer.screenshot();
+			m_renderThread->screenshot();
 		}
 
 		ImGui::End();
 
 		ImGui::Begin("Scene");
+
+		if (m_sceneLoad)
+		{
+			const auto& progress = m_loadProgress;
+			float fraction = progress.meshCount > 0 ? (float)progress.loadedMeshes / progress.meshCount : 0.0f;
+			ImGui::Text("Loading %s", m_scenePath.c_str());
+			ImGui::ProgressBar(fraction, ImVec2(-1.0f, 0.0f), (std::to_string(progress.loadedMeshes) + " / " + std::to_string(progress.meshCount) + " meshes").c_str());
+		}
+		if (!m_loadProgress.error.empty())
+			ImGui::TextWrapped("Error: %s", m_loadProgress.error.c_str());
 		
 		if (ImGui::TreeNode("Objects"))
 		{
-			for (size_t i = 0; i < m_scene.objects.size(); ++i)
+			for (size_t i = 0; i < m_objects.size(); ++i)
 			{
 				ImGui::PushID((int)i);
-				std::shared_ptr<Vibrato::Hittable> object = m_scene.objects[i];
+				ObjectState& object = m_objects[i];
 
 				ImGui::Text("\nObject %d", (i + 1));
-				ImGui::DragFloat3("Position", glm::value_ptr(object->position), 0.1f);
+				bool changed = ImGui::DragFloat3("Position", glm::value_ptr(object.position), 0.1f);
 				// ImGui::DragFloat("Radius", &(object.radius), 0.1f, 0.0f);
-				ImGui::DragInt("Material", &(object->materialIndex), 1.0f, 0, (int)(m_scene.materials.size() - 1));
+				changed |= ImGui::DragInt("Material", &(object.materialIndex), 1.0f, 0, (int)(m_materials.size() - 1));
+				if (changed)
+				{
+					m_renderThread->post([i, object](Vibrato::Scene& scene, Vibrato::Camera&, Vibrato::Renderer&)
+					{
+						scene.objects[i]->position = object.position;
+						scene.objects[i]->materialIndex = object.materialIndex;
+						scene.markObjectDirty((uint32_t)i);
+					});
+				}
+
+				ImGui::Text("");
+				ImGui::Separator();
+
+				ImGui::PopID();
+			}
+			ImGui::TreePop();
+		}
+
+		if (ImGui::TreeNode("Meshes"))
+		{
+			for (size_t i = 0; i < m_meshes.size(); ++i)
+			{
+				ImGui::PushID((int)i);
+				MeshState& mesh = m_meshes[i];
+
+				ImGui::Text("\nMesh %d", (i + 1));
+				ImGui::Text("%u triangles, %u vertices", mesh.triangleCount, mesh.vertexCount);
+				if (ImGui::DragInt("Material", &(mesh.materialIndex), 1.0f, 0, (int)(m_materials.size() - 1)))
+				{
+					m_renderThread->post([i, materialIndex = mesh.materialIndex](Vibrato::Scene& scene, Vibrato::Camera&, Vibrato::Renderer&)
+					{
+						scene.meshes[i]->materialIndex = materialIndex;
+						scene.markMeshDirty((uint32_t)i);
+					});
+				}
 
 				ImGui::Text("");
 				ImGui::Separator();
@@ -129,27 +270,31 @@ public:
 
 		if (ImGui::TreeNode("Materials"))
 		{
-			for (size_t i = 0; i < m_scene.materials.size(); ++i)
+			for (size_t i = 0; i < m_materials.size(); ++i)
 			{
 				ImGui::PushID((int)i);
-				Vibrato::Material& material = m_scene.materials[i];
+				Vibrato::Material& material = m_materials[i];
+				bool changed = false;
 
 				ImGui::Text("\nMaterial Index %d", i);
 
 				if (ImGui::Button("Diffuse"))
 				{
 					material.reset();
+					changed = true;
 				} ImGui::SameLine();
 
 				if (ImGui::Button("Metal"))
 				{
 					material.reset();
+					changed = true;
 					material.roughness = 0.0f;
 				} ImGui::SameLine();
 
 				if (ImGui::Button("Glass"))
 				{
 					material.reset();
+					changed = true;
 					material.albedo.r = 1.0f;
 					material.albedo.g = 1.0f;
 					material.albedo.b = 1.0f;
@@ -160,17 +305,18 @@ public:
 				if (ImGui::TreeNode("Advance"))
 				{
 
-					ImGui::ColorEdit3("Albedo", glm::value_ptr(material.albedo));
-					ImGui::DragFloat("Roughness", &(material.roughness), 0.01f, 0.0f, 1.0f);
-					ImGui::DragFloat("Metallic", &(material.fuzz), 0.01f, 0.0f, 1.0f);
-					ImGui::DragFloat("Refraction Index", &(material.refractiveIndex), 0.01f, 0.0f, FLT_MAX);
+					changed |= ImGui::ColorEdit3("Albedo", glm::value_ptr(material.albedo));
+					changed |= ImGui::DragFloat("Roughness", &(material.roughness), 0.01f, 0.0f, 1.0f);
+					changed |= ImGui::DragFloat("Metallic", &(material.fuzz), 0.01f, 0.0f, 1.0f);
+					changed |= ImGui::DragFloat("Refraction Index", &(material.refractiveIndex), 0.01f, 0.0f, FLT_MAX);
 
-					ImGui::ColorEdit3("Emission Color", glm::value_ptr(material.emissionColor));
-					ImGui::DragFloat("Emission Power", &(material.emissionPower), 0.01f, 0.0f, FLT_MAX);
+					changed |= ImGui::ColorEdit3("Emission Color", glm::value_ptr(material.emissionColor));
+					changed |= ImGui::DragFloat("Emission Power", &(material.emissionPower), 0.01f, 0.0f, FLT_MAX);
 
 					if (ImGui::Button("Reset Material"))
 					{
 						material.reset();
+						changed = true;
 						material.albedo.r = 1.0f;
 						material.albedo.g = 1.0f;
 						material.albedo.b = 1.0f;
@@ -179,6 +325,15 @@ public:
 				}
 
 
+				if (changed)
+				{
+					m_renderThread->post([i, material](Vibrato::Scene& scene, Vibrato::Camera&, Vibrato::Renderer&)
+					{
+						scene.materials[i] = material;
+						scene.markMaterialDirty((uint32_t)i);
+					});
+				}
+
 				ImGui::Text("");
 				ImGui::Separator();
 
@@ -195,7 +350,7 @@ public:
 		m_viewportWidth = (uint32_t)ImGui::GetContentRegionAvail().x;
 		m_viewportHeight = (uint32_t)ImGui::GetContentRegionAvail().y;
 
-		auto image = m_renderer.getFinalImage();
+		auto image = m_image;
 		if (image)
 			ImGui::Image(
 				image->getDescriptorSet(), 
@@ -210,25 +365,55 @@ public:
 		render();
 	}
 
+	// Never waits for the renderer, the viewport shows the newest frame it has finished.
 	void render()
 	{
-		Timer timer;
-
-		m_renderer.onResize(m_viewportWidth, m_viewportHeight);
 		m_camera.onResize(m_viewportWidth, m_viewportHeight);
-		
-		m_renderer.render(m_scene, m_camera);
+		m_renderThread->setViewport(m_viewportWidth, m_viewportHeight);
 
-		m_lastRenderTime = timer.elapsedMillis();
+		m_renderThread->readFrame(m_frameInfo.frameNumber, [this](const uint32_t* pixels, const Vibrato::RenderThread::FrameInfo& info)
+		{
+			if (!m_image)
+				m_image = std::make_shared<Image>(info.width, info.height, ImageFormat::RGBA);
+			else if (m_image->getWidth() != info.width || m_image->getHeight() != info.height)
+				m_image->resize(info.width, info.height);
+
+			// No lock is held here, waiting for a free staging buffer never stalls the render thread
+			m_image->setData(pixels);
+			m_frameInfo = info;
+		});
 	}
 
 private:
+	// Scene panel state, edits are posted to the render thread
+	struct ObjectState
+	{
+		glm::vec3 position;
+		int materialIndex;
+	};
+
+	struct MeshState
+	{
+		int materialIndex;
+		uint32_t triangleCount, vertexCount;
+	};
+
 	Vibrato::Camera m_camera;
-	Vibrato::Renderer m_renderer;
-	Vibrato::Scene m_scene;
-	uint32_t m_viewportWidth = 0, m_viewportHeight = 0;
+	Vibrato::Renderer::Settings m_settings;
+
+	std::string m_scenePath;
+	std::unique_ptr<Vibrato::SceneLoadTask> m_sceneLoad; // until everything in the file has loaded
+	Vibrato::SceneLoadTask::Progress m_loadProgress;
+
+	std::vector<ObjectState> m_objects;
+	std::vector<MeshState> m_meshes;
+	std::vector<Vibrato::Material> m_materials;
 
-	float m_lastRenderTime = 0.0f;
+	std::unique_ptr<Vibrato::RenderThread> m_renderThread;
+	Vibrato::RenderThread::FrameInfo m_frameInfo;
+
+	std::shared_ptr<Image> m_image;
+	uint32_t m_viewportWidth = 0, m_viewportHeight = 0;
 };
 
 Clef::Application* Clef::createApplication(int argc, char** argv)
@@ -237,6 +422,6 @@ Clef::Application* Clef::createApplication(int argc, char** argv)
 	spec.name = "Vibrato";
 
 	Clef::Application* app = new Clef::Application(spec);
-	app->pushLayer<VibratoLayer>();
+	app->pushLayer(std::make_shared<VibratoLayer>(argc > 1 ? argv[1] : "./scenes/default.vscene"));
 	return app;
 }
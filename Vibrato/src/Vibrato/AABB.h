@@ -0,0 +1,79 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <limits>
+#include <cmath>
+
+#include "Ray.h"
+
+namespace Vibrato
+{
+	// Reciprocal ray direction for slab tests. Zero components are nudged away from zero so
+	// (bound - origin) * inverse never turns into 0 * inf = NaN.
+	inline glm::vec3 safeInverse(const glm::vec3& direction)
+	{
+		constexpr float epsilon = 1e-20f;
+		glm::vec3 d = direction;
+		for (int i = 0; i < 3; i++)
+		{
+			if (std::abs(d[i]) < epsilon)
+				d[i] = d[i] < 0.0f ? -epsilon : epsilon;
+		}
+		return 1.0f / d;
+	}
+
+	struct AABB
+	{
+		glm::vec3 min{ std::numeric_limits<float>::max() };
+		glm::vec3 max{ -std::numeric_limits<float>::max() };
+
+		inline void grow(const glm::vec3& p)
+		{
+			min = glm::min(min, p);
+			max = glm::max(max, p);
+		}
+
+		inline void grow(const AABB& other)
+		{
+			min = glm::min(min, other.min);
+			max = glm::max(max, other.max);
+		}
+
+		inline bool isEmpty() const { return min.x > max.x; }
+
+		inline glm::vec3 extent() const { return max - min; }
+		inline glm::vec3 centroid() const { return (min + max) * 0.5f; }
+
+		inline float surfaceArea() const
+		{
+			if (isEmpty())
+				return 0.0f;
+
+			glm::vec3 e = extent();
+			return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+		}
+
+		inline int longestAxis() const
+		{
+			glm::vec3 e = extent();
+			if (e.x > e.y && e.x > e.z) return 0;
+			return e.y > e.z ? 1 : 2;
+		}
+
+		// Slab test, returns the entry distance or FLT_MAX on a miss.
+		inline float intersect(const Ray& ray, const glm::vec3& invDirection, float tMax) const
+		{
+			glm::vec3 t0 = (min - ray.origin) * invDirection;
+			glm::vec3 t1 = (max - ray.origin) * invDirection;
+
+			glm::vec3 tSmall = glm::min(t0, t1);
+			glm::vec3 tLarge = glm::max(t0, t1);
+
+			float tNear = glm::max(glm::max(tSmall.x, tSmall.y), glm::max(tSmall.z, 0.0f));
+			float tFar = glm::min(glm::min(tLarge.x, tLarge.y), glm::min(tLarge.z, tMax));
+
+			return tNear <= tFar ? tNear : std::numeric_limits<float>::max();
+		}
+	};
+}
@@ -0,0 +1,367 @@
+#include "BVH.h"
+
+#include "Clef/Timer.h"
+
+#include <cassert>
+#include <iostream>
+
+namespace Vibrato
+{
+	void BVH::build(PrimitiveStore& store)
+	{
+		Clef::Timer timer;
+
+		clear();
+
+		if (store.size() == 0)
+			return;
+
+		uint32_t primitiveCount = store.size();
+
+		std::vector<BuildPrimitive> primitives(primitiveCount);
+		m_primitiveIndices.resize(primitiveCount);
+		for (uint32_t i = 0; i < primitiveCount; i++)
+		{
+			primitives[i].bounds = store.getBounds(i);
+			primitives[i].centroid = primitives[i].bounds.centroid();
+			m_primitiveIndices[i] = i;
+		}
+
+		// A binary tree over N primitives never has more than 2N - 1 nodes.
+		m_nodes.reserve(primitiveCount * 2);
+
+		Node& root = m_nodes.emplace_back();
+		root.leftFirst = 0;
+		root.count = primitiveCount;
+
+		m_buildStats.primitiveCount = primitiveCount;
+
+		subdivide(0, primitives, 1);
+
+		m_nodes.shrink_to_fit();
+
+		store.reorder(m_primitiveIndices);
+
+		m_buildStats.nodeCount = (uint32_t)m_nodes.size();
+		m_buildStats.sahCost = computeSAHCost();
+		m_buildStats.buildTimeMs = timer.elapsedMillis();
+	}
+
+	void BVH::assign(std::vector<Node> nodes, uint32_t primitiveCount)
+	{
+		clear();
+
+		m_nodes = std::move(nodes);
+		m_primitiveIndices.resize(primitiveCount);
+		for (uint32_t i = 0; i < primitiveCount; i++)
+			m_primitiveIndices[i] = i;
+
+		m_buildStats.primitiveCount = primitiveCount;
+		m_buildStats.nodeCount = (uint32_t)m_nodes.size();
+		for (const Node& node : m_nodes)
+		{
+			if (!node.isLeaf())
+				continue;
+			m_buildStats.leafCount++;
+			m_buildStats.maxLeafSize = std::max(m_buildStats.maxLeafSize, node.count);
+		}
+		m_buildStats.sahCost = computeSAHCost();
+	}
+
+	void BVH::clear()
+	{
+		m_nodes.clear();
+		m_primitiveIndices.clear();
+		m_buildStats = BuildStats();
+	}
+
+	void BVH::refit(const PrimitiveStore& store, const std::vector<uint8_t>& changedPrimitives, std::vector<uint8_t>& changedNodes)
+	{
+		Clef::Timer timer;
+
+		changedNodes.assign(m_nodes.size(), 0);
+
+		// Children are always stored after their parent, so walking backwards refits bottom up.
+		for (uint32_t n = (uint32_t)m_nodes.size(); n-- > 0;)
+		{
+			Node& node = m_nodes[n];
+			if (node.isLeaf())
+			{
+				bool changed = false;
+				for (uint32_t i = 0; i < node.count && !changed; i++)
+					changed = changedPrimitives[m_primitiveIndices[node.leftFirst + i]] != 0;
+				if (!changed)
+					continue;
+
+				node.bounds = AABB();
+				for (uint32_t i = 0; i < node.count; i++)
+					node.bounds.grow(store.getBounds(m_primitiveIndices[node.leftFirst + i]));
+			}
+			else
+			{
+				if (!changedNodes[node.leftFirst] && !changedNodes[node.leftFirst + 1])
+					continue;
+
+				node.bounds = m_nodes[node.leftFirst].bounds;
+				node.bounds.grow(m_nodes[node.leftFirst + 1].bounds);
+			}
+
+			changedNodes[n] = 1;
+		}
+
+		m_buildStats.sahCost = computeSAHCost();
+		m_buildStats.refitCount++;
+		m_buildStats.refitTimeMs = timer.elapsedMillis();
+	}
+
+	void BVH::subdivide(uint32_t nodeIndex, const std::vector<BuildPrimitive>& primitives, uint32_t depth)
+	{
+		// m_nodes may reallocate below, so never hold on to a reference across emplace_back.
+		{
+			Node& node = m_nodes[nodeIndex];
+			for (uint32_t i = 0; i < node.count; i++)
+				node.bounds.grow(primitives[m_primitiveIndices[node.leftFirst + i]].bounds);
+		}
+
+		Node node = m_nodes[nodeIndex];
+
+		int axis = -1;
+		float splitPosition = 0.0f;
+		float splitCost = findBestSplit(node, primitives, axis, splitPosition);
+		float leafCost = INTERSECTION_COST * node.count;
+
+		bool makeLeaf = axis < 0 || (splitCost >= leafCost && node.count <= MAX_LEAF_SIZE);
+
+		uint32_t first = node.leftFirst;
+		uint32_t last = first + node.count;
+		uint32_t mid = first;
+
+		if (!makeLeaf)
+		{
+			// Partition primitive indices around the split plane.
+			uint32_t i = first;
+			uint32_t j = last;
+			while (i < j)
+			{
+				if (primitives[m_primitiveIndices[i]].centroid[axis] < splitPosition)
+					i++;
+				else
+					std::swap(m_primitiveIndices[i], m_primitiveIndices[--j]);
+			}
+			mid = i;
+
+			makeLeaf = mid == first || mid == last;
+		}
+
+		if (makeLeaf)
+		{
+			m_buildStats.leafCount++;
+			m_buildStats.maxDepth = std::max(m_buildStats.maxDepth, depth);
+			m_buildStats.maxLeafSize = std::max(m_buildStats.maxLeafSize, node.count);
+			return;
+		}
+
+		uint32_t leftIndex = (uint32_t)m_nodes.size();
+
+		Node& left = m_nodes.emplace_back();
+		left.leftFirst = first;
+		left.count = mid - first;
+
+		Node& right = m_nodes.emplace_back();
+		right.leftFirst = mid;
+		right.count = last - mid;
+
+		m_nodes[nodeIndex].leftFirst = leftIndex;
+		m_nodes[nodeIndex].count = 0;
+
+		subdivide(leftIndex, primitives, depth + 1);
+		subdivide(leftIndex + 1, primitives, depth + 1);
+	}
+
+	float BVH::findBestSplit(const Node& node, const std::vector<BuildPrimitive>& primitives, int& axis, float& splitPosition) const
+	{
+		float bestCost = std::numeric_limits<float>::max();
+
+		if (node.count < 2)
+			return bestCost;
+
+		AABB centroidBounds;
+		for (uint32_t i = 0; i < node.count; i++)
+			centroidBounds.grow(primitives[m_primitiveIndices[node.leftFirst + i]].centroid);
+
+		float parentArea = node.bounds.surfaceArea();
+
+		for (int a = 0; a < 3; a++)
+		{
+			float boundsMin = centroidBounds.min[a];
+			float boundsMax = centroidBounds.max[a];
+			if (boundsMin == boundsMax)
+				continue;
+
+			struct Bin
+			{
+				AABB bounds;
+				uint32_t count = 0;
+			} bins[SAH_BINS];
+
+			float scale = SAH_BINS / (boundsMax - boundsMin);
+			for (uint32_t i = 0; i < node.count; i++)
+			{
+				const BuildPrimitive& primitive = primitives[m_primitiveIndices[node.leftFirst + i]];
+				int binIndex = std::min(SAH_BINS - 1, (int)((primitive.centroid[a] - boundsMin) * scale));
+				bins[binIndex].count++;
+				bins[binIndex].bounds.grow(primitive.bounds);
+			}
+
+			// Sweep from both sides to get the area and count of every split candidate.
+			float leftArea[SAH_BINS - 1], rightArea[SAH_BINS - 1];
+			uint32_t leftCount[SAH_BINS - 1], rightCount[SAH_BINS - 1];
+
+			AABB leftBounds, rightBounds;
+			uint32_t leftSum = 0, rightSum = 0;
+			for (int i = 0; i < SAH_BINS - 1; i++)
+			{
+				leftSum += bins[i].count;
+				leftCount[i] = leftSum;
+				leftBounds.grow(bins[i].bounds);
+				leftArea[i] = leftBounds.surfaceArea();
+
+				rightSum += bins[SAH_BINS - 1 - i].count;
+				rightCount[SAH_BINS - 2 - i] = rightSum;
+				rightBounds.grow(bins[SAH_BINS - 1 - i].bounds);
+				rightArea[SAH_BINS - 2 - i] = rightBounds.surfaceArea();
+			}
+
+			float binWidth = (boundsMax - boundsMin) / SAH_BINS;
+			for (int i = 0; i < SAH_BINS - 1; i++)
+			{
+				if (leftCount[i] == 0 || rightCount[i] == 0)
+					continue;
+
+				float cost = TRAVERSAL_COST + INTERSECTION_COST * (leftCount[i] * leftArea[i] + rightCount[i] * rightArea[i]) / parentArea;
+				if (cost < bestCost)
+				{
+					bestCost = cost;
+					axis = a;
+					splitPosition = boundsMin + binWidth * (i + 1);
+				}
+			}
+		}
+
+		return bestCost;
+	}
+
+	float BVH::computeSAHCost() const
+	{
+		if (m_nodes.empty())
+			return 0.0f;
+
+		float rootArea = m_nodes[0].bounds.surfaceArea();
+		if (rootArea <= 0.0f)
+			return 0.0f;
+
+		float cost = 0.0f;
+		for (const Node& node : m_nodes)
+		{
+			float relativeArea = node.bounds.surfaceArea() / rootArea;
+			if (node.isLeaf())
+				cost += INTERSECTION_COST * node.count * relativeArea;
+			else
+				cost += TRAVERSAL_COST * relativeArea;
+		}
+
+		return cost;
+	}
+
+	bool BVH::intersect(const Ray& ray, const PrimitiveStore& primitives, float& hitDistance, uint32_t& primitiveIndex) const
+	{
+		if (m_nodes.empty())
+			return false;
+
+		TraversalStats& stats = threadTraversalStats();
+		stats.rays++;
+
+		glm::vec3 invDirection = safeInverse(ray.direction);
+
+		bool hit = false;
+
+		// Holds at most one entry per tree level
+		constexpr uint32_t STACK_SIZE = 64;
+		uint32_t stack[STACK_SIZE];
+		uint32_t stackSize = 0;
+
+		const Node* node = &m_nodes[0];
+		if (node->bounds.intersect(ray, invDirection, hitDistance) == std::numeric_limits<float>::max())
+			return false;
+
+		while (true)
+		{
+			stats.nodesVisited++;
+
+			if (node->isLeaf())
+			{
+				for (uint32_t i = 0; i < node->count; i++)
+				{
+					uint32_t id = m_primitiveIndices[node->leftFirst + i];
+					float t = primitives.intersect(id, ray);
+					if (t > 0.0f && t < hitDistance)
+					{
+						hitDistance = t;
+						primitiveIndex = id;
+						hit = true;
+					}
+				}
+				stats.primitiveTests += node->count;
+
+				if (stackSize == 0)
+					break;
+				node = &m_nodes[stack[--stackSize]];
+				continue;
+			}
+
+			// Visit the nearer child first and keep the other one for later.
+			uint32_t nearIndex = node->leftFirst;
+			uint32_t farIndex = node->leftFirst + 1;
+			float tNear = m_nodes[nearIndex].bounds.intersect(ray, invDirection, hitDistance);
+			float tFar = m_nodes[farIndex].bounds.intersect(ray, invDirection, hitDistance);
+
+			if (tFar < tNear)
+			{
+				std::swap(tNear, tFar);
+				std::swap(nearIndex, farIndex);
+			}
+
+			if (tNear == std::numeric_limits<float>::max())
+			{
+				if (stackSize == 0)
+					break;
+				node = &m_nodes[stack[--stackSize]];
+				continue;
+			}
+
+			node = &m_nodes[nearIndex];
+			if (tFar != std::numeric_limits<float>::max())
+			{
+				assert(stackSize < STACK_SIZE && "traversal stack overflow");
+				stack[stackSize++] = farIndex;
+			}
+		}
+
+		return hit;
+	}
+
+	BVH::TraversalStats& BVH::threadTraversalStats()
+	{
+		static thread_local TraversalStats s_stats;
+		return s_stats;
+	}
+
+	void BVH::printReport() const
+	{
+		const BuildStats& s = m_buildStats;
+		std::cout << "> BVH built over " << s.primitiveCount << " primitives in " << s.buildTimeMs << "ms\n"
+			<< "    nodes: " << s.nodeCount << ", leaves: " << s.leafCount
+			<< ", max depth: " << s.maxDepth << ", max leaf size: " << s.maxLeafSize << "\n"
+			<< "    SAH cost: " << s.sahCost << " (linear loop: " << s.primitiveCount << ")\n\n";
+	}
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include "AABB.h"
+#include "PrimitiveStore.h"
+#include "Ray.h"
+
+#include <vector>
+
+namespace Vibrato
+{
+	class BVH
+	{
+	public:
+		struct Node
+		{
+			AABB bounds;
+			uint32_t leftFirst = 0; // left child index for interior nodes, first primitive for leaves
+			uint32_t count = 0;     // 0 for interior nodes
+
+			inline bool isLeaf() const { return count > 0; }
+		};
+
+		struct BuildStats
+		{
+			uint32_t primitiveCount = 0;
+			uint32_t nodeCount = 0;
+			uint32_t leafCount = 0;
+			uint32_t maxDepth = 0;
+			uint32_t maxLeafSize = 0;
+			float sahCost = 0.0f; // expected cost of a random ray, relative to one primitive test
+			float buildTimeMs = 0.0f;
+
+			// Since the last build
+			uint32_t refitCount = 0;
+			float refitTimeMs = 0.0f; // of the last refit
+		};
+
+		struct TraversalStats
+		{
+			uint64_t rays = 0;
+			uint64_t nodesVisited = 0;
+			uint64_t primitiveTests = 0;
+		};
+
+	public:
+		BVH() = default;
+
+		// Also reorders the store so primitives are laid out in leaf order.
+		void build(PrimitiveStore& store);
+		// Takes over nodes built earlier (e.g. loaded from a cache) over primitiveCount primitives that are already in leaf order.
+		void assign(std::vector<Node> nodes, uint32_t primitiveCount);
+		void clear();
+		// Recomputes the bounds of the leaves holding a primitive flagged in changedPrimitives (indexed by id)
+		// and of their ancestors, keeping the tree as it is. Flags every node whose bounds were recomputed in changedNodes.
+		void refit(const PrimitiveStore& store, const std::vector<uint8_t>& changedPrimitives, std::vector<uint8_t>& changedNodes);
+
+		// Closest hit over the primitives the hierarchy was built from.
+		// Returns false when nothing in (0, hitDistance) was hit.
+		bool intersect(const Ray& ray, const PrimitiveStore& primitives, float& hitDistance, uint32_t& primitiveIndex) const;
+
+		inline bool isEmpty() const { return m_nodes.empty(); }
+
+		inline const std::vector<Node>& getNodes() const { return m_nodes; }
+		inline const std::vector<uint32_t>& getPrimitiveIndices() const { return m_primitiveIndices; }
+
+		inline const BuildStats& getBuildStats() const { return m_buildStats; }
+
+		// Counters for the calling thread, the renderer sums them per row.
+		static TraversalStats& threadTraversalStats();
+
+		void printReport() const;
+
+	private:
+		struct BuildPrimitive
+		{
+			AABB bounds;
+			glm::vec3 centroid;
+		};
+
+		void subdivide(uint32_t nodeIndex, const std::vector<BuildPrimitive>& primitives, uint32_t depth);
+		float findBestSplit(const Node& node, const std::vector<BuildPrimitive>& primitives, int& axis, float& splitPosition) const;
+		float computeSAHCost() const;
+
+	private:
+		std::vector<Node> m_nodes;
+		std::vector<uint32_t> m_primitiveIndices;
+
+		BuildStats m_buildStats;
+
+		static constexpr int SAH_BINS = 16;
+		static constexpr uint32_t MAX_LEAF_SIZE = 8;
+		static constexpr float TRAVERSAL_COST = 1.0f;
+		static constexpr float INTERSECTION_COST = 1.0f;
+	};
+}
@@ -1,14 +1,20 @@
 #include "Camera.h"
 
+#include <glm/gtc/constants.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/quaternion.hpp>
 #include <glm/gtx/quaternion.hpp>
 
+#ifndef VIBRATO_HEADLESS
 #include "Clef/Input/Input.h"
+#endif
 
-#include "Utils.h"
+#include <algorithm>
+#include <cmath>
 
+#ifndef VIBRATO_HEADLESS
 using namespace Clef;
+#endif
 
 namespace Vibrato
 {
@@ -21,6 +27,10 @@ namespace Vibrato
 
 	bool Camera::onUpdate(float ts)
 	{
+#ifdef VIBRATO_HEADLESS
+		// No window and no input devices in headless builds.
+		return false;
+#else
 		glm::vec2 mousePos = Input::getMousePosition();
 		glm::vec2 delta = (mousePos - m_lastMousePosition) * 0.002f;
 		m_lastMousePosition = mousePos;
@@ -92,10 +102,11 @@ namespace Vibrato
 		if (moved)
 		{
 			recalculateView();
-			recalculateRayDirections();
+			recalculateFilm();
 		}
 
 		return moved;
+#endif
 	}
 
 	void Camera::onResize(uint32_t width, uint32_t height)
@@ -107,7 +118,71 @@ namespace Vibrato
 		m_viewportHeight = height;
 
 		recalculateProjection();
-		recalculateRayDirections();
+		recalculateFilm();
+	}
+
+	void Camera::setView(const glm::vec3& position, const glm::vec3& forwardDirection)
+	{
+		m_position = position;
+		m_forwardDirection = glm::normalize(forwardDirection);
+
+		recalculateView();
+		recalculateFilm();
+	}
+
+	void Camera::setVerticalFOV(float verticalFOV)
+	{
+		m_verticalFOV = verticalFOV;
+
+		if (m_viewportWidth == 0 || m_viewportHeight == 0)
+			return;
+
+		recalculateProjection();
+		recalculateFilm();
+	}
+
+	void Camera::setLens(float aperture, float focusDistance)
+	{
+		m_aperture = std::max(aperture, 0.0f);
+		m_focusDistance = std::max(focusDistance, 0.001f);
+	}
+
+	Ray Camera::generateRay(const glm::vec2& filmPosition, const glm::vec2& lensSample) const
+	{
+		// The film sits at unit distance along the view direction
+		glm::vec3 direction = m_filmCorner + filmPosition.x * m_pixelRight + filmPosition.y * m_pixelUp;
+
+		Ray ray;
+		ray.origin = m_position;
+		ray.direction = glm::normalize(direction);
+		if (m_aperture <= 0.0f)
+			return ray;
+
+		// Concentric disk mapping (Shirley and Chiu), keeps the sample's stratification on the lens
+		glm::vec2 offset = lensSample * 2.0f - 1.0f;
+		glm::vec2 disk(0.0f);
+		if (offset.x != 0.0f || offset.y != 0.0f)
+		{
+			float radius, theta;
+			if (std::abs(offset.x) > std::abs(offset.y))
+			{
+				radius = offset.x;
+				theta = glm::quarter_pi<float>() * (offset.y / offset.x);
+			}
+			else
+			{
+				radius = offset.y;
+				theta = glm::half_pi<float>() - glm::quarter_pi<float>() * (offset.x / offset.y);
+			}
+			disk = radius * glm::vec2(std::cos(theta), std::sin(theta));
+		}
+		disk *= 0.5f * m_aperture;
+
+		// Every ray through this film point meets at the focus plane
+		glm::vec3 focusPoint = m_position + direction * m_focusDistance;
+		ray.origin = m_position + disk.x * glm::normalize(m_pixelRight) + disk.y * glm::normalize(m_pixelUp);
+		ray.direction = glm::normalize(focusPoint - ray.origin);
+		return ray;
 	}
 
 	float Camera::getRotationSpeed()
@@ -127,26 +202,20 @@ namespace Vibrato
 		m_inverseView = glm::inverse(m_view);
 	}
 
-	void Camera::recalculateRayDirections()
+	void Camera::recalculateFilm()
 	{
-		m_rayDirections.resize(m_viewportWidth * m_viewportHeight);
+		if (m_viewportWidth == 0 || m_viewportHeight == 0)
+			return;
 
-		for (uint32_t y = 0; y < m_viewportHeight; y++)
+		// Unprojected points of one depth lie on a plane, so three corners describe the whole film.
+		auto filmPoint = [this](float x, float y)
 		{
-			for (uint32_t x = 0; x < m_viewportWidth; x++)
-			{
-				uint32_t seed = x + y * m_viewportWidth;
-				float jx = (float)x + Utils::randomFloat(seed);
-				float jy = (float)y + Utils::randomFloat(seed);
-
-				glm::vec2 coord = { (float)jx / (float)m_viewportWidth, (float)jy / (float)m_viewportHeight };
-				coord = coord * 2.0f - 1.0f; // -1 -> 1
+			glm::vec4 target = m_inverseProjection * glm::vec4(x, y, 1, 1);
+			return glm::vec3(m_inverseView * glm::vec4(glm::vec3(target) / -target.z, 0)); // World space
+		};
 
-				glm::vec4 target = m_inverseProjection * glm::vec4(coord.x, coord.y, 1, 1);
-				glm::vec3 rayDirection = glm::vec3(m_inverseView * glm::vec4(glm::normalize(glm::vec3(target) / target.w), 0)); // World space
-
-				m_rayDirections[x + y * m_viewportWidth] = rayDirection;
-			}
-		}
+		m_filmCorner = filmPoint(-1.0f, -1.0f);
+		m_pixelRight = (filmPoint(1.0f, -1.0f) - m_filmCorner) / (float)m_viewportWidth;
+		m_pixelUp = (filmPoint(-1.0f, 1.0f) - m_filmCorner) / (float)m_viewportHeight;
 	}
 }
@@ -1,7 +1,8 @@
 #pragma once
 
+#include "Ray.h"
+
 #include <glm/glm.hpp>
-#include <vector>
 
 namespace Vibrato
 {
@@ -13,6 +14,13 @@ namespace Vibrato
 		bool onUpdate(float ts);
 		void onResize(uint32_t width, uint32_t height);
 
+		// Places the camera directly, for renders without input.
+		void setView(const glm::vec3& position, const glm::vec3& forwardDirection);
+		void setVerticalFOV(float verticalFOV);
+		// Thin lens, aperture is the lens diameter in world units, 0 for a pinhole.
+		// Points focusDistance in front of the camera (along its direction) are sharp.
+		void setLens(float aperture, float focusDistance);
+
 		inline const glm::mat4& getProjection() const { return m_projection; }
 		inline const glm::mat4& getInverseProjection() const { return m_inverseProjection; }
 		inline const glm::mat4& getView() const { return m_view; }
@@ -20,17 +28,28 @@ namespace Vibrato
 
 		inline const glm::vec3& getPosition() const { return m_position; }
 		inline const glm::vec3& getDirection() const { return m_forwardDirection; }
+		inline float getVerticalFOV() const { return m_verticalFOV; }
+		inline float getAperture() const { return m_aperture; }
+		inline float getFocusDistance() const { return m_focusDistance; }
+
+		// World space ray through a point on the film, in pixels from the bottom left corner of the viewport,
+		// from a point on the lens, lensSample in [0, 1)^2.
+		Ray generateRay(const glm::vec2& filmPosition, const glm::vec2& lensSample) const;
 
-		inline const std::vector<glm::vec3>& getRayDirections() const { return m_rayDirections; }
-		
 		float getRotationSpeed();
 	private:
 		void recalculateProjection();
 		void recalculateView();
-		void recalculateRayDirections();
+		void recalculateFilm();
 
 	private:
-		std::vector<glm::vec3> m_rayDirections;
+		// The film at unit distance in world space, rays are generated from it per sample.
+		glm::vec3 m_filmCorner{ 0.0f };
+		glm::vec3 m_pixelRight{ 0.0f };
+		glm::vec3 m_pixelUp{ 0.0f };
+
+		float m_aperture = 0.0f;
+		float m_focusDistance = 5.0f;
 
 		glm::mat4 m_projection{ 1.0f };
 		glm::mat4 m_view{ 1.0f };
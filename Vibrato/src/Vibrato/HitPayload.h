@@ -1,7 +1,10 @@
 #pragma once
 
+#include <glm/vec2.hpp>
 #include <glm/vec3.hpp>
 
+#include <cstdint>
+
 struct HitPayload
 {
 	glm::vec3 position;
@@ -10,4 +13,15 @@ struct HitPayload
 	bool frontFace;
 	glm::vec3 AOV;
 	int objectIndex;
+	int materialIndex;
+	uint32_t primitiveIndex; // id in the scene's PrimitiveStore, UINT32_MAX on mesh instances
+};
+
+// Closest hit found by traversal, turned into a HitPayload by Renderer::closestHit.
+struct RayHit
+{
+	float distance;
+	uint32_t primitiveIndex;
+	glm::vec2 barycentrics; // weights of the second and third vertex for triangles
+	uint32_t instance = UINT32_MAX; // TLAS instance the primitive belongs to, UINT32_MAX for the scene's own
 };
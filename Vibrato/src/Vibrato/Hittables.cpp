@@ -1,9 +1,53 @@
 #include "Hittables.h"
 
+#include "BVH.h"
+#include "MeshCache.h"
+#include "ObjLoader.h"
+#include "PrimitiveStore.h"
+#include "Utils.h"
+
+#include <algorithm>
 #include <iostream>
 
 namespace Vibrato
 {
+	// Two-sided Moller-Trumbore, returns -1 on a miss. u and v weight the second and third vertex.
+	static float rayTriangleIntersect(const Ray& ray, const glm::vec3& v0, const glm::vec3& e1, const glm::vec3& e2, float& u, float& v)
+	{
+		glm::vec3 pvec = glm::cross(ray.direction, e2);
+		float det = glm::dot(e1, pvec);
+
+		if (std::abs(det) < 1e-12f) return -1.0f;
+
+		float inv_det = 1.0f / det;
+		glm::vec3 tvec = ray.origin - v0;
+		u = glm::dot(tvec, pvec) * inv_det;
+
+		if (u < 0.0f || u > 1.0f) return -1.0f;
+
+		glm::vec3 qvec = glm::cross(tvec, e1);
+		v = glm::dot(ray.direction, qvec) * inv_det;
+
+		if (v < 0.0f || u + v > 1.0f) return -1.0f;
+
+		return glm::dot(e2, qvec) * inv_det;
+	}
+
+	// Barycentric coordinates of p (relative to v0) in the triangle spanned by e1 and e2.
+	static glm::vec3 barycentric(const glm::vec3& p, const glm::vec3& e1, const glm::vec3& e2)
+	{
+		float d00 = glm::dot(e1, e1);
+		float d01 = glm::dot(e1, e2);
+		float d11 = glm::dot(e2, e2);
+		float d20 = glm::dot(p, e1);
+		float d21 = glm::dot(p, e2);
+		float d = d00 * d11 - d01 * d01;
+		float v = (d11 * d20 - d01 * d21) / d;
+		float w = (d00 * d21 - d01 * d20) / d;
+		float u = 1 - v - w;
+		return glm::vec3(u, v, w);
+	}
+
 	float Sphere::intersect(const Ray& ray) const
 	{
 		glm::vec3 origin = ray.origin - position;
@@ -28,6 +72,14 @@ namespace Vibrato
 		payload.normal = payload.frontFace ? outwardNormal : -outwardNormal;
 	}
 
+	AABB Sphere::getBounds() const
+	{
+		AABB bounds;
+		bounds.grow(position - glm::vec3(radius));
+		bounds.grow(position + glm::vec3(radius));
+		return bounds;
+	}
+
 	Triangle::Triangle(Vertex _v0, Vertex _v1, Vertex _v2)
 	{
 		v0 = _v0.P;
@@ -48,41 +100,13 @@ namespace Vibrato
 
 	float Triangle::intersect(const Ray& ray) const
 	{
-		float u, v, t = 0.0f;
-
-		glm::vec3 pvec = glm::cross(ray.direction, e2);
-		float det = glm::dot(e1, pvec);
-
-		if (det < 0.0f) return t;
-		
-		float inv_det = 1.0f / det;
-		glm::vec3 tvec = ray.origin - v0;
-		u = glm::dot(tvec, pvec) * inv_det;
-		
-		if (u < 0.0f || u > 1.0f) return t;
-		
-		glm::vec3 qvec = glm::cross(tvec, e1);
-		v = glm::dot(ray.direction, qvec) * inv_det;
-		
-		if (v < 0.0f || u + v > 1.0f) return t;
-		
-		t = glm::dot(e2, qvec) * inv_det;
-		return t;
+		float u, v;
+		return rayTriangleIntersect(ray, v0, e1, e2, u, v);
 	}
 
 	glm::vec3 Triangle::getBarycentric(glm::vec3& p) const
 	{
-		glm::vec3 v2_ = p - v0;
-		float d00 = glm::dot(e1, e1);
-		float d01 = glm::dot(e1, e2);
-		float d11 = glm::dot(e2, e2);
-		float d20 = glm::dot(v2_, e1);
-		float d21 = glm::dot(v2_, e2);
-		float d = d00 * d11 - d01 * d01;
-		float v = (d11 * d20 - d01 * d21) / d;
-		float w = (d00 * d21 - d01 * d20) / d;
-		float u = 1 - v - w;
-		return glm::vec3(u, v, w);
+		return barycentric(p - v0, e1, e2);
 	}
 
 	void Triangle::setHitPayload(const Ray& ray, HitPayload& payload) const
@@ -91,7 +115,10 @@ namespace Vibrato
 		// payload.normal = this->n;
 	
 		glm::vec3 bary = getBarycentric(payload.position);
+		payload.frontFace = glm::dot(ray.direction, n) < 0;
 		payload.normal = glm::normalize((bary.x * N[0]) + (bary.y * N[1]) + bary.z * N[2]);
+		if (!payload.frontFace)
+			payload.normal = -payload.normal;
 
 		glm::vec2 ST = bary.x * uv[0] + bary.y * uv[1] + bary.z * uv[2];
 		payload.AOV = glm::vec3(ST.x, ST.y, 0.0f);
@@ -99,112 +126,201 @@ namespace Vibrato
 		payload.AOV = bary;
 	}
 
-	TriangleMesh::TriangleMesh(const char* filePath)
+	AABB Triangle::getBounds() const
 	{
-		std::string inputfile = filePath;
-		unsigned long pos = inputfile.find_last_of("/");
-		std::string mtlbasepath = inputfile.substr(0, pos + 1);
+		AABB bounds;
+		bounds.grow(v0);
+		bounds.grow(v1);
+		bounds.grow(v2);
+		return bounds;
+	}
 
-		tinyobj::attrib_t attributes;
-		std::vector<tinyobj::shape_t> shapes;
-		std::vector<tinyobj::material_t> materials;
-		std::string warnings;
-		std::string errors;
+	TriangleMesh::TriangleMesh(const char* filePath)
+	{
+		std::string error;
+		if (!load(filePath, error))
+			std::cout << "> Failed to load " << filePath << ": " << error << std::endl;
+	}
 
-		bool ret = tinyobj::LoadObj(&attributes, &shapes, &materials, &warnings, &errors, inputfile.c_str(), mtlbasepath.c_str());
-		if (!warnings.empty())
-		{
-			std::cout << "Warning: " << warnings << std::endl;
-		}
+	bool TriangleMesh::load(const std::string& filePath, std::string& error, bool withHierarchy)
+	{
+		const std::string& inputfile = filePath;
 
-		if (!errors.empty())
+		if (MeshCache::load(inputfile, *this))
 		{
-			std::cerr << "Error: " << errors << std::endl;
-		}
+			// Cached while the mesh was not instanced yet
+			if (withHierarchy && !hierarchy)
+			{
+				buildHierarchy();
+				MeshCache::save(inputfile, *this);
+			}
 
-		if (!ret)
-		{
-			exit(1);
+			std::cout << "> Loaded " << inputfile << " from " << MeshCache::getCachePath(inputfile) << "! "
+				<< getTriangleCount() << " triangles, " << getVertexCount() << " vertices, "
+				<< getMemoryUsage() / 1024 << "KB\n\n";
+			return true;
 		}
 
-		std::vector<Vertex> vertices;
+		if (!ObjLoader::load(inputfile, *this, error))
+			return false;
 
-		// Loop over shapes
-		for (size_t s = 0; s < shapes.size(); s++)
+		// Smooth normals for vertices the file did not provide one for
+		if (std::find(normals.begin(), normals.end(), glm::vec3(0.0f)) != normals.end())
 		{
-			// Loop over faces(triangles)
-			size_t index_offset = 0;
-			for (size_t f = 0; f < shapes[s].mesh.num_face_vertices.size(); f++)
+			std::vector<glm::vec3> accumulated(positions.size(), glm::vec3(0.0f));
+			for (uint32_t t = 0; t < getTriangleCount(); t++)
 			{
-				int fv = shapes[s].mesh.num_face_vertices[f];
-
-				// Loop over vertices in the face.
-				for (size_t v = 0; v < fv; v++)
-				{
-					// access to vertex
-					tinyobj::index_t idx = shapes[s].mesh.indices[index_offset + v];
-					tinyobj::real_t vx = attributes.vertices[3 * idx.vertex_index + 0];
-					tinyobj::real_t vy = attributes.vertices[3 * idx.vertex_index + 1];
-					tinyobj::real_t vz = attributes.vertices[3 * idx.vertex_index + 2];
-					tinyobj::real_t nx = attributes.normals[3 * idx.normal_index + 0];
-					tinyobj::real_t ny = attributes.normals[3 * idx.normal_index + 1];
-					tinyobj::real_t nz = attributes.normals[3 * idx.normal_index + 2];
-					tinyobj::real_t tx = attributes.texcoords[2 * idx.texcoord_index + 0];
-					tinyobj::real_t ty = attributes.texcoords[2 * idx.texcoord_index + 1];
-
-					Vertex vert;
-					vert.P = glm::vec3(vx, vy, vz);
-					vert.Ng = glm::vec3(nx, ny, nz);
-					vert.UV = glm::vec2(tx, ty);
-					vertices.push_back(vert);
-
-				}
-				index_offset += fv;
+				uint32_t i0 = indices[t * 3 + 0], i1 = indices[t * 3 + 1], i2 = indices[t * 3 + 2];
+				glm::vec3 faceNormal = glm::cross(positions[i1] - positions[i0], positions[i2] - positions[i0]); // area weighted
+				accumulated[i0] += faceNormal;
+				accumulated[i1] += faceNormal;
+				accumulated[i2] += faceNormal;
 			}
-		}
 
-		// Loops vertices
-		for (int i = 0; i < vertices.size() / 3; ++i)
-		{
-			triangles.push_back(std::make_shared<Triangle>(vertices[i * 3], vertices[i * 3 + 1], vertices[i * 3 + 2]));
+			for (size_t v = 0; v < positions.size(); v++)
+			{
+				if (normals[v] == glm::vec3(0.0f) && glm::dot(accumulated[v], accumulated[v]) > 0.0f)
+					normals[v] = glm::normalize(accumulated[v]);
+			}
 		}
 
-		std::cout << "> Successfully opened " << inputfile << "! \n\n";
+		if (withHierarchy)
+			buildHierarchy();
+		if (!MeshCache::save(inputfile, *this))
+			std::cout << "> Could not write " << MeshCache::getCachePath(inputfile) << ", the mesh will be parsed again next time." << std::endl;
 
-		shapes.clear();
-		materials.clear();
+		std::cout << "> Successfully opened " << inputfile << "! "
+			<< getTriangleCount() << " triangles, " << getVertexCount() << " vertices, "
+			<< getMemoryUsage() / 1024 << "KB\n\n";
+		return true;
+	}
+
+	uint32_t TriangleMesh::addVertex(const Vertex& vertex)
+	{
+		positions.push_back(vertex.P);
+		normals.push_back(vertex.Ng);
+		uvs.push_back(vertex.UV);
+		return (uint32_t)(positions.size() - 1);
 	}
 
-	/*float TriangleMesh::intersect(const Ray& r) const
+	void TriangleMesh::addTriangle(uint32_t i0, uint32_t i1, uint32_t i2)
 	{
-		float t = 0.0f;
-		long triangles_size = tris.size();
-		for (long i = 0; i < triangles_size; ++i)
+		indices.push_back(i0);
+		indices.push_back(i1);
+		indices.push_back(i2);
+	}
+
+	bool TriangleMesh::intersect(const Ray& ray, RayHit& hit) const
+	{
+		bool found = false;
+
+		uint32_t triangleCount = getTriangleCount();
+		for (uint32_t i = 0; i < triangleCount; i++)
 		{
-			t = tris[i]->intersect(r);
-			if (t)
+			glm::vec2 barycentrics;
+			float t = intersectTriangle(i, ray, barycentrics);
+			if (t > 0.0f && t < hit.distance)
 			{
-				return t;
+				hit.distance = t;
+				hit.primitiveIndex = i;
+				hit.barycentrics = barycentrics;
+				found = true;
 			}
 		}
-		return -1.0f;
+
+		return found;
 	}
 
-	void TriangleMesh::setHitPayload(const Ray& ray, HitPayload& payload) const
+	float TriangleMesh::intersectTriangle(uint32_t triangle, const Ray& ray, glm::vec2& barycentrics) const
 	{
-		long triangles_size = tris.size();
-		for (long i = 0; i < triangles_size; ++i)
+		const glm::vec3& v0 = positions[indices[triangle * 3 + 0]];
+		const glm::vec3& v1 = positions[indices[triangle * 3 + 1]];
+		const glm::vec3& v2 = positions[indices[triangle * 3 + 2]];
+
+		return rayTriangleIntersect(ray, v0, v1 - v0, v2 - v0, barycentrics.x, barycentrics.y);
+	}
+
+	void TriangleMesh::setHitPayload(uint32_t triangle, const Ray& ray, const glm::vec2& barycentrics, HitPayload& payload) const
+	{
+		uint32_t i0 = indices[triangle * 3 + 0];
+		uint32_t i1 = indices[triangle * 3 + 1];
+		uint32_t i2 = indices[triangle * 3 + 2];
+
+		glm::vec3 e1 = positions[i1] - positions[i0];
+		glm::vec3 e2 = positions[i2] - positions[i0];
+
+		glm::vec3 bary(1.0f - barycentrics.x - barycentrics.y, barycentrics.x, barycentrics.y);
+
+		// Triangles are two-sided, shading normals face the incoming ray like the sphere ones do
+		payload.frontFace = glm::dot(ray.direction, glm::cross(e1, e2)) < 0;
+		payload.normal = glm::normalize((bary.x * normals[i0]) + (bary.y * normals[i1]) + bary.z * normals[i2]);
+		if (!payload.frontFace)
+			payload.normal = -payload.normal;
+		payload.AOV = bary;
+	}
+
+	AABB TriangleMesh::getBounds() const
+	{
+		AABB bounds;
+		for (const glm::vec3& position : positions)
+			bounds.grow(position);
+		return bounds;
+	}
+
+	AABB TriangleMesh::getTriangleBounds(uint32_t triangle) const
+	{
+		AABB bounds;
+		bounds.grow(positions[indices[triangle * 3 + 0]]);
+		bounds.grow(positions[indices[triangle * 3 + 1]]);
+		bounds.grow(positions[indices[triangle * 3 + 2]]);
+		return bounds;
+	}
+
+	void TriangleMesh::buildHierarchy()
+	{
+		if (getTriangleCount() == 0)
+			return;
+
+		// The store only needs the mesh while building, it must not own it
+		std::shared_ptr<TriangleMesh> self(this, [](TriangleMesh*) {});
+
+		PrimitiveStore store;
+		store.build({}, { self });
+
+		std::shared_ptr<BVH> bvh = std::make_shared<BVH>();
+		bvh->build(store);
+
+		// The build left the store in leaf order, the mesh follows it so both number triangles the same
+		std::vector<uint32_t> sorted(indices.size());
+		for (uint32_t t = 0; t < getTriangleCount(); t++)
 		{
-			if (tris[i]->intersect(ray))
-			{
-				glm::vec3 bary = tris[i]->getBarycentric(payload.position);
-				payload.normal = glm::normalize((bary.x * tris[i]->N[0]) + (bary.y * tris[i]->N[1]) + bary.z * tris[i]->N[2]);
+			uint32_t source = store.getTriangleSource(t).triangle;
+			sorted[t * 3 + 0] = indices[source * 3 + 0];
+			sorted[t * 3 + 1] = indices[source * 3 + 1];
+			sorted[t * 3 + 2] = indices[source * 3 + 2];
+		}
+		indices.swap(sorted);
 
-				glm::vec2 ST = bary.x * tris[i]->uv[0] + bary.y * tris[i]->uv[1] + bary.z * tris[i]->uv[2];
-				payload.AOV = glm::vec3(ST.x, ST.y, 0.0f);
-				payload.AOV = glm::normalize((bary.x * tris[i]->N[0]) + (bary.y * tris[i]->N[1]) + bary.z * tris[i]->N[2]);
-				payload.AOV = bary;
-			}
-		}	
-	}*/
+		hierarchy = bvh;
+		hierarchyGeometry = getGeometryHash();
+	}
+
+	bool TriangleMesh::hasCurrentHierarchy() const
+	{
+		return hierarchy && hierarchyGeometry == getGeometryHash();
+	}
+
+	uint64_t TriangleMesh::getGeometryHash() const
+	{
+		uint64_t hash = Utils::hashBytes(positions.data(), positions.size() * sizeof(glm::vec3));
+		return Utils::hashBytes(indices.data(), indices.size() * sizeof(uint32_t), hash);
+	}
+
+	size_t TriangleMesh::getMemoryUsage() const
+	{
+		return positions.capacity() * sizeof(glm::vec3)
+			+ normals.capacity() * sizeof(glm::vec3)
+			+ uvs.capacity() * sizeof(glm::vec2)
+			+ indices.capacity() * sizeof(uint32_t);
+	}
 }
@@ -2,16 +2,19 @@
 
 #include <glm/glm.hpp>
 
-#include "../Extern/tiny_obj_loader.h"
-
+#include "AABB.h"
 #include "Ray.h"
 #include "Vertex.h"
 #include "HitPayload.h"
 
 #include <memory>
+#include <string>
+#include <vector>
 
 namespace Vibrato
 {
+	class BVH;
+
 	class Hittable
 	{
 	public:
@@ -22,6 +25,7 @@ namespace Vibrato
 		virtual ~Hittable() = default;
 		virtual float intersect(const Ray& ray) const = 0;
 		virtual void setHitPayload(const Ray& ray, HitPayload& payload) const = 0;
+		virtual AABB getBounds() const = 0;
 	};
 
 	class Sphere : public Hittable
@@ -32,6 +36,7 @@ namespace Vibrato
 	public:
 		float intersect(const Ray& ray) const override;
 		void setHitPayload(const Ray& ray, HitPayload& payload) const override;
+		AABB getBounds() const override;
 	};
 
     struct Vertex
@@ -50,6 +55,7 @@ namespace Vibrato
         float intersect(const Ray& r) const override;
         glm::vec3 getBarycentric(glm::vec3& p) const;
 		void setHitPayload(const Ray& ray, HitPayload& payload) const override;
+		AABB getBounds() const override;
     public:
         glm::vec3 v0, v1, v2;
         glm::vec3 e1, e2;
@@ -58,15 +64,54 @@ namespace Vibrato
         glm::vec2 uv[3];
     };
 
-    class TriangleMesh
-    {
-    public:
-        TriangleMesh(const char* filePath);
-        // float intersect(const Ray& r) const override;
-		// void setHitPayload(const Ray& ray, HitPayload& payload) const override;
-    public:
-        std::vector<tinyobj::shape_t> shapes;
-        std::vector<tinyobj::material_t> materials;
-        std::vector<std::shared_ptr<Triangle> > triangles;
-    };
+	// Indexed mesh, every three entries of `indices` form a triangle referencing the shared vertex arrays.
+	class TriangleMesh
+	{
+	public:
+		TriangleMesh() = default;
+		// Loads an OBJ file, a mesh that failed to load stays empty and the error is printed.
+		TriangleMesh(const char* filePath);
+
+		// Replaces the mesh with an OBJ file, through its mesh cache when that is current.
+		// withHierarchy also builds (or takes from the cache) the mesh's own BVH, only instances use it.
+		// Returns false with a message in error when the file cannot be read, the mesh is left unchanged then.
+		bool load(const std::string& filePath, std::string& error, bool withHierarchy = false);
+
+		uint32_t addVertex(const Vertex& vertex);
+		void addTriangle(uint32_t i0, uint32_t i1, uint32_t i2);
+
+		inline uint32_t getVertexCount() const { return (uint32_t)positions.size(); }
+		inline uint32_t getTriangleCount() const { return (uint32_t)(indices.size() / 3); }
+
+		// Closest hit over all triangles of the mesh, returns false when nothing in (0, hit.distance) was hit.
+		// hit.primitiveIndex is the triangle index within the mesh.
+		bool intersect(const Ray& ray, RayHit& hit) const;
+		float intersectTriangle(uint32_t triangle, const Ray& ray, glm::vec2& barycentrics) const;
+		void setHitPayload(uint32_t triangle, const Ray& ray, const glm::vec2& barycentrics, HitPayload& payload) const;
+
+		AABB getBounds() const;
+		AABB getTriangleBounds(uint32_t triangle) const;
+
+		// Sorts the triangles into the leaf order of a BVH built over the mesh alone and keeps that BVH in hierarchy.
+		void buildHierarchy();
+		// Whether hierarchy was built over the positions and indices the mesh has now, edits in place make it stale.
+		bool hasCurrentHierarchy() const;
+		// Hash of the positions and indices, what hierarchy depends on.
+		uint64_t getGeometryHash() const;
+
+		size_t getMemoryUsage() const;
+
+	public:
+		std::vector<glm::vec3> positions;
+		std::vector<glm::vec3> normals;
+		std::vector<glm::vec2> uvs;
+		std::vector<uint32_t> indices;
+
+		// BVH over the triangles in mesh space, primitive i is triangle i. Set by buildHierarchy or the mesh cache,
+		// null for meshes loaded without one.
+		std::shared_ptr<BVH> hierarchy;
+		uint64_t hierarchyGeometry = 0; // getGeometryHash() when hierarchy was built or loaded
+
+		int materialIndex = 0;
+	};
 }
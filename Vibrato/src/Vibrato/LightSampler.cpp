@@ -0,0 +1,372 @@
+#include "LightSampler.h"
+
+#include <glm/gtc/constants.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+namespace Vibrato
+{
+	// cos(max(0, a - b)) and sin(max(0, a - b)) from the sines and cosines of a and b.
+	static float cosSubClamped(float sinA, float cosA, float sinB, float cosB)
+	{
+		return cosA > cosB ? 1.0f : cosA * cosB + sinA * sinB;
+	}
+
+	static float sinSubClamped(float sinA, float cosA, float sinB, float cosB)
+	{
+		return cosA > cosB ? 0.0f : sinA * cosB - cosA * sinB;
+	}
+
+	static float safeSqrt(float x)
+	{
+		return std::sqrt(std::max(x, 0.0f));
+	}
+
+	static float safeAcos(float x)
+	{
+		return std::acos(glm::clamp(x, -1.0f, 1.0f));
+	}
+
+	void LightSampler::build(const PrimitiveStore& primitives, const std::vector<Material>& materials)
+	{
+		clear();
+
+		const PrimitiveStore::SphereHot& spheres = primitives.getSpheres();
+		const PrimitiveStore::TriangleHot& triangles = primitives.getTriangles();
+		uint32_t sphereCount = primitives.getSphereCount();
+
+		std::vector<BuildLight> lights;
+		for (uint32_t id = 0; id < primitives.size(); id++)
+		{
+			int material = primitives.getMaterialIndex(id);
+			if (material < 0 || material >= (int)materials.size() || !materials[material].isEmissive())
+				continue;
+
+			// Same radiance Renderer::shade adds on a hit
+			glm::vec3 radiance = materials[material].radiance();
+			float luminance = glm::dot(radiance, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+
+			LightBounds light;
+			light.bounds = primitives.getBounds(id);
+
+			if (id < sphereCount)
+			{
+				// Emits in every direction
+				float radius = spheres.radius[id];
+				light.power = glm::pi<float>() * 4.0f * glm::pi<float>() * radius * radius * luminance;
+				light.cosThetaO = -1.0f;
+			}
+			else
+			{
+				uint32_t t = id - sphereCount;
+				glm::vec3 e1(triangles.e1x[t], triangles.e1y[t], triangles.e1z[t]);
+				glm::vec3 e2(triangles.e2x[t], triangles.e2y[t], triangles.e2z[t]);
+				glm::vec3 normal = glm::cross(e1, e2);
+				float doubleArea = glm::length(normal);
+				if (doubleArea <= 0.0f)
+					continue;
+
+				// Both faces emit, like they are both hit
+				light.power = glm::pi<float>() * doubleArea * luminance;
+				light.axis = normal / doubleArea;
+				light.twoSided = true;
+			}
+
+			if (light.power > 0.0f)
+				lights.push_back({ id, light });
+		}
+
+		if (lights.empty())
+			return;
+
+		m_nodes.reserve(lights.size() * 2);
+		subdivide(lights, 0, (uint32_t)lights.size(), 0, 0);
+	}
+
+	void LightSampler::clear()
+	{
+		m_nodes.clear();
+		m_trails.clear();
+	}
+
+	uint32_t LightSampler::subdivide(std::vector<BuildLight>& lights, uint32_t begin, uint32_t end, uint64_t trail, uint32_t depth)
+	{
+		uint32_t nodeIndex = (uint32_t)m_nodes.size();
+		m_nodes.emplace_back();
+
+		if (end - begin == 1)
+		{
+			m_nodes[nodeIndex] = { lights[begin].bounds, lights[begin].id, true };
+			m_trails[lights[begin].id] = trail;
+			return nodeIndex;
+		}
+
+		AABB bounds, centroidBounds;
+		for (uint32_t i = begin; i < end; i++)
+		{
+			bounds.grow(lights[i].bounds.bounds);
+			centroidBounds.grow(lights[i].bounds.bounds.centroid());
+		}
+
+		int bestAxis = -1, bestBin = 0;
+		float bestCost = std::numeric_limits<float>::max();
+
+		for (int axis = 0; depth < MAX_HEURISTIC_DEPTH && axis < 3; axis++)
+		{
+			float boundsMin = centroidBounds.min[axis];
+			float boundsMax = centroidBounds.max[axis];
+			if (boundsMin == boundsMax)
+				continue;
+
+			float scale = SPLIT_BINS / (boundsMax - boundsMin);
+			auto binOf = [&](const BuildLight& light)
+			{
+				return std::min(SPLIT_BINS - 1, (int)((light.bounds.bounds.centroid()[axis] - boundsMin) * scale));
+			};
+
+			LightBounds bins[SPLIT_BINS];
+			for (uint32_t i = begin; i < end; i++)
+			{
+				int bin = binOf(lights[i]);
+				bins[bin] = merge(bins[bin], lights[i].bounds);
+			}
+
+			// Sweep from the right first so every candidate only merges its left side as it goes.
+			float rightCost[SPLIT_BINS];
+			LightBounds right;
+			for (int i = SPLIT_BINS - 1; i > 0; i--)
+			{
+				right = merge(right, bins[i]);
+				rightCost[i] = right.bounds.isEmpty() ? -1.0f : splitCost(right, bounds, axis);
+			}
+
+			LightBounds left;
+			for (int i = 1; i < SPLIT_BINS; i++)
+			{
+				left = merge(left, bins[i - 1]);
+				if (left.bounds.isEmpty() || rightCost[i] < 0.0f)
+					continue;
+
+				float cost = splitCost(left, bounds, axis) + rightCost[i];
+				if (cost < bestCost)
+				{
+					bestCost = cost;
+					bestAxis = axis;
+					bestBin = i;
+				}
+			}
+		}
+
+		uint32_t mid;
+		if (bestAxis >= 0)
+		{
+			float boundsMin = centroidBounds.min[bestAxis];
+			float scale = SPLIT_BINS / (centroidBounds.max[bestAxis] - boundsMin);
+			auto it = std::partition(lights.begin() + begin, lights.begin() + end, [&](const BuildLight& light)
+			{
+				return std::min(SPLIT_BINS - 1, (int)((light.bounds.bounds.centroid()[bestAxis] - boundsMin) * scale)) < bestBin;
+			});
+			mid = (uint32_t)(it - lights.begin());
+		}
+		else
+		{
+			// No usable split, halve by count along the widest axis
+			int axis = centroidBounds.longestAxis();
+			mid = (begin + end) / 2;
+			std::nth_element(lights.begin() + begin, lights.begin() + mid, lights.begin() + end, [axis](const BuildLight& a, const BuildLight& b)
+			{
+				return a.bounds.bounds.centroid()[axis] < b.bounds.bounds.centroid()[axis];
+			});
+		}
+
+		uint32_t leftIndex = subdivide(lights, begin, mid, trail, depth + 1);
+		uint32_t rightIndex = subdivide(lights, mid, end, trail | (1ull << depth), depth + 1);
+
+		m_nodes[nodeIndex] = { merge(m_nodes[leftIndex].bounds, m_nodes[rightIndex].bounds), rightIndex, false };
+		return nodeIndex;
+	}
+
+	bool LightSampler::sample(const glm::vec3& position, const glm::vec3& normal, float u, uint32_t& light, float& pdf) const
+	{
+		if (m_nodes.empty())
+			return false;
+
+		pdf = 1.0f;
+		uint32_t index = 0;
+		while (!m_nodes[index].leaf)
+		{
+			uint32_t second = m_nodes[index].child;
+			float first = m_nodes[index + 1].bounds.importance(position, normal);
+			float total = first + m_nodes[second].bounds.importance(position, normal);
+			if (total <= 0.0f)
+				return false;
+
+			// Pick a child proportionally and rescale u so it stays uniform for the next level
+			float firstProbability = first / total;
+			if (u < firstProbability)
+			{
+				index = index + 1;
+				u = u / firstProbability;
+				pdf *= firstProbability;
+			}
+			else
+			{
+				index = second;
+				u = (u - firstProbability) / (1.0f - firstProbability);
+				pdf *= 1.0f - firstProbability;
+			}
+			u = std::min(u, 0.99999994f);
+		}
+
+		// Only a single light at the root gets here without an importance check
+		if (index == 0 && m_nodes[0].bounds.importance(position, normal) <= 0.0f)
+			return false;
+
+		light = m_nodes[index].child;
+		return true;
+	}
+
+	float LightSampler::pdf(const glm::vec3& position, const glm::vec3& normal, uint32_t id) const
+	{
+		auto it = m_trails.find(id);
+		if (it == m_trails.end())
+			return 0.0f;
+
+		uint64_t trail = it->second;
+		float pdf = 1.0f;
+		uint32_t index = 0;
+		while (!m_nodes[index].leaf)
+		{
+			uint32_t second = m_nodes[index].child;
+			float first = m_nodes[index + 1].bounds.importance(position, normal);
+			float total = first + m_nodes[second].bounds.importance(position, normal);
+			if (total <= 0.0f)
+				return 0.0f;
+
+			if (trail & 1)
+			{
+				pdf *= 1.0f - first / total;
+				index = second;
+			}
+			else
+			{
+				pdf *= first / total;
+				index = index + 1;
+			}
+			trail >>= 1;
+		}
+
+		if (index == 0 && m_nodes[0].bounds.importance(position, normal) <= 0.0f)
+			return 0.0f;
+
+		return pdf;
+	}
+
+	float LightSampler::LightBounds::importance(const glm::vec3& position, const glm::vec3& normal) const
+	{
+		glm::vec3 center = bounds.centroid();
+		glm::vec3 toPosition = position - center;
+		float distance2 = glm::dot(toPosition, toPosition);
+
+		// Clamped to the bounding sphere so points inside or next to the bounds stay finite
+		float radius2 = 0.25f * glm::dot(bounds.extent(), bounds.extent());
+		float clampedDistance2 = std::max(distance2, radius2);
+
+		// Angle between the cone axis and the direction to the point
+		float cosThetaW = distance2 > 0.0f ? glm::dot(axis, toPosition) / std::sqrt(distance2) : 1.0f;
+		if (twoSided)
+			cosThetaW = std::abs(cosThetaW);
+		float sinThetaW = safeSqrt(1.0f - cosThetaW * cosThetaW);
+
+		// Angle the bounding sphere subtends from the point
+		float cosThetaB = distance2 > radius2 ? safeSqrt(1.0f - radius2 / distance2) : -1.0f;
+		float sinThetaB = safeSqrt(1.0f - cosThetaB * cosThetaB);
+
+		// Smallest angle between the point and any direction the lights emit in
+		float sinThetaO = safeSqrt(1.0f - cosThetaO * cosThetaO);
+		float cosThetaX = cosSubClamped(sinThetaW, cosThetaW, sinThetaO, cosThetaO);
+		float sinThetaX = sinSubClamped(sinThetaW, cosThetaW, sinThetaO, cosThetaO);
+		float cosThetaP = cosSubClamped(sinThetaX, cosThetaX, sinThetaB, cosThetaB);
+		if (cosThetaP <= cosThetaE)
+			return 0.0f;
+
+		// Smallest angle between the normal and any direction into the bounds
+		float cosThetaI = distance2 > 0.0f ? -glm::dot(normal, toPosition) / std::sqrt(distance2) : 1.0f;
+		float sinThetaI = safeSqrt(1.0f - cosThetaI * cosThetaI);
+		float cosThetaPI = cosSubClamped(sinThetaI, cosThetaI, sinThetaB, cosThetaB);
+		if (cosThetaPI <= 0.0f)
+			return 0.0f;
+
+		return power * cosThetaP * cosThetaPI / clampedDistance2;
+	}
+
+	LightSampler::LightBounds LightSampler::merge(const LightBounds& a, const LightBounds& b)
+	{
+		if (a.bounds.isEmpty())
+			return b;
+		if (b.bounds.isEmpty())
+			return a;
+
+		LightBounds result;
+		result.bounds = a.bounds;
+		result.bounds.grow(b.bounds);
+		result.power = a.power + b.power;
+		result.cosThetaE = std::min(a.cosThetaE, b.cosThetaE);
+		result.twoSided = a.twoSided || b.twoSided;
+
+		// Smallest cone around both normal cones
+		float thetaA = safeAcos(a.cosThetaO);
+		float thetaB = safeAcos(b.cosThetaO);
+		float thetaD = safeAcos(glm::dot(a.axis, b.axis));
+
+		if (std::min(thetaD + thetaB, glm::pi<float>()) <= thetaA)
+		{
+			result.axis = a.axis;
+			result.cosThetaO = a.cosThetaO;
+			return result;
+		}
+		if (std::min(thetaD + thetaA, glm::pi<float>()) <= thetaB)
+		{
+			result.axis = b.axis;
+			result.cosThetaO = b.cosThetaO;
+			return result;
+		}
+
+		float thetaO = (thetaA + thetaD + thetaB) * 0.5f;
+		glm::vec3 rotationAxis = glm::cross(a.axis, b.axis);
+		float rotationLength = glm::length(rotationAxis);
+		if (thetaO >= glm::pi<float>() || rotationLength <= 0.0f)
+		{
+			result.axis = a.axis;
+			result.cosThetaO = -1.0f;
+			return result;
+		}
+
+		// Rotate a's axis towards b's until the cone covers both
+		float thetaR = thetaO - thetaA;
+		glm::vec3 k = rotationAxis / rotationLength;
+		glm::vec3 v = a.axis;
+		result.axis = glm::normalize(v * std::cos(thetaR) + glm::cross(k, v) * std::sin(thetaR) + k * glm::dot(k, v) * (1.0f - std::cos(thetaR)));
+		result.cosThetaO = std::cos(thetaO);
+		return result;
+	}
+
+	float LightSampler::splitCost(const LightBounds& bounds, const AABB& parent, int axis)
+	{
+		// Solid angle measure of the normal cone widened by the emission angle
+		float thetaO = safeAcos(bounds.cosThetaO);
+		float thetaE = safeAcos(bounds.cosThetaE);
+		float thetaW = std::min(thetaO + thetaE, glm::pi<float>());
+		float sinThetaO = safeSqrt(1.0f - bounds.cosThetaO * bounds.cosThetaO);
+		float orientation = glm::two_pi<float>() * (1.0f - bounds.cosThetaO)
+			+ glm::half_pi<float>() * (2.0f * thetaW * sinThetaO - std::cos(thetaO - 2.0f * thetaW) - 2.0f * thetaO * sinThetaO + bounds.cosThetaO);
+
+		// Discourages thin slabs across the parent's long side
+		glm::vec3 extent = parent.extent();
+		float maxExtent = std::max(extent.x, std::max(extent.y, extent.z));
+		float regularity = extent[axis] > 0.0f ? maxExtent / extent[axis] : 1.0f;
+
+		return bounds.power * orientation * regularity * bounds.bounds.surfaceArea();
+	}
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "AABB.h"
+#include "Material.h"
+#include "PrimitiveStore.h"
+
+#include <glm/glm.hpp>
+
+#include <unordered_map>
+#include <vector>
+
+namespace Vibrato
+{
+	// Light BVH over the emissive primitives. Every node bounds where its lights are, how much they emit and
+	// in which directions, so picking a light walks down the tree towards the ones likely to matter at a point.
+	class LightSampler
+	{
+	public:
+		// Gathers every primitive whose material emits, ids must be final (after the BVH reorder).
+		void build(const PrimitiveStore& primitives, const std::vector<Material>& materials);
+		void clear();
+
+		inline bool isEmpty() const { return m_nodes.empty(); }
+		inline uint32_t getLightCount() const { return (uint32_t)m_trails.size(); }
+		inline uint32_t getNodeCount() const { return (uint32_t)m_nodes.size(); }
+
+		// Picks an emissive primitive for a shading point with the given normal, u in [0, 1).
+		// pdf is the probability of picking it, returns false when no light can reach the point.
+		bool sample(const glm::vec3& position, const glm::vec3& normal, float u, uint32_t& light, float& pdf) const;
+		// Probability of sample() picking the emissive primitive id for the shading point.
+		float pdf(const glm::vec3& position, const glm::vec3& normal, uint32_t id) const;
+
+	private:
+		// Emission of a group of lights: where, how much and in which directions.
+		struct LightBounds
+		{
+			AABB bounds;
+			float power = 0.0f;
+
+			glm::vec3 axis{ 0.0f, 0.0f, 1.0f };
+			float cosThetaO = 1.0f; // every normal is within this angle of axis
+			float cosThetaE = 0.0f; // and emits up to this angle away from itself
+			bool twoSided = false;
+
+			// Estimated contribution to a shading point, 0 when no light can face it or all are below its horizon.
+			float importance(const glm::vec3& position, const glm::vec3& normal) const;
+		};
+
+		struct Node
+		{
+			LightBounds bounds;
+			uint32_t child; // primitive id for leaves, second child otherwise, the first one follows the node
+			bool leaf;
+		};
+
+		struct BuildLight
+		{
+			uint32_t id;
+			LightBounds bounds;
+		};
+
+		static LightBounds merge(const LightBounds& a, const LightBounds& b);
+		// Surface area orientation heuristic, the split cost of one side.
+		static float splitCost(const LightBounds& bounds, const AABB& parent, int axis);
+
+		uint32_t subdivide(std::vector<BuildLight>& lights, uint32_t begin, uint32_t end, uint64_t trail, uint32_t depth);
+
+	private:
+		static constexpr int SPLIT_BINS = 12;
+		// Deeper than this, nodes split by count so trails always fit in 64 bits.
+		static constexpr uint32_t MAX_HEURISTIC_DEPTH = 32;
+
+		std::vector<Node> m_nodes;
+
+		// Path from the root to each light's leaf, bit d set when it goes to the second child at depth d.
+		std::unordered_map<uint32_t, uint64_t> m_trails;
+	};
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace Vibrato
+{
+	// Read-only view of a whole file, the OS pages it in on demand.
+	// data() is null when the file could not be opened or is empty.
+	class MappedFile
+	{
+	public:
+		explicit MappedFile(const std::string& path);
+		~MappedFile();
+
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+
+		inline const uint8_t* data() const { return m_data; }
+		inline size_t size() const { return m_size; }
+
+	private:
+#ifdef _WIN32
+		void* m_file = nullptr;
+		void* m_mapping = nullptr;
+#else
+		int m_file = -1;
+#endif
+		const uint8_t* m_data = nullptr;
+		size_t m_size = 0;
+	};
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+namespace Vibrato
+{
+	struct Material
+	{
+		glm::vec3 albedo{ 1.0f };
+		float roughness = 1.0f;
+		float fuzz = 0.0f;
+
+		float refractiveIndex = 0.0f;
+
+		glm::vec3 emissionColor{ 1.0f };
+		float emissionPower = 0.0f;
+
+		glm::vec3 emission() const { return emissionColor * emissionPower; }
+		// What an emissive surface gives off, its emission tinted by the albedo. Light sampling weighs lights by it.
+		glm::vec3 radiance() const { return emission() * albedo; }
+
+		inline bool isEmissive() const { return emissionPower > 0.0f; }
+		// Fully rough and not refractive, shaded as Lambertian so lights can be sampled for it.
+		inline bool isDiffuse() const { return refractiveIndex <= 0.0f && roughness >= 1.0f && fuzz == 0.0f; }
+
+		void reset()
+		{
+			roughness = 1.0f;
+			fuzz = 0.0f;
+
+			refractiveIndex = 0.0f;
+
+			emissionColor.r = 1.0f;
+			emissionColor.g = 1.0f;
+			emissionColor.b = 1.0f;
+
+			emissionPower = 0.0f;
+		}
+	};
+}
@@ -0,0 +1,222 @@
+#include "MeshCache.h"
+
+#include "BVH.h"
+#include "MappedFile.h"
+#include "Utils.h"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+#include <type_traits>
+
+#ifdef _WIN32
+	#include <process.h>
+#else
+	#include <unistd.h>
+#endif
+
+namespace Vibrato
+{
+	namespace MeshCache
+	{
+		// Bump whenever the layout below or what the arrays mean changes.
+		constexpr uint32_t VERSION = 2;
+		constexpr char MAGIC[4] = { 'V', 'M', 'S', 'H' };
+
+		// Followed by positions, normals, uvs, indices and BVH nodes, all tightly packed.
+		struct Header
+		{
+			char magic[4];
+			uint32_t version;
+
+			uint64_t sourceSize;
+			int64_t sourceTime; // last write time in ticks of the filesystem clock
+			uint64_t sourceHash;
+
+			uint32_t vertexCount;
+			uint32_t indexCount;
+			uint32_t nodeCount;
+			uint32_t padding;
+		};
+
+		static_assert(sizeof(glm::vec3) == 12 && sizeof(glm::vec2) == 8, "vectors are stored packed");
+		static_assert(std::is_trivially_copyable<BVH::Node>::value, "nodes are stored as they are in memory");
+
+		// Size and time of the source, false when it cannot be read.
+		static bool getSourceStamp(const std::string& sourcePath, uint64_t& size, int64_t& time)
+		{
+			std::error_code error;
+			size = (uint64_t)std::filesystem::file_size(sourcePath, error);
+			if (error)
+				return false;
+
+			time = (int64_t)std::filesystem::last_write_time(sourcePath, error).time_since_epoch().count();
+			return !error;
+		}
+
+		static bool hashSource(const std::string& sourcePath, uint64_t size, uint64_t& hash)
+		{
+			if (size == 0)
+			{
+				hash = Utils::hashBytes(nullptr, 0);
+				return true;
+			}
+
+			MappedFile source(sourcePath);
+			if (!source.data() || source.size() != size)
+				return false;
+
+			hash = Utils::hashBytes(source.data(), source.size());
+			return true;
+		}
+
+		// Unique to this process and thread, so concurrent writers of the same cache never share a temporary file.
+		static std::string getTemporaryPath(const std::string& cachePath)
+		{
+#ifdef _WIN32
+			uint64_t process = (uint64_t)_getpid();
+#else
+			uint64_t process = (uint64_t)getpid();
+#endif
+			size_t thread = std::hash<std::thread::id>()(std::this_thread::get_id());
+			return cachePath + "." + std::to_string(process) + "." + std::to_string(thread) + ".tmp";
+		}
+
+		template<typename T>
+		static const uint8_t* readArray(const uint8_t* data, uint32_t count, std::vector<T>& out)
+		{
+			out.resize(count);
+			if (count > 0)
+				std::memcpy(out.data(), data, count * sizeof(T));
+			return data + count * sizeof(T);
+		}
+
+		std::string getCachePath(const std::string& sourcePath)
+		{
+			return sourcePath + ".vmesh";
+		}
+
+		bool load(const std::string& sourcePath, TriangleMesh& mesh)
+		{
+			uint64_t sourceSize;
+			int64_t sourceTime;
+			if (!getSourceStamp(sourcePath, sourceSize, sourceTime))
+				return false;
+
+			MappedFile cache(getCachePath(sourcePath));
+			if (!cache.data() || cache.size() < sizeof(Header))
+				return false;
+
+			Header header;
+			std::memcpy(&header, cache.data(), sizeof(Header));
+
+			if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != VERSION)
+				return false;
+			if (header.sourceSize != sourceSize || header.sourceTime != sourceTime)
+				return false;
+
+			size_t expectedSize = sizeof(Header)
+				+ (size_t)header.vertexCount * (sizeof(glm::vec3) * 2 + sizeof(glm::vec2))
+				+ (size_t)header.indexCount * sizeof(uint32_t)
+				+ (size_t)header.nodeCount * sizeof(BVH::Node);
+			if (cache.size() != expectedSize || header.indexCount % 3 != 0)
+				return false;
+
+			// Copies and coarse clocks can leave size and time unchanged, the content cannot lie
+			uint64_t sourceHash;
+			if (!hashSource(sourcePath, sourceSize, sourceHash) || header.sourceHash != sourceHash)
+				return false;
+
+			TriangleMesh loaded;
+			const uint8_t* data = cache.data() + sizeof(Header);
+			data = readArray(data, header.vertexCount, loaded.positions);
+			data = readArray(data, header.vertexCount, loaded.normals);
+			data = readArray(data, header.vertexCount, loaded.uvs);
+			data = readArray(data, header.indexCount, loaded.indices);
+
+			std::vector<BVH::Node> nodes;
+			readArray(data, header.nodeCount, nodes);
+
+			// A damaged cache must not index out of bounds later
+			for (uint32_t index : loaded.indices)
+			{
+				if (index >= header.vertexCount)
+					return false;
+			}
+
+			uint32_t triangleCount = header.indexCount / 3;
+			// The builder appends children after their parent, requiring that keeps a corrupted tree from having
+			// cycles for traversal or the collapse to wide nodes to loop in
+			for (size_t i = 0; i < nodes.size(); i++)
+			{
+				const BVH::Node& node = nodes[i];
+				bool valid = node.isLeaf() ? (uint64_t)node.leftFirst + node.count <= triangleCount :
+					node.leftFirst > i && (uint64_t)node.leftFirst + 1 < nodes.size();
+				if (!valid)
+					return false;
+			}
+
+			if (!nodes.empty())
+			{
+				loaded.hierarchy = std::make_shared<BVH>();
+				loaded.hierarchy->assign(std::move(nodes), triangleCount);
+				loaded.hierarchyGeometry = loaded.getGeometryHash();
+			}
+
+			loaded.materialIndex = mesh.materialIndex;
+			mesh = std::move(loaded);
+			return true;
+		}
+
+		bool save(const std::string& sourcePath, const TriangleMesh& mesh)
+		{
+			Header header = {};
+			std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+			header.version = VERSION;
+
+			if (!getSourceStamp(sourcePath, header.sourceSize, header.sourceTime))
+				return false;
+			if (!hashSource(sourcePath, header.sourceSize, header.sourceHash))
+				return false;
+
+			const std::vector<BVH::Node> noNodes;
+			const std::vector<BVH::Node>& nodes = mesh.hierarchy ? mesh.hierarchy->getNodes() : noNodes;
+
+			header.vertexCount = mesh.getVertexCount();
+			header.indexCount = (uint32_t)mesh.indices.size();
+			header.nodeCount = (uint32_t)nodes.size();
+
+			std::string cachePath = getCachePath(sourcePath);
+			std::string temporaryPath = getTemporaryPath(cachePath);
+			{
+				std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+				if (!file)
+					return false;
+
+				file.write((const char*)&header, sizeof(Header));
+				file.write((const char*)mesh.positions.data(), mesh.positions.size() * sizeof(glm::vec3));
+				file.write((const char*)mesh.normals.data(), mesh.normals.size() * sizeof(glm::vec3));
+				file.write((const char*)mesh.uvs.data(), mesh.uvs.size() * sizeof(glm::vec2));
+				file.write((const char*)mesh.indices.data(), mesh.indices.size() * sizeof(uint32_t));
+				file.write((const char*)nodes.data(), nodes.size() * sizeof(BVH::Node));
+
+				if (!file)
+				{
+					file.close();
+					std::remove(temporaryPath.c_str());
+					return false;
+				}
+			}
+
+			std::error_code error;
+			std::filesystem::rename(temporaryPath, cachePath, error);
+			if (error)
+			{
+				std::remove(temporaryPath.c_str());
+				return false;
+			}
+			return true;
+		}
+	}
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "Hittables.h"
+
+#include <string>
+
+namespace Vibrato
+{
+	// Binary copy of a parsed mesh kept next to its source as <source>.vmesh: the vertex and index arrays
+	// followed by the mesh's BVH when it has one, so loading maps the file and copies arrays out instead of parsing.
+	// The header records the source's size, modification time and content hash, a cache that disagrees
+	// with the source on any of them (or was written by another version) is ignored.
+	namespace MeshCache
+	{
+		std::string getCachePath(const std::string& sourcePath);
+
+		// Returns false when there is no valid cache for the source, the mesh is left untouched then.
+		bool load(const std::string& sourcePath, TriangleMesh& mesh);
+		// Writes through a temporary file, so a cache is either complete or absent.
+		bool save(const std::string& sourcePath, const TriangleMesh& mesh);
+	}
+}
@@ -0,0 +1,539 @@
+#include "ObjLoader.h"
+
+#include "MappedFile.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+
+namespace Vibrato
+{
+	namespace ObjLoader
+	{
+		// Large enough that per chunk overhead disappears, small enough to keep every thread busy.
+		constexpr size_t CHUNK_SIZE = 4 << 20;
+		// Triangles per task when writing the final indices.
+		constexpr uint32_t TRIANGLE_BATCH = 1 << 16;
+		// Corners are deduplicated in this many independent groups, split by position index. Fixed rather
+		// than per thread so the vertex order never depends on the machine that wrote a mesh cache.
+		constexpr uint32_t VERTEX_GROUPS = 64;
+
+		constexpr uint32_t NONE = UINT32_MAX;
+
+		// One face corner. Indices are zero based, -1 when the corner has no uv or normal.
+		struct Corner
+		{
+			int position, texcoord, normal;
+			uint8_t relative; // components given as negative indices, relative to the chunk until resolved
+		};
+
+		struct Chunk
+		{
+			const char* begin;
+			const char* end;
+
+			std::vector<glm::vec3> positions;
+			std::vector<glm::vec2> texcoords;
+			std::vector<glm::vec3> normals;
+
+			std::vector<Corner> corners;
+			std::vector<uint32_t> faceSizes; // corners per face
+			std::vector<uint32_t> faceLines; // for errors found after parsing
+			uint32_t triangleCount = 0;
+			uint32_t lineCount = 0;
+
+			std::string error;
+			uint32_t errorLine = 0;
+
+			// Where this chunk's entries start in the merged arrays
+			uint32_t positionBase = 0, texcoordBase = 0, normalBase = 0;
+			uint32_t cornerBase = 0, triangleBase = 0, lineBase = 0;
+		};
+
+		static inline bool isBlank(char c)
+		{
+			return c == ' ' || c == '\t' || c == '\r';
+		}
+
+		static inline const char* skipBlanks(const char* p, const char* end)
+		{
+			while (p < end && isBlank(*p))
+				p++;
+			return p;
+		}
+
+		static bool parseFloat(const char*& p, const char* end, float& value)
+		{
+			p = skipBlanks(p, end);
+			if (p < end && *p == '+')
+				p++;
+
+			std::from_chars_result result = std::from_chars(p, end, value);
+			if (result.ec == std::errc::result_out_of_range)
+				value = 0.0f; // denormals and beyond, not worth keeping
+			else if (result.ec != std::errc())
+				return false;
+
+			p = result.ptr;
+			return true;
+		}
+
+		// OBJ indices are one based, negative ones count back from the last element defined so far.
+		static bool parseIndex(const char*& p, const char* end, uint32_t definedCount, int& index, bool& relative)
+		{
+			int value;
+			std::from_chars_result result = std::from_chars(p, end, value);
+			if (result.ec != std::errc() || value == 0)
+				return false;
+
+			p = result.ptr;
+			relative = value < 0;
+			index = relative ? (int)definedCount + value : value - 1;
+			return true;
+		}
+
+		// v, v/vt, v//vn or v/vt/vn
+		static bool parseCorner(const char*& p, const char* end, const Chunk& chunk, Corner& corner)
+		{
+			corner = { -1, -1, -1, 0 };
+
+			bool relative;
+			if (!parseIndex(p, end, (uint32_t)chunk.positions.size(), corner.position, relative))
+				return false;
+			corner.relative |= relative ? 1 : 0;
+
+			if (p < end && *p == '/')
+			{
+				p++;
+				if (p < end && *p != '/')
+				{
+					if (!parseIndex(p, end, (uint32_t)chunk.texcoords.size(), corner.texcoord, relative))
+						return false;
+					corner.relative |= relative ? 2 : 0;
+				}
+
+				if (p < end && *p == '/')
+				{
+					p++;
+					if (!parseIndex(p, end, (uint32_t)chunk.normals.size(), corner.normal, relative))
+						return false;
+					corner.relative |= relative ? 4 : 0;
+				}
+			}
+
+			return p == end || isBlank(*p);
+		}
+
+		static bool parseLine(const char* p, const char* end, Chunk& chunk)
+		{
+			p = skipBlanks(p, end);
+			if (p + 1 >= end || *p == '#')
+				return true;
+
+			if (p[0] == 'v' && isBlank(p[1]))
+			{
+				glm::vec3& position = chunk.positions.emplace_back();
+				p++;
+				return parseFloat(p, end, position.x) && parseFloat(p, end, position.y) && parseFloat(p, end, position.z);
+			}
+
+			if (p[0] == 'v' && p[1] == 't' && p + 2 < end && isBlank(p[2]))
+			{
+				glm::vec2& texcoord = chunk.texcoords.emplace_back(0.0f);
+				p += 2;
+				if (!parseFloat(p, end, texcoord.x))
+					return false;
+				// v is optional
+				p = skipBlanks(p, end);
+				return p == end || *p == '#' || parseFloat(p, end, texcoord.y);
+			}
+
+			if (p[0] == 'v' && p[1] == 'n' && p + 2 < end && isBlank(p[2]))
+			{
+				glm::vec3& normal = chunk.normals.emplace_back();
+				p += 2;
+				return parseFloat(p, end, normal.x) && parseFloat(p, end, normal.y) && parseFloat(p, end, normal.z);
+			}
+
+			if (p[0] == 'f' && isBlank(p[1]))
+			{
+				p++;
+				uint32_t count = 0;
+				while (true)
+				{
+					p = skipBlanks(p, end);
+					if (p == end || *p == '#')
+						break;
+
+					Corner corner;
+					if (!parseCorner(p, end, chunk, corner))
+						return false;
+
+					chunk.corners.push_back(corner);
+					count++;
+				}
+
+				// Not a surface, skipped like lines and points
+				if (count < 3)
+				{
+					chunk.corners.resize(chunk.corners.size() - count);
+					return true;
+				}
+
+				chunk.faceSizes.push_back(count);
+				chunk.faceLines.push_back(chunk.lineCount);
+				chunk.triangleCount += count - 2;
+			}
+
+			return true;
+		}
+
+		static void parseChunk(Chunk& chunk)
+		{
+			const char* p = chunk.begin;
+			while (p < chunk.end)
+			{
+				const char* lineEnd = (const char*)std::memchr(p, '\n', chunk.end - p);
+				if (!lineEnd)
+					lineEnd = chunk.end;
+
+				chunk.lineCount++;
+				if (!parseLine(p, lineEnd, chunk))
+				{
+					chunk.error = "could not parse \"" + std::string(p, lineEnd - p) + "\"";
+					chunk.errorLine = chunk.lineCount;
+					return;
+				}
+
+				p = lineEnd + 1;
+			}
+		}
+
+		// Relative indices become absolute and every index is checked against what the file defines.
+		static bool resolveCorner(Corner& corner, const Chunk& chunk, uint32_t positionCount, uint32_t texcoordCount, uint32_t normalCount)
+		{
+			if (corner.relative & 1) corner.position += (int)chunk.positionBase;
+			if (corner.relative & 2) corner.texcoord += (int)chunk.texcoordBase;
+			if (corner.relative & 4) corner.normal += (int)chunk.normalBase;
+			corner.relative = 0;
+
+			return corner.position >= 0 && corner.position < (int)positionCount &&
+				corner.texcoord >= -1 && corner.texcoord < (int)texcoordCount &&
+				corner.normal >= -1 && corner.normal < (int)normalCount;
+		}
+
+		// Splits a face into size - 2 triangles, writing corner indices to out. Ear clipping in the plane the
+		// polygon faces most keeps concave faces inside their outline, convex ones come out as a fan from the
+		// first corner. Faces too broken to find an ear in are fanned from what is left.
+		static void triangulate(uint32_t first, uint32_t size, const std::vector<Corner>& corners, const std::vector<glm::vec3>& positions,
+			std::vector<uint32_t>& remaining, std::vector<glm::vec2>& projected, uint32_t* out)
+		{
+			if (size == 3)
+			{
+				out[0] = first;
+				out[1] = first + 1;
+				out[2] = first + 2;
+				return;
+			}
+
+			// Newell normal, its largest component picks the plane to project to
+			glm::vec3 normal(0.0f);
+			for (uint32_t i = 0; i < size; i++)
+			{
+				const glm::vec3& a = positions[corners[first + i].position];
+				const glm::vec3& b = positions[corners[first + (i + 1) % size].position];
+				normal += glm::vec3((a.y - b.y) * (a.z + b.z), (a.z - b.z) * (a.x + b.x), (a.x - b.x) * (a.y + b.y));
+			}
+			glm::vec3 magnitude = glm::abs(normal);
+			int axis = magnitude.x > magnitude.y ? (magnitude.x > magnitude.z ? 0 : 2) : (magnitude.y > magnitude.z ? 1 : 2);
+			int u = (axis + 1) % 3, v = (axis + 2) % 3;
+			// Keeps counter clockwise outlines counter clockwise after dropping the axis
+			float orientation = normal[axis] < 0.0f ? -1.0f : 1.0f;
+
+			remaining.resize(size);
+			projected.resize(size);
+			for (uint32_t i = 0; i < size; i++)
+			{
+				const glm::vec3& position = positions[corners[first + i].position];
+				remaining[i] = i;
+				projected[i] = glm::vec2(position[u], position[v]);
+			}
+
+			auto cross = [&projected](uint32_t a, uint32_t b, uint32_t c)
+			{
+				glm::vec2 ab = projected[b] - projected[a], ac = projected[c] - projected[a];
+				return ab.x * ac.y - ab.y * ac.x;
+			};
+
+			uint32_t written = 0;
+			uint32_t i = 1, misses = 0;
+			while (remaining.size() > 3 && misses < remaining.size())
+			{
+				uint32_t count = (uint32_t)remaining.size();
+				uint32_t a = remaining[(i + count - 1) % count], b = remaining[i], c = remaining[(i + 1) % count];
+
+				bool ear = cross(a, b, c) * orientation > 0.0f;
+				for (uint32_t j = 0; ear && j < count; j++)
+				{
+					uint32_t p = remaining[j];
+					if (p == a || p == b || p == c || projected[p] == projected[a] || projected[p] == projected[b] || projected[p] == projected[c])
+						continue;
+					ear = !(cross(a, b, p) * orientation > 0.0f && cross(b, c, p) * orientation > 0.0f && cross(c, a, p) * orientation > 0.0f);
+				}
+
+				if (!ear)
+				{
+					i = (i + 1) % count;
+					misses++;
+					continue;
+				}
+
+				out[written++] = first + a;
+				out[written++] = first + b;
+				out[written++] = first + c;
+
+				remaining.erase(remaining.begin() + i);
+				if (i >= remaining.size())
+					i = 0;
+				misses = 0;
+			}
+
+			for (uint32_t j = 1; j + 1 < remaining.size(); j++)
+			{
+				out[written++] = first + remaining[0];
+				out[written++] = first + remaining[j];
+				out[written++] = first + remaining[j + 1];
+			}
+		}
+
+		bool load(const std::string& path, TriangleMesh& mesh, std::string& error)
+		{
+			MappedFile file(path);
+			if (!file.data())
+			{
+				error = "could not open " + path + " or it is empty";
+				return false;
+			}
+
+			const char* text = (const char*)file.data();
+			const char* textEnd = text + file.size();
+
+			// Chunk boundaries move forward to the next line start, so no line is split
+			uint32_t chunkCount = (uint32_t)std::max<size_t>(file.size() / CHUNK_SIZE, 1);
+			std::vector<Chunk> chunks(chunkCount);
+			const char* begin = text;
+			for (uint32_t i = 0; i < chunkCount; i++)
+			{
+				const char* end = i + 1 == chunkCount ? textEnd : text + file.size() * (i + 1) / chunkCount;
+				if (end < begin)
+					end = begin;
+				while (end < textEnd && end[-1] != '\n')
+					end++;
+
+				chunks[i].begin = begin;
+				chunks[i].end = end;
+				begin = end;
+			}
+
+			ThreadPool pool(std::min(std::max(std::thread::hardware_concurrency(), 1u), chunkCount * 4));
+
+			pool.run(chunkCount, [&chunks](uint32_t i) { parseChunk(chunks[i]); });
+
+			uint64_t positionCount = 0, texcoordCount = 0, normalCount = 0, cornerCount = 0, triangleCount = 0, lineCount = 0;
+			for (Chunk& chunk : chunks)
+			{
+				if (!chunk.error.empty())
+				{
+					error = path + ":" + std::to_string(lineCount + chunk.errorLine) + ": " + chunk.error;
+					return false;
+				}
+
+				chunk.positionBase = (uint32_t)positionCount;
+				chunk.texcoordBase = (uint32_t)texcoordCount;
+				chunk.normalBase = (uint32_t)normalCount;
+				chunk.cornerBase = (uint32_t)cornerCount;
+				chunk.triangleBase = (uint32_t)triangleCount;
+				chunk.lineBase = (uint32_t)lineCount;
+
+				positionCount += chunk.positions.size();
+				texcoordCount += chunk.texcoords.size();
+				normalCount += chunk.normals.size();
+				cornerCount += chunk.corners.size();
+				triangleCount += chunk.triangleCount;
+				lineCount += chunk.lineCount;
+			}
+
+			if (positionCount > INT32_MAX || texcoordCount > INT32_MAX || normalCount > INT32_MAX || triangleCount * 3 > INT32_MAX)
+			{
+				error = path + " has more elements than a mesh can index";
+				return false;
+			}
+
+			// Merge the attributes, resolve every corner and triangulate, chunk by chunk
+			std::vector<glm::vec3> positions(positionCount), normals(normalCount);
+			std::vector<glm::vec2> texcoords(texcoordCount);
+			std::vector<Corner> corners(cornerCount);
+			std::vector<uint32_t> triangleCorners(triangleCount * 3);
+
+			pool.run(chunkCount, [&](uint32_t c)
+			{
+				Chunk& chunk = chunks[c];
+				std::copy(chunk.positions.begin(), chunk.positions.end(), positions.begin() + chunk.positionBase);
+				std::copy(chunk.texcoords.begin(), chunk.texcoords.end(), texcoords.begin() + chunk.texcoordBase);
+				std::copy(chunk.normals.begin(), chunk.normals.end(), normals.begin() + chunk.normalBase);
+				std::vector<glm::vec3>().swap(chunk.positions);
+				std::vector<glm::vec2>().swap(chunk.texcoords);
+				std::vector<glm::vec3>().swap(chunk.normals);
+			});
+
+			pool.run(chunkCount, [&](uint32_t c)
+			{
+				Chunk& chunk = chunks[c];
+
+				uint32_t corner = chunk.cornerBase;
+				for (size_t face = 0; face < chunk.faceSizes.size(); face++)
+				{
+					for (uint32_t i = 0; i < chunk.faceSizes[face]; i++, corner++)
+					{
+						corners[corner] = chunk.corners[corner - chunk.cornerBase];
+						if (!resolveCorner(corners[corner], chunk, (uint32_t)positionCount, (uint32_t)texcoordCount, (uint32_t)normalCount))
+						{
+							chunk.error = "face refers to an element the file does not define";
+							chunk.errorLine = chunk.faceLines[face];
+							return;
+						}
+					}
+				}
+				std::vector<Corner>().swap(chunk.corners);
+
+				std::vector<uint32_t> remaining;
+				std::vector<glm::vec2> projected;
+				uint32_t* out = triangleCorners.data() + (size_t)chunk.triangleBase * 3;
+				corner = chunk.cornerBase;
+				for (uint32_t size : chunk.faceSizes)
+				{
+					triangulate(corner, size, corners, positions, remaining, projected, out);
+					out += (size - 2) * 3;
+					corner += size;
+				}
+			});
+
+			for (const Chunk& chunk : chunks)
+			{
+				if (!chunk.error.empty())
+				{
+					error = path + ":" + std::to_string(chunk.lineBase + chunk.errorLine) + ": " + chunk.error;
+					return false;
+				}
+			}
+
+			// Deduplicate corners into vertices. Each group sees its corners in file order, so vertices are
+			// numbered by first use. Grouping is a counting sort: count per chunk, then scatter.
+			std::vector<uint32_t> groupCounts((size_t)chunkCount * VERTEX_GROUPS, 0);
+			pool.run(chunkCount, [&](uint32_t c)
+			{
+				uint32_t* counts = groupCounts.data() + (size_t)c * VERTEX_GROUPS;
+				uint32_t end = c + 1 < chunkCount ? chunks[c + 1].cornerBase : (uint32_t)cornerCount;
+				for (uint32_t corner = chunks[c].cornerBase; corner < end; corner++)
+					counts[corners[corner].position % VERTEX_GROUPS]++;
+			});
+
+			// groupCounts becomes where each chunk writes into each group, groupStarts where each group begins
+			std::vector<uint32_t> groupStarts(VERTEX_GROUPS + 1, 0);
+			uint32_t offset = 0;
+			for (uint32_t group = 0; group < VERTEX_GROUPS; group++)
+			{
+				groupStarts[group] = offset;
+				for (uint32_t c = 0; c < chunkCount; c++)
+				{
+					uint32_t count = groupCounts[(size_t)c * VERTEX_GROUPS + group];
+					groupCounts[(size_t)c * VERTEX_GROUPS + group] = offset;
+					offset += count;
+				}
+			}
+			groupStarts[VERTEX_GROUPS] = offset;
+
+			std::vector<uint32_t> groupedCorners(cornerCount);
+			pool.run(chunkCount, [&](uint32_t c)
+			{
+				uint32_t* offsets = groupCounts.data() + (size_t)c * VERTEX_GROUPS;
+				uint32_t end = c + 1 < chunkCount ? chunks[c + 1].cornerBase : (uint32_t)cornerCount;
+				for (uint32_t corner = chunks[c].cornerBase; corner < end; corner++)
+					groupedCorners[offsets[corners[corner].position % VERTEX_GROUPS]++] = corner;
+			});
+
+			// Local vertex of every corner within its group, and the first corner of every vertex
+			std::vector<uint32_t> cornerVertices(cornerCount);
+			std::vector<std::vector<uint32_t>> groupVertices(VERTEX_GROUPS);
+			pool.run(VERTEX_GROUPS, [&](uint32_t group)
+			{
+				// Vertices sharing a position are chained, most positions have one or a few
+				std::vector<uint32_t> firstVertex(positionCount / VERTEX_GROUPS + 1, NONE);
+				std::vector<uint32_t> nextVertex;
+				std::vector<uint32_t>& vertices = groupVertices[group];
+
+				for (uint32_t i = groupStarts[group]; i < groupStarts[group + 1]; i++)
+				{
+					uint32_t corner = groupedCorners[i];
+					const Corner& key = corners[corner];
+					uint32_t slot = key.position / VERTEX_GROUPS;
+
+					uint32_t vertex = firstVertex[slot];
+					while (vertex != NONE && (corners[vertices[vertex]].texcoord != key.texcoord || corners[vertices[vertex]].normal != key.normal))
+						vertex = nextVertex[vertex];
+
+					if (vertex == NONE)
+					{
+						vertex = (uint32_t)vertices.size();
+						vertices.push_back(corner);
+						nextVertex.push_back(firstVertex[slot]);
+						firstVertex[slot] = vertex;
+					}
+
+					cornerVertices[corner] = vertex;
+				}
+			});
+
+			std::vector<uint32_t> vertexBases(VERTEX_GROUPS);
+			uint32_t vertexCount = 0;
+			for (uint32_t group = 0; group < VERTEX_GROUPS; group++)
+			{
+				vertexBases[group] = vertexCount;
+				vertexCount += (uint32_t)groupVertices[group].size();
+			}
+
+			mesh.positions.resize(vertexCount);
+			mesh.normals.resize(vertexCount);
+			mesh.uvs.resize(vertexCount);
+			mesh.indices.resize(triangleCorners.size());
+
+			pool.run(VERTEX_GROUPS, [&](uint32_t group)
+			{
+				uint32_t vertex = vertexBases[group];
+				for (uint32_t corner : groupVertices[group])
+				{
+					const Corner& key = corners[corner];
+					mesh.positions[vertex] = positions[key.position];
+					mesh.normals[vertex] = key.normal >= 0 ? normals[key.normal] : glm::vec3(0.0f);
+					mesh.uvs[vertex] = key.texcoord >= 0 ? texcoords[key.texcoord] : glm::vec2(0.0f);
+					vertex++;
+				}
+			});
+
+			uint32_t batchCount = (uint32_t)((triangleCount + TRIANGLE_BATCH - 1) / TRIANGLE_BATCH);
+			pool.run(batchCount, [&](uint32_t batch)
+			{
+				size_t begin = (size_t)batch * TRIANGLE_BATCH * 3;
+				size_t end = std::min(begin + (size_t)TRIANGLE_BATCH * 3, triangleCorners.size());
+				for (size_t i = begin; i < end; i++)
+				{
+					uint32_t corner = triangleCorners[i];
+					mesh.indices[i] = vertexBases[corners[corner].position % VERTEX_GROUPS] + cornerVertices[corner];
+				}
+			});
+
+			return true;
+		}
+	}
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "Hittables.h"
+
+#include <string>
+
+namespace Vibrato
+{
+	// Wavefront OBJ importer. The file is mapped and split into line aligned chunks parsed in parallel,
+	// polygons are triangulated by ear clipping and every distinct position/uv/normal combination becomes
+	// one vertex. Only geometry is read (v, vt, vn and f), materials, groups, lines and points are skipped.
+	namespace ObjLoader
+	{
+		// Replaces the mesh's vertex and index arrays. Corners without a normal get a zero one and corners without
+		// a uv get (0, 0). Returns false with a message in error when the file cannot be read or is malformed.
+		bool load(const std::string& path, TriangleMesh& mesh, std::string& error);
+	}
+}
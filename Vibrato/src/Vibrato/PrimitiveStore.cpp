@@ -0,0 +1,384 @@
+#include "PrimitiveStore.h"
+
+#include <glm/gtc/constants.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+namespace Vibrato
+{
+	// Solid angle pdf of sampling the cone a sphere subtends, 0 from inside the sphere.
+	static float sphereConePdf(const glm::vec3& center, float radius, const glm::vec3& from)
+	{
+		glm::vec3 toCenter = center - from;
+		float centerDistance2 = glm::dot(toCenter, toCenter);
+		if (centerDistance2 <= radius * radius)
+			return 0.0f;
+
+		// 1 - cos(thetaMax) without the cancellation for small, far away spheres
+		float sinThetaMax2 = (radius * radius) / centerDistance2;
+		float oneMinusCosThetaMax = sinThetaMax2 / (1.0f + glm::sqrt(1.0f - sinThetaMax2));
+		return 1.0f / (glm::two_pi<float>() * oneMinusCosThetaMax);
+	}
+
+	void PrimitiveStore::build(const std::vector<std::shared_ptr<Hittable>>& objects, const std::vector<std::shared_ptr<TriangleMesh>>& meshes)
+	{
+		clear();
+
+		std::shared_ptr<TriangleMesh> looseTriangles = std::make_shared<TriangleMesh>();
+		std::vector<int> looseMaterials, looseObjects;
+
+		for (size_t i = 0; i < objects.size(); i++)
+		{
+			if (const Sphere* sphere = dynamic_cast<const Sphere*>(objects[i].get()))
+			{
+				m_spheres.centerX.push_back(sphere->position.x);
+				m_spheres.centerY.push_back(sphere->position.y);
+				m_spheres.centerZ.push_back(sphere->position.z);
+				m_spheres.radius.push_back(sphere->radius);
+
+				m_materialIndices.push_back(sphere->materialIndex);
+				m_objectIndices.push_back((int)i);
+			}
+			else if (const Triangle* triangle = dynamic_cast<const Triangle*>(objects[i].get()))
+			{
+				uint32_t i0 = looseTriangles->addVertex({ triangle->v0, triangle->N[0], triangle->uv[0] });
+				uint32_t i1 = looseTriangles->addVertex({ triangle->v1, triangle->N[1], triangle->uv[1] });
+				uint32_t i2 = looseTriangles->addVertex({ triangle->v2, triangle->N[2], triangle->uv[2] });
+				looseTriangles->addTriangle(i0, i1, i2);
+
+				looseMaterials.push_back(triangle->materialIndex);
+				looseObjects.push_back((int)i);
+			}
+		}
+
+		for (const auto& mesh : meshes)
+			m_meshes.push_back(mesh);
+		if (looseTriangles->getTriangleCount() > 0)
+			m_meshes.push_back(looseTriangles);
+
+		for (uint32_t m = 0; m < (uint32_t)m_meshes.size(); m++)
+		{
+			const TriangleMesh& mesh = *m_meshes[m];
+			bool loose = m_meshes[m] == looseTriangles;
+
+			for (uint32_t t = 0; t < mesh.getTriangleCount(); t++)
+			{
+				const glm::vec3& v0 = mesh.positions[mesh.indices[t * 3 + 0]];
+				glm::vec3 e1 = mesh.positions[mesh.indices[t * 3 + 1]] - v0;
+				glm::vec3 e2 = mesh.positions[mesh.indices[t * 3 + 2]] - v0;
+
+				m_triangles.v0x.push_back(v0.x);
+				m_triangles.v0y.push_back(v0.y);
+				m_triangles.v0z.push_back(v0.z);
+				m_triangles.e1x.push_back(e1.x);
+				m_triangles.e1y.push_back(e1.y);
+				m_triangles.e1z.push_back(e1.z);
+				m_triangles.e2x.push_back(e2.x);
+				m_triangles.e2y.push_back(e2.y);
+				m_triangles.e2z.push_back(e2.z);
+
+				m_triangleShading.push_back({ m, t });
+
+				m_materialIndices.push_back(loose ? looseMaterials[t] : mesh.materialIndex);
+				m_objectIndices.push_back(loose ? looseObjects[t] : -1);
+			}
+		}
+
+		indexObjects();
+	}
+
+	void PrimitiveStore::clear()
+	{
+		m_spheres = SphereHot();
+		m_triangles = TriangleHot();
+		m_triangleShading.clear();
+		m_meshes.clear();
+		m_materialIndices.clear();
+		m_objectIndices.clear();
+		m_objectPrimitives.clear();
+	}
+
+	void PrimitiveStore::reorder(std::vector<uint32_t>& order)
+	{
+		uint32_t sphereCount = getSphereCount();
+
+		PrimitiveStore sorted;
+		sorted.m_triangleShading.reserve(m_triangleShading.size());
+		sorted.m_meshes = m_meshes;
+
+		std::vector<uint32_t> newSphereIds, newTriangleIds;
+		for (uint32_t& id : order)
+		{
+			if (id < sphereCount)
+			{
+				sorted.m_spheres.centerX.push_back(m_spheres.centerX[id]);
+				sorted.m_spheres.centerY.push_back(m_spheres.centerY[id]);
+				sorted.m_spheres.centerZ.push_back(m_spheres.centerZ[id]);
+				sorted.m_spheres.radius.push_back(m_spheres.radius[id]);
+				newSphereIds.push_back(id);
+			}
+			else
+			{
+				uint32_t t = id - sphereCount;
+				sorted.m_triangles.v0x.push_back(m_triangles.v0x[t]);
+				sorted.m_triangles.v0y.push_back(m_triangles.v0y[t]);
+				sorted.m_triangles.v0z.push_back(m_triangles.v0z[t]);
+				sorted.m_triangles.e1x.push_back(m_triangles.e1x[t]);
+				sorted.m_triangles.e1y.push_back(m_triangles.e1y[t]);
+				sorted.m_triangles.e1z.push_back(m_triangles.e1z[t]);
+				sorted.m_triangles.e2x.push_back(m_triangles.e2x[t]);
+				sorted.m_triangles.e2y.push_back(m_triangles.e2y[t]);
+				sorted.m_triangles.e2z.push_back(m_triangles.e2z[t]);
+				sorted.m_triangleShading.push_back(m_triangleShading[t]);
+				newTriangleIds.push_back(id);
+			}
+		}
+
+		// Spheres keep the lower ids, so the per-primitive arrays are rebuilt spheres first.
+		for (uint32_t id : newSphereIds)
+		{
+			sorted.m_materialIndices.push_back(m_materialIndices[id]);
+			sorted.m_objectIndices.push_back(m_objectIndices[id]);
+		}
+		for (uint32_t id : newTriangleIds)
+		{
+			sorted.m_materialIndices.push_back(m_materialIndices[id]);
+			sorted.m_objectIndices.push_back(m_objectIndices[id]);
+		}
+
+		uint32_t nextSphere = 0, nextTriangle = sphereCount;
+		for (uint32_t& id : order)
+			id = id < sphereCount ? nextSphere++ : nextTriangle++;
+
+		*this = std::move(sorted);
+		indexObjects();
+	}
+
+	void PrimitiveStore::indexObjects()
+	{
+		m_objectPrimitives.clear();
+		for (uint32_t id = 0; id < size(); id++)
+		{
+			int object = m_objectIndices[id];
+			if (object < 0)
+				continue;
+
+			if ((size_t)object >= m_objectPrimitives.size())
+				m_objectPrimitives.resize(object + 1, -1);
+			m_objectPrimitives[object] = (int)id;
+		}
+	}
+
+	bool PrimitiveStore::setSphere(uint32_t id, const glm::vec3& center, float radius)
+	{
+		if (m_spheres.centerX[id] == center.x && m_spheres.centerY[id] == center.y && m_spheres.centerZ[id] == center.z && m_spheres.radius[id] == radius)
+			return false;
+
+		m_spheres.centerX[id] = center.x;
+		m_spheres.centerY[id] = center.y;
+		m_spheres.centerZ[id] = center.z;
+		m_spheres.radius[id] = radius;
+		return true;
+	}
+
+	bool PrimitiveStore::setMaterialIndex(uint32_t id, int materialIndex)
+	{
+		if (m_materialIndices[id] == materialIndex)
+			return false;
+
+		m_materialIndices[id] = materialIndex;
+		return true;
+	}
+
+	bool PrimitiveStore::setMeshMaterialIndex(uint32_t mesh, int materialIndex)
+	{
+		uint32_t sphereCount = getSphereCount();
+
+		bool changed = false;
+		for (uint32_t t = 0; t < getTriangleCount(); t++)
+		{
+			if (m_triangleShading[t].mesh == mesh && m_materialIndices[sphereCount + t] != materialIndex)
+			{
+				m_materialIndices[sphereCount + t] = materialIndex;
+				changed = true;
+			}
+		}
+		return changed;
+	}
+
+	bool PrimitiveStore::usesMaterial(int materialIndex) const
+	{
+		return std::find(m_materialIndices.begin(), m_materialIndices.end(), materialIndex) != m_materialIndices.end();
+	}
+
+	float PrimitiveStore::intersectSphere(uint32_t sphere, const Ray& ray) const
+	{
+		glm::vec3 origin = ray.origin - glm::vec3(m_spheres.centerX[sphere], m_spheres.centerY[sphere], m_spheres.centerZ[sphere]);
+		float radius = m_spheres.radius[sphere];
+
+		float a = glm::dot(ray.direction, ray.direction);
+		float half_b = glm::dot(origin, ray.direction);
+		float c = glm::dot(origin, origin) - (radius * radius);
+
+		float discriminant = half_b * half_b - a * c;
+
+		if (discriminant < 0.0f)
+			return -1.0f;
+
+		return ((-half_b - glm::sqrt(discriminant)) / a);
+	}
+
+	float PrimitiveStore::intersectTriangle(uint32_t triangle, const Ray& ray) const
+	{
+		glm::vec3 v0(m_triangles.v0x[triangle], m_triangles.v0y[triangle], m_triangles.v0z[triangle]);
+		glm::vec3 e1(m_triangles.e1x[triangle], m_triangles.e1y[triangle], m_triangles.e1z[triangle]);
+		glm::vec3 e2(m_triangles.e2x[triangle], m_triangles.e2y[triangle], m_triangles.e2z[triangle]);
+
+		// Two-sided, so refracted rays also hit the inside of closed meshes
+		glm::vec3 pvec = glm::cross(ray.direction, e2);
+		float det = glm::dot(e1, pvec);
+
+		if (std::abs(det) < 1e-12f) return -1.0f;
+
+		float inv_det = 1.0f / det;
+		glm::vec3 tvec = ray.origin - v0;
+		float u = glm::dot(tvec, pvec) * inv_det;
+
+		if (u < 0.0f || u > 1.0f) return -1.0f;
+
+		glm::vec3 qvec = glm::cross(tvec, e1);
+		float v = glm::dot(ray.direction, qvec) * inv_det;
+
+		if (v < 0.0f || u + v > 1.0f) return -1.0f;
+
+		return glm::dot(e2, qvec) * inv_det;
+	}
+
+	void PrimitiveStore::setHitPayload(const RayHit& hit, const Ray& ray, HitPayload& payload) const
+	{
+		uint32_t id = hit.primitiveIndex;
+
+		payload.materialIndex = m_materialIndices[id];
+		payload.objectIndex = m_objectIndices[id];
+		payload.primitiveIndex = id;
+
+		uint32_t sphereCount = getSphereCount();
+		if (id < sphereCount)
+		{
+			glm::vec3 center(m_spheres.centerX[id], m_spheres.centerY[id], m_spheres.centerZ[id]);
+			glm::vec3 outwardNormal = (payload.position - center) / m_spheres.radius[id];
+			payload.frontFace = glm::dot(ray.direction, outwardNormal) < 0;
+			payload.normal = payload.frontFace ? outwardNormal : -outwardNormal;
+			return;
+		}
+
+		const TriangleCold& shading = m_triangleShading[id - sphereCount];
+		m_meshes[shading.mesh]->setHitPayload(shading.triangle, ray, hit.barycentrics, payload);
+	}
+
+	AABB PrimitiveStore::getBounds(uint32_t id) const
+	{
+		AABB bounds;
+
+		uint32_t sphereCount = getSphereCount();
+		if (id < sphereCount)
+		{
+			glm::vec3 center(m_spheres.centerX[id], m_spheres.centerY[id], m_spheres.centerZ[id]);
+			bounds.grow(center - glm::vec3(m_spheres.radius[id]));
+			bounds.grow(center + glm::vec3(m_spheres.radius[id]));
+			return bounds;
+		}
+
+		uint32_t t = id - sphereCount;
+		glm::vec3 v0(m_triangles.v0x[t], m_triangles.v0y[t], m_triangles.v0z[t]);
+		glm::vec3 e1(m_triangles.e1x[t], m_triangles.e1y[t], m_triangles.e1z[t]);
+		glm::vec3 e2(m_triangles.e2x[t], m_triangles.e2y[t], m_triangles.e2z[t]);
+		bounds.grow(v0);
+		bounds.grow(v0 + e1);
+		bounds.grow(v0 + e2);
+		return bounds;
+	}
+
+	bool PrimitiveStore::sampleDirection(uint32_t id, const glm::vec3& from, const glm::vec2& u, glm::vec3& direction, float& distance, float& pdf) const
+	{
+		uint32_t sphereCount = getSphereCount();
+		if (id < sphereCount)
+		{
+			// Uniform over the cone the sphere subtends, so no sample lands on the side facing away.
+			glm::vec3 center(m_spheres.centerX[id], m_spheres.centerY[id], m_spheres.centerZ[id]);
+			float radius = m_spheres.radius[id];
+
+			pdf = sphereConePdf(center, radius, from);
+			if (pdf <= 0.0f || !std::isfinite(pdf))
+				return false;
+
+			glm::vec3 toCenter = center - from;
+			float centerDistance2 = glm::dot(toCenter, toCenter);
+			float centerDistance = glm::sqrt(centerDistance2);
+
+			float oneMinusCosThetaMax = 1.0f / (glm::two_pi<float>() * pdf);
+			float cosTheta = 1.0f - u.x * oneMinusCosThetaMax;
+			float sinTheta = glm::sqrt(glm::max(0.0f, 1.0f - cosTheta * cosTheta));
+			float phi = glm::two_pi<float>() * u.y;
+
+			// Any basis around the axis works, the cone is symmetric
+			glm::vec3 w = toCenter / centerDistance;
+			glm::vec3 helper = std::abs(w.x) > 0.9f ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+			glm::vec3 tangent = glm::normalize(glm::cross(helper, w));
+			glm::vec3 bitangent = glm::cross(w, tangent);
+
+			direction = glm::normalize(tangent * (glm::cos(phi) * sinTheta) + bitangent * (glm::sin(phi) * sinTheta) + w * cosTheta);
+
+			// Near intersection of the sampled direction with the sphere
+			float b = centerDistance * cosTheta;
+			distance = b - glm::sqrt(glm::max(0.0f, b * b - centerDistance2 + radius * radius));
+			return distance > 0.0f;
+		}
+
+		uint32_t t = id - sphereCount;
+		glm::vec3 v0(m_triangles.v0x[t], m_triangles.v0y[t], m_triangles.v0z[t]);
+		glm::vec3 e1(m_triangles.e1x[t], m_triangles.e1y[t], m_triangles.e1z[t]);
+		glm::vec3 e2(m_triangles.e2x[t], m_triangles.e2y[t], m_triangles.e2z[t]);
+
+		// Uniform over the area, the square is folded onto the triangle
+		glm::vec2 b = u.x + u.y > 1.0f ? glm::vec2(1.0f) - u : u;
+		glm::vec3 position = v0 + e1 * b.x + e2 * b.y;
+
+		glm::vec3 toPosition = position - from;
+		distance = glm::length(toPosition);
+		if (distance <= 0.0f)
+			return false;
+
+		direction = toPosition / distance;
+		pdf = directionPdf(id, from, position);
+		return pdf > 0.0f && std::isfinite(pdf);
+	}
+
+	float PrimitiveStore::directionPdf(uint32_t id, const glm::vec3& from, const glm::vec3& position) const
+	{
+		uint32_t sphereCount = getSphereCount();
+		if (id < sphereCount)
+			return sphereConePdf(glm::vec3(m_spheres.centerX[id], m_spheres.centerY[id], m_spheres.centerZ[id]), m_spheres.radius[id], from);
+
+		uint32_t t = id - sphereCount;
+		glm::vec3 e1(m_triangles.e1x[t], m_triangles.e1y[t], m_triangles.e1z[t]);
+		glm::vec3 e2(m_triangles.e2x[t], m_triangles.e2y[t], m_triangles.e2z[t]);
+
+		glm::vec3 normal = glm::cross(e1, e2);
+		float doubleArea = glm::length(normal);
+
+		glm::vec3 toPosition = position - from;
+		float distance2 = glm::dot(toPosition, toPosition);
+		if (doubleArea <= 0.0f || distance2 <= 0.0f)
+			return 0.0f;
+
+		// Triangles are two-sided, both faces emit
+		float cosine = std::abs(glm::dot(normal, toPosition)) / (doubleArea * glm::sqrt(distance2));
+		if (cosine <= 0.0f)
+			return 0.0f;
+
+		// Area pdf 1 / area converted to solid angle
+		return distance2 / (0.5f * doubleArea * cosine);
+	}
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include "AABB.h"
+#include "Hittables.h"
+#include "HitPayload.h"
+#include "Ray.h"
+
+#include <vector>
+#include <memory>
+
+namespace Vibrato
+{
+	// Flat, type-segregated copy of Scene::objects used for tracing.
+	// Primitive ids are linear: [0, sphereCount) are spheres, the rest are triangles.
+	// Hot arrays hold only what intersection needs, shading data lives in the cold arrays.
+	class PrimitiveStore
+	{
+	public:
+		struct SphereHot
+		{
+			std::vector<float> centerX, centerY, centerZ;
+			std::vector<float> radius;
+		};
+
+		struct TriangleHot
+		{
+			std::vector<float> v0x, v0y, v0z;
+			std::vector<float> e1x, e1y, e1z;
+			std::vector<float> e2x, e2y, e2z;
+		};
+
+		// Shading data is read from the owning mesh's shared vertex buffers.
+		struct TriangleCold
+		{
+			uint32_t mesh;
+			uint32_t triangle;
+		};
+
+	public:
+		// Loose Triangle objects are gathered into an internal mesh.
+		void build(const std::vector<std::shared_ptr<Hittable>>& objects, const std::vector<std::shared_ptr<TriangleMesh>>& meshes);
+		void clear();
+
+		// Reorders the primitives so they are stored in the given order, ids in `order` are rewritten in place.
+		void reorder(std::vector<uint32_t>& order);
+
+		// In place edits that keep every id, each returns whether anything changed.
+		// Moved primitives leave the acceleration structure to be refitted.
+		bool setSphere(uint32_t id, const glm::vec3& center, float radius);
+		bool setMaterialIndex(uint32_t id, int materialIndex);
+		// Every triangle of Scene::meshes[mesh].
+		bool setMeshMaterialIndex(uint32_t mesh, int materialIndex);
+		bool usesMaterial(int materialIndex) const;
+
+		inline uint32_t getSphereCount() const { return (uint32_t)m_spheres.radius.size(); }
+		inline uint32_t getTriangleCount() const { return (uint32_t)m_triangles.v0x.size(); }
+		inline uint32_t size() const { return getSphereCount() + getTriangleCount(); }
+
+		inline bool isSphere(uint32_t id) const { return id < getSphereCount(); }
+
+		inline float intersect(uint32_t id, const Ray& ray) const
+		{
+			uint32_t sphereCount = getSphereCount();
+			return id < sphereCount ? intersectSphere(id, ray) : intersectTriangle(id - sphereCount, ray);
+		}
+
+		float intersectSphere(uint32_t sphere, const Ray& ray) const;
+		float intersectTriangle(uint32_t triangle, const Ray& ray) const;
+
+		void setHitPayload(const RayHit& hit, const Ray& ray, HitPayload& payload) const;
+
+		AABB getBounds(uint32_t id) const;
+
+		// Picks a point on the primitive as seen from `from`, for shadow rays towards emitters. u is uniform in [0, 1).
+		// pdf is per unit solid angle at `from`, returns false when there is nothing to sample from there.
+		bool sampleDirection(uint32_t id, const glm::vec3& from, const glm::vec2& u, glm::vec3& direction, float& distance, float& pdf) const;
+		// Solid angle pdf of sampleDirection picking `position` on the primitive.
+		float directionPdf(uint32_t id, const glm::vec3& from, const glm::vec3& position) const;
+
+		inline int getMaterialIndex(uint32_t id) const { return m_materialIndices[id]; }
+		// Index into Scene::objects, -1 for triangles that belong to a mesh.
+		inline int getObjectIndex(uint32_t id) const { return m_objectIndices[id]; }
+		// Primitive id of Scene::objects[object], -1 when it has none.
+		inline int getObjectPrimitive(uint32_t object) const { return object < m_objectPrimitives.size() ? m_objectPrimitives[object] : -1; }
+
+		// Mesh and triangle within it that triangle t of the store came from.
+		inline const TriangleCold& getTriangleSource(uint32_t t) const { return m_triangleShading[t]; }
+
+		inline const SphereHot& getSpheres() const { return m_spheres; }
+		inline const TriangleHot& getTriangles() const { return m_triangles; }
+
+	private:
+		void indexObjects();
+
+	private:
+		SphereHot m_spheres;
+		TriangleHot m_triangles;
+		std::vector<TriangleCold> m_triangleShading;
+
+		std::vector<std::shared_ptr<const TriangleMesh>> m_meshes;
+
+		// Indexed by primitive id.
+		std::vector<int> m_materialIndices;
+		std::vector<int> m_objectIndices;
+		std::vector<int> m_objectPrimitives; // inverse of m_objectIndices
+	};
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "HitPayload.h"
+#include "Ray.h"
+
+#include <cstdint>
+#include <limits>
+
+namespace Vibrato
+{
+	// Coherent rays (e.g. neighbouring camera rays) stored per component so one AVX2 op covers the whole packet.
+	struct RayPacket
+	{
+		static constexpr int SIZE = 8;
+
+		alignas(32) float originX[SIZE];
+		alignas(32) float originY[SIZE];
+		alignas(32) float originZ[SIZE];
+		alignas(32) float directionX[SIZE];
+		alignas(32) float directionY[SIZE];
+		alignas(32) float directionZ[SIZE];
+
+		uint32_t count = 0;
+
+		inline void set(int lane, const Ray& ray)
+		{
+			originX[lane] = ray.origin.x;
+			originY[lane] = ray.origin.y;
+			originZ[lane] = ray.origin.z;
+			directionX[lane] = ray.direction.x;
+			directionY[lane] = ray.direction.y;
+			directionZ[lane] = ray.direction.z;
+		}
+
+		inline Ray get(int lane) const
+		{
+			Ray ray;
+			ray.origin = glm::vec3(originX[lane], originY[lane], originZ[lane]);
+			ray.direction = glm::vec3(directionX[lane], directionY[lane], directionZ[lane]);
+			return ray;
+		}
+	};
+
+	// Per-lane closest hits of a RayPacket.
+	// Lanes past RayPacket::count start at a negative distance, which no box or primitive test can beat.
+	struct PacketHit
+	{
+		alignas(32) float distance[RayPacket::SIZE];
+		alignas(32) uint32_t primitiveIndex[RayPacket::SIZE];
+		alignas(32) float u[RayPacket::SIZE];
+		alignas(32) float v[RayPacket::SIZE];
+		uint32_t instance[RayPacket::SIZE];
+
+		inline void reset(uint32_t count)
+		{
+			for (uint32_t i = 0; i < (uint32_t)RayPacket::SIZE; i++)
+			{
+				distance[i] = i < count ? std::numeric_limits<float>::max() : -1.0f;
+				primitiveIndex[i] = 0;
+				u[i] = v[i] = 0.0f;
+				instance[i] = UINT32_MAX;
+			}
+		}
+
+		inline bool isHit(int lane) const { return distance[lane] >= 0.0f && distance[lane] != std::numeric_limits<float>::max(); }
+
+		inline RayHit get(int lane) const { return { distance[lane], primitiveIndex[lane], glm::vec2(u[lane], v[lane]), instance[lane] }; }
+
+		inline void set(int lane, const RayHit& hit)
+		{
+			distance[lane] = hit.distance;
+			primitiveIndex[lane] = hit.primitiveIndex;
+			u[lane] = hit.barycentrics.x;
+			v[lane] = hit.barycentrics.y;
+			instance[lane] = hit.instance;
+		}
+	};
+}
@@ -0,0 +1,196 @@
+#include "RenderThread.h"
+
+#include "Clef/Timer.h"
+
+namespace Vibrato
+{
+	RenderThread::RenderThread(Scene&& scene, const Camera& camera, const Renderer::Settings& settings)
+		: m_scene(std::move(scene)), m_camera(camera)
+	{
+		m_renderer.getSettings() = settings;
+		m_thread = std::thread(&RenderThread::run, this);
+	}
+
+	RenderThread::~RenderThread()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_messageMutex);
+			m_stop = true;
+		}
+		m_wake.notify_one();
+
+		// A frame already being traced is finished first
+		m_thread.join();
+	}
+
+	void RenderThread::post(Message message)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_messageMutex);
+			m_messages.push_back(std::move(message));
+		}
+		m_wake.notify_one();
+	}
+
+	void RenderThread::setViewport(uint32_t width, uint32_t height)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_messageMutex);
+			if (m_viewportWidth == width && m_viewportHeight == height)
+				return;
+
+			m_viewportWidth = width;
+			m_viewportHeight = height;
+		}
+		m_wake.notify_one();
+	}
+
+	void RenderThread::setCamera(const Camera& camera)
+	{
+		post([camera](Scene&, Camera& renderCamera, Renderer& renderer)
+		{
+			renderCamera = camera;
+			renderer.resetFrameIndex();
+		});
+	}
+
+	void RenderThread::setSettings(const Renderer::Settings& settings)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_messageMutex);
+			m_pendingSettings = settings;
+			m_settingsChanged = true;
+		}
+		m_wake.notify_one();
+	}
+
+	void RenderThread::resetFrameIndex()
+	{
+		post([](Scene&, Camera&, Renderer& renderer) { renderer.resetFrameIndex(); });
+	}
+
+	void RenderThread::screenshot()
+	{
+		// Between frames the renderer's output is still the frame it finished last
+		post([this](Scene&, Camera&, Renderer& renderer)
+		{
+			if (m_frameInfo.frameNumber > 0)
+				renderer.screenshot();
+		});
+	}
+
+	bool RenderThread::readFrame(uint64_t lastFrameNumber, const std::function<void(const uint32_t* pixels, const FrameInfo& info)>& read)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_frameMutex);
+			if (m_frameInfo.frameNumber <= lastFrameNumber)
+				return false;
+
+			// Otherwise the newest frame already is the front one
+			if (m_readyIsNew)
+			{
+				std::swap(m_front, m_ready);
+				m_frontInfo = m_frameInfo;
+				m_readyIsNew = false;
+			}
+		}
+
+		read(m_frames[m_front].data(), m_frontInfo);
+		return true;
+	}
+
+	RenderThread::FrameInfo RenderThread::getFrameInfo() const
+	{
+		std::lock_guard<std::mutex> lock(m_frameMutex);
+		return m_frameInfo;
+	}
+
+	void RenderThread::run()
+	{
+		bool idle = false;
+		while (applyMessages(idle))
+		{
+			idle = m_width == 0 || m_height == 0;
+			if (idle)
+				continue;
+
+			Clef::Timer timer;
+
+			m_renderer.onResize(m_width, m_height);
+			m_camera.onResize(m_width, m_height);
+
+			std::vector<uint32_t>& frame = m_frames[m_back];
+			frame.resize((size_t)m_width * m_height);
+			m_renderer.setOutputBuffer(frame.data());
+			m_renderer.render(m_scene, m_camera);
+
+			publishFrame(timer.elapsedMillis());
+
+			// Once adaptive sampling has converged everywhere further frames change nothing
+			const Renderer::Settings& settings = m_renderer.getSettings();
+			idle = settings.accumulate && settings.adaptiveSampling && m_renderer.getActivePixelCount() == 0;
+		}
+	}
+
+	bool RenderThread::applyMessages(bool idle)
+	{
+		std::vector<Message> messages;
+		{
+			std::unique_lock<std::mutex> lock(m_messageMutex);
+			if (idle)
+			{
+				m_wake.wait(lock, [this]
+				{
+					return m_stop || m_settingsChanged || !m_messages.empty() ||
+						m_viewportWidth != m_width || m_viewportHeight != m_height;
+				});
+			}
+
+			if (m_stop)
+				return false;
+
+			messages.swap(m_messages);
+			if (m_settingsChanged)
+			{
+				m_renderer.getSettings() = m_pendingSettings;
+				m_settingsChanged = false;
+			}
+			m_width = m_viewportWidth;
+			m_height = m_viewportHeight;
+		}
+
+		for (Message& message : messages)
+			message(m_scene, m_camera, m_renderer);
+
+		// Edits marked by the messages, accumulation restarts only when they show
+		if (m_scene.update())
+			m_renderer.resetFrameIndex();
+
+		return true;
+	}
+
+	void RenderThread::publishFrame(float renderTime)
+	{
+		std::lock_guard<std::mutex> lock(m_frameMutex);
+
+		FrameInfo& info = m_frameInfo;
+		info.frameNumber++;
+		info.width = m_renderer.getWidth();
+		info.height = m_renderer.getHeight();
+
+		info.renderTime = renderTime;
+		info.resolveTime = m_renderer.getResolveTime();
+		info.averagePathLength = m_renderer.getAveragePathLength();
+		info.activePixelCount = m_renderer.getActivePixelCount();
+		info.traversalStats = m_renderer.getTraversalStats();
+
+		info.buildStats = m_scene.bvh.getBuildStats();
+		info.traversalKernel = m_scene.wideBvh.getKernelName();
+		info.wideBvhNodeCount = m_scene.wideBvh.getNodeCount();
+		info.lightCount = m_scene.lights.getLightCount();
+		info.lightNodeCount = m_scene.lights.getNodeCount();
+
+		std::swap(m_back, m_ready);
+		m_readyIsNew = true;
+	}
+}
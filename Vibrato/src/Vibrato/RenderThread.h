@@ -0,0 +1,104 @@
+#pragma once
+
+#include "Renderer.h"
+#include "Camera.h"
+#include "Scene.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace Vibrato
+{
+	// Runs a renderer on a thread of its own so whoever drives the UI never waits for a frame.
+	// The scene, camera and settings it renders belong to that thread: changes are posted as messages
+	// and applied between frames, finished frames come back through a triple buffer.
+	class RenderThread
+	{
+	public:
+		// Runs on the render thread, between frames. Scene edits should be marked dirty rather than committed,
+		// they are applied together once all messages ran.
+		using Message = std::function<void(Scene& scene, Camera& camera, Renderer& renderer)>;
+
+		// Copied out together with every finished frame.
+		struct FrameInfo
+		{
+			uint64_t frameNumber = 0; // 0 until the first frame is done
+			uint32_t width = 0, height = 0;
+
+			float renderTime = 0.0f; // ms, render and resolve
+			float resolveTime = 0.0f;
+			float averagePathLength = 0.0f;
+			uint32_t activePixelCount = 0;
+			BVH::TraversalStats traversalStats;
+
+			BVH::BuildStats buildStats;
+			const char* traversalKernel = "";
+			uint32_t wideBvhNodeCount = 0;
+			uint32_t lightCount = 0, lightNodeCount = 0;
+		};
+
+	public:
+		RenderThread(Scene&& scene, const Camera& camera, const Renderer::Settings& settings);
+		~RenderThread();
+
+		RenderThread(const RenderThread&) = delete;
+		RenderThread& operator=(const RenderThread&) = delete;
+
+		// Messages apply in the order they were posted, all of them before the next frame starts.
+		void post(Message message);
+
+		// Takes effect with the next frame, setting the same size again does nothing.
+		void setViewport(uint32_t width, uint32_t height);
+		// Replaces the camera and restarts accumulation.
+		void setCamera(const Camera& camera);
+		// Only the latest settings matter, so these are not queued but replace any still pending.
+		void setSettings(const Renderer::Settings& settings);
+		void resetFrameIndex();
+		// Saves the newest finished frame.
+		void screenshot();
+
+		// Calls read with the newest finished frame if it is newer than lastFrameNumber and returns whether it did.
+		// read runs without any lock held, the frame is the reader's until the next call, so the render thread
+		// can publish meanwhile however long read takes. Meant for a single reading thread.
+		bool readFrame(uint64_t lastFrameNumber, const std::function<void(const uint32_t* pixels, const FrameInfo& info)>& read);
+		FrameInfo getFrameInfo() const;
+
+	private:
+		void run();
+		// Waits for something to be posted first when idle, returns false when stopping.
+		bool applyMessages(bool idle);
+		void publishFrame(float renderTime);
+
+	private:
+		// Only touched by the render thread once it runs
+		Scene m_scene;
+		Camera m_camera;
+		Renderer m_renderer;
+		uint32_t m_width = 0, m_height = 0;
+
+		// Pending changes
+		std::mutex m_messageMutex;
+		std::condition_variable m_wake;
+		std::vector<Message> m_messages;
+		Renderer::Settings m_pendingSettings;
+		bool m_settingsChanged = false;
+		uint32_t m_viewportWidth = 0, m_viewportHeight = 0;
+		bool m_stop = false;
+
+		// Finished frames, the renderer resolves into m_frames[m_back] while the reader uses m_frames[m_front].
+		// Publishing and reading only swap indices with m_ready, the newest finished frame.
+		mutable std::mutex m_frameMutex;
+		std::vector<uint32_t> m_frames[3];
+		uint32_t m_back = 0, m_ready = 1, m_front = 2;
+		bool m_readyIsNew = false; // m_ready has not been taken by the reader yet
+		FrameInfo m_frameInfo;
+		FrameInfo m_frontInfo; // only touched by the reader
+
+		std::thread m_thread;
+	};
+}
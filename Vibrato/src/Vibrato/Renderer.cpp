@@ -1,14 +1,19 @@
 #include "Renderer.h"
 
-#include "Clef/Random.h"
-
 #include "Utils.h"
 
+#include "Clef/Timer.h"
+
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
 #include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
 
 #include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
 
 namespace Vibrato
 {
@@ -20,19 +25,74 @@ namespace Vibrato
 		return r0 + (1 - r0) * pow((1 - cosine), 5);
 	}
 
-	void Renderer::onResize(uint32_t width, uint32_t height)
+	// Multiple importance sampling weight of a sample drawn with pdf a against a strategy with pdf b.
+	static float powerHeuristic(float a, float b)
 	{
-		if (m_finalImage)
-		{
-			if (m_finalImage->getWidth() == width && m_finalImage->getHeight() == height)
-				return;
+		return (a * a) / (a * a + b * b);
+	}
 
-			m_finalImage->resize(width, height);
-		}
-		else
+	static float luminance(const glm::vec3& color)
+	{
+		return glm::dot(color, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+	}
+
+	// Blue at 0, green at 0.5, red at 1.
+	static glm::vec3 heatmapColor(float t)
+	{
+		return glm::vec3(std::max(2.0f * t - 1.0f, 0.0f), 1.0f - std::abs(2.0f * t - 1.0f), std::max(1.0f - 2.0f * t, 0.0f));
+	}
+
+	// Offset from the pixel center distributed like the Blackman-Harris window, by inverting its tabulated CDF.
+	static float sampleBlackmanHarris(float u)
+	{
+		constexpr float RADIUS = 1.5f;
+		constexpr int TABLE_SIZE = 256;
+
+		// The integral of the window over [0, t] of its width, divided by the whole integral a0
+		static const std::vector<float> cdf = []()
 		{
-			m_finalImage = std::make_shared<Clef::Image>(width, height, Clef::ImageFormat::RGBA);
-		}
+			constexpr float a0 = 0.35875f, a1 = 0.48829f, a2 = 0.14128f, a3 = 0.01168f;
+			constexpr float twoPi = glm::two_pi<float>();
+
+			std::vector<float> table(TABLE_SIZE + 1);
+			for (int i = 0; i <= TABLE_SIZE; i++)
+			{
+				float t = (float)i / TABLE_SIZE;
+				float integral = a0 * t - a1 * std::sin(twoPi * t) / twoPi + a2 * std::sin(2.0f * twoPi * t) / (2.0f * twoPi)
+					- a3 * std::sin(3.0f * twoPi * t) / (3.0f * twoPi);
+				table[i] = integral / a0;
+			}
+			table[TABLE_SIZE] = 1.0f;
+			return table;
+		}();
+
+		int bin = (int)(std::upper_bound(cdf.begin(), cdf.end(), u) - cdf.begin()) - 1;
+		bin = std::clamp(bin, 0, TABLE_SIZE - 1);
+
+		float width = cdf[bin + 1] - cdf[bin];
+		float t = (bin + (width > 0.0f ? (u - cdf[bin]) / width : 0.5f)) / TABLE_SIZE;
+		return (2.0f * t - 1.0f) * RADIUS;
+	}
+
+	// Most samples a pixel takes in one frame under adaptive sampling, as a multiple of samplesPerPixel.
+	static constexpr uint32_t MAX_ADAPTIVE_BOOST = 8;
+
+	// Items per parallelChunks task.
+	static constexpr uint32_t WAVEFRONT_CHUNK = 1024;
+	// Paths the wavefront integrator keeps in flight, frames with more samples are traced in several waves.
+	static constexpr uint32_t WAVEFRONT_WAVE_SIZE = 1 << 21;
+
+	// Rays traced per bounce by the current thread, added to the frame counters after every task.
+	static thread_local std::vector<uint64_t> t_bounceRays;
+
+	void Renderer::onResize(uint32_t width, uint32_t height)
+	{
+		if (m_imageData && m_width == width && m_height == height)
+			return;
+
+		m_width = width;
+		m_height = height;
+		m_outputData = nullptr;
 
 		delete[] m_imageData;
 		m_imageData = new uint32_t[width * height];
@@ -40,14 +100,51 @@ namespace Vibrato
 		delete[] m_accumulationData;
 		m_accumulationData = new glm::vec4[width * height];
 
-		m_imgHorizontalIter.resize(width);
-		m_imgVerticalIter.resize(height);
+		delete[] m_luminanceSquares;
+		m_luminanceSquares = new float[width * height];
+
+		m_sampleOffsets.clear();
+		m_activePixelCount = width * height;
+
+		m_tiles.clear();
+	}
+
+	void Renderer::updateTiles()
+	{
+		uint32_t tileSize = (uint32_t)std::max(m_settings.tileSize, 1);
+		if (!m_tiles.empty() && tileSize == m_tileSize && m_settings.tileOrder == m_tileOrder)
+			return;
+
+		m_tileSize = tileSize;
+		m_tileOrder = m_settings.tileOrder;
+
+		uint32_t tilesX = (m_width + tileSize - 1) / tileSize;
+		uint32_t tilesY = (m_height + tileSize - 1) / tileSize;
 
-		for (uint32_t i = 0; i < width; i++)
-			m_imgHorizontalIter[i] = i;
+		uint32_t gridSize = 1;
+		while (gridSize < tilesX || gridSize < tilesY)
+			gridSize *= 2;
 
-		for (uint32_t i = 0; i < height; i++)
-			m_imgVerticalIter[i] = i;
+		std::vector<std::pair<uint32_t, Tile>> ordered;
+		for (uint32_t y = 0; y < tilesY; y++)
+		{
+			for (uint32_t x = 0; x < tilesX; x++)
+			{
+				uint32_t key = x + y * tilesX;
+				if (m_tileOrder == TileOrder::Morton)
+					key = Utils::mortonIndex(x, y);
+				else if (m_tileOrder == TileOrder::Hilbert)
+					key = Utils::hilbertIndex(gridSize, x, y);
+
+				ordered.push_back({ key, { x * tileSize, y * tileSize } });
+			}
+		}
+
+		std::sort(ordered.begin(), ordered.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+
+		m_tiles.clear();
+		for (const auto& [key, tile] : ordered)
+			m_tiles.push_back(tile);
 	}
 
 	void Renderer::render(const Scene& scene, const Camera& camera)
@@ -56,198 +153,746 @@ namespace Vibrato
 		m_activeCamera = &camera;
 
 		if (m_frameIndex == 1)
-			memset(m_accumulationData, 0, m_finalImage->getWidth() * m_finalImage->getHeight() * sizeof(glm::vec4));
+		{
+			memset(m_accumulationData, 0, m_width * m_height * sizeof(glm::vec4));
+			memset(m_luminanceSquares, 0, m_width * m_height * sizeof(float));
+		}
 
-#define MT 1
-#if MT
+		m_threadPool.resize((uint32_t)std::max(m_settings.threadCount, 0));
+		updateTiles();
+		planSamples();
 
-		std::for_each(std::execution::par, m_imgVerticalIter.begin(), m_imgVerticalIter.end(),
-		[this](uint32_t y)
+		FrameCounters counters;
+		counters.bounceRays.assign(std::max(m_settings.bounces, 1), 0);
+
+		if (m_settings.integrator == Integrator::Wavefront)
 		{
-	#if 0
-			std::for_each(std::execution::par, m_imgHorizontalIter.begin(), m_imgHorizontalIter.end(),
-			[this, y](uint32_t x)
+			renderWavefront(counters);
+		}
+		else
+		{
+			m_threadPool.run((uint32_t)m_tiles.size(), [this, &counters](uint32_t tile)
 			{
-				glm::vec4 color = perPixel(x, y);
-				m_accumulationData[x + y * m_finalImage->getWidth()] += color;
+				BVH::TraversalStats& stats = BVH::threadTraversalStats();
+				stats = BVH::TraversalStats();
+				t_bounceRays.assign(counters.bounceRays.size(), 0);
 
-				glm::vec4 accumulatedColor = m_accumulationData[x + y * m_finalImage->getWidth()];
-				accumulatedColor /= (float)m_frameIndex;
+				renderTile(m_tiles[tile]);
 
-				accumulatedColor = glm::clamp(accumulatedColor, glm::vec4(0.0f), glm::vec4(1.0f));
-				m_imageData[x + y * m_finalImage->getWidth()] = Utils::convertToRGBA(accumulatedColor);
+				counters.add(stats);
+				counters.addBounceRays(t_bounceRays);
 			});
-	#else
-			for (uint32_t x = 0; x < m_finalImage->getWidth(); x++)
-			{
-				glm::vec4 color = perPixel(x, y);
-				m_accumulationData[x + y * m_finalImage->getWidth()] += color;
+		}
+
+		resolve();
+
+		m_traversalStats.rays = counters.rays;
+		m_traversalStats.nodesVisited = counters.nodesVisited;
+		m_traversalStats.primitiveTests = counters.primitiveTests;
+		m_bounceRayCounts = counters.bounceRays;
+		m_pathCount = m_sampleOffsets.empty() ? (uint64_t)m_width * m_height * std::max(m_settings.samplesPerPixel, 1) : m_sampleOffsets.back();
+
+		if (m_settings.accumulate)
+			m_frameIndex++;
+		else
+			m_frameIndex = 1;
+	}
+
+	void Renderer::planSamples()
+	{
+		uint32_t pixelCount = m_width * m_height;
+		uint32_t samples = (uint32_t)std::max(m_settings.samplesPerPixel, 1);
+
+		if (!m_settings.adaptiveSampling || m_frameIndex == 1)
+		{
+			m_sampleOffsets.clear();
+			m_activePixelCount = pixelCount;
+			return;
+		}
 
-				glm::vec4 accumulatedColor = m_accumulationData[x + y * m_finalImage->getWidth()];
-				accumulatedColor /= (float)m_frameIndex;
+		m_pixelErrors.resize(pixelCount);
+		parallelChunks(pixelCount, [this](uint32_t begin, uint32_t end)
+		{
+			for (uint32_t pixel = begin; pixel < end; pixel++)
+				m_pixelErrors[pixel] = pixelError(pixel);
+		});
 
-				accumulatedColor = glm::clamp(accumulatedColor, glm::vec4(0.0f), glm::vec4(1.0f));
-				m_imageData[x + y * m_finalImage->getWidth()] = Utils::convertToRGBA(accumulatedColor);
+		// A pixel keeps sampling while any of its neighbours is above the threshold. One pixel's estimate is
+		// too noisy to trust alone, a path that rarely finds a light can look converged after a few samples.
+		m_sampleOffsets.resize(pixelCount + 1);
+		parallelChunks(pixelCount, [this](uint32_t begin, uint32_t end)
+		{
+			for (uint32_t pixel = begin; pixel < end; pixel++)
+			{
+				uint32_t x = pixel % m_width, y = pixel / m_width;
+				uint32_t minX = x > 0 ? x - 1 : x, maxX = std::min(x + 1, m_width - 1);
+				uint32_t minY = y > 0 ? y - 1 : y, maxY = std::min(y + 1, m_height - 1);
+
+				bool active = false;
+				for (uint32_t ny = minY; ny <= maxY && !active; ny++)
+				{
+					for (uint32_t nx = minX; nx <= maxX && !active; nx++)
+						active = m_pixelErrors[nx + ny * m_width] > m_settings.noiseThreshold;
+				}
+				m_sampleOffsets[pixel] = active ? 1 : 0;
 			}
 		});
-	#endif
 
-#else
+		uint32_t activePixels = 0;
+		for (uint32_t pixel = 0; pixel < pixelCount; pixel++)
+			activePixels += m_sampleOffsets[pixel];
+		m_activePixelCount = activePixels;
+
+		// Converged pixels hand their share of the frame's samples to the ones still sampling,
+		// the k-th active pixel takes the samples between k and k + 1 times budget / activePixels.
+		uint64_t budget = std::min<uint64_t>((uint64_t)pixelCount * samples, (uint64_t)activePixels * samples * MAX_ADAPTIVE_BOOST);
 
-		for (uint32_t y = 0; y < m_finalImage->getHeight(); y++)
+		uint64_t offset = 0;
+		uint64_t active = 0;
+		for (uint32_t pixel = 0; pixel < pixelCount; pixel++)
 		{
-			for (uint32_t x = 0; x < m_finalImage->getWidth(); x++)
+			uint32_t count = 0;
+			if (m_sampleOffsets[pixel])
 			{
-				glm::vec4 color = perPixel(x, y);
-				m_accumulationData[x + y * m_finalImage->getWidth()] += color;
+				count = (uint32_t)((active + 1) * budget / activePixels - active * budget / activePixels);
+				active++;
+			}
+
+			m_sampleOffsets[pixel] = offset;
+			offset += count;
+		}
+		m_sampleOffsets[pixelCount] = offset;
+	}
+
+	float Renderer::pixelError(uint32_t pixel) const
+	{
+		const glm::vec4& sum = m_accumulationData[pixel];
+		float count = sum.w;
+		if (count < (float)std::max(m_settings.adaptiveMinSamples, 2))
+			return std::numeric_limits<float>::max();
+
+		float mean = luminance(glm::vec3(sum)) / count;
+		float variance = std::max((m_luminanceSquares[pixel] - count * mean * mean) / (count - 1.0f), 0.0f);
+
+		// The error of the mean, scaled by the slope of a square root, which stands in for every display curve
+		return std::sqrt(variance / count) / (2.0f * std::max(std::sqrt(mean), 1.0f / 255.0f));
+	}
 
-				glm::vec4 accumulatedColor = m_accumulationData[x + y * m_finalImage->getWidth()];
-				accumulatedColor /= (float)m_frameIndex;
+	void Renderer::renderTile(const Tile& tile)
+	{
+		uint32_t endX = std::min(tile.x + m_tileSize, m_width);
+		uint32_t endY = std::min(tile.y + m_tileSize, m_height);
 
-				accumulatedColor = glm::clamp(accumulatedColor, glm::vec4(0.0f), glm::vec4(1.0f));
-				m_imageData[x + y * m_finalImage->getWidth()] = Utils::convertToRGBA(accumulatedColor);
+		for (uint32_t y = tile.y; y < endY; y++)
+		{
+			if (!m_settings.packetTracing)
+			{
+				for (uint32_t x = tile.x; x < endX; x++)
+					accumulate(x, y, perPixel(x, y, pixelSampleCount(x + y * m_width)));
+				continue;
 			}
-		}
 
-#endif
+			// The first sample of each pixel traces its camera ray in a packet, the rest are traced one at a time.
+			HitPayload primaryHits[RayPacket::SIZE];
+			for (uint32_t x = tile.x; x < endX; x += RayPacket::SIZE)
+			{
+				uint32_t count = std::min<uint32_t>(RayPacket::SIZE, endX - x);
 
-		m_finalImage->setData(m_imageData);
+				// Packets where every pixel has converged only refresh the display
+				bool sampled = false;
+				for (uint32_t i = 0; i < count && !sampled; i++)
+					sampled = pixelSampleCount(x + i + y * m_width) > 0;
+				if (sampled)
+					tracePrimaryPacket(x, y, count, primaryHits);
 
-		if (m_settings.accumulate)
-			m_frameIndex++;
-		else
-			m_frameIndex = 1;
+				for (uint32_t i = 0; i < count; i++)
+					accumulate(x + i, y, perPixel(x + i, y, pixelSampleCount(x + i + y * m_width), &primaryHits[i]));
+			}
+		}
 	}
 
-	void Renderer::screenshot()
+	template<typename Fn>
+	void Renderer::parallelChunks(uint32_t count, Fn&& fn)
 	{
-		stbi_write_jpg("./render.jpg", m_finalImage->getWidth(), m_finalImage->getHeight(), 4, m_imageData, 1000);
-		std::cout << "File <render.jpg> saved." << std::endl;
+		uint32_t chunks = (count + WAVEFRONT_CHUNK - 1) / WAVEFRONT_CHUNK;
+		m_threadPool.run(chunks, [count, &fn](uint32_t chunk)
+		{
+			fn(chunk * WAVEFRONT_CHUNK, std::min(count, (chunk + 1) * WAVEFRONT_CHUNK));
+		});
+	}
+
+	void Renderer::renderWavefront(FrameCounters& counters)
+	{
+		uint32_t pixelCount = m_width * m_height;
+		uint32_t samples = (uint32_t)std::max(m_settings.samplesPerPixel, 1);
+
+		// Whole pixels per wave, as many as fit (at least one)
+		uint32_t firstPixel = 0;
+		while (firstPixel < pixelCount)
+		{
+			uint32_t endPixel;
+			if (m_sampleOffsets.empty())
+			{
+				endPixel = firstPixel + std::max(WAVEFRONT_WAVE_SIZE / samples, 1u);
+			}
+			else
+			{
+				uint64_t limit = m_sampleOffsets[firstPixel] + WAVEFRONT_WAVE_SIZE;
+				auto last = std::upper_bound(m_sampleOffsets.begin() + firstPixel + 1, m_sampleOffsets.end(), limit);
+				endPixel = std::max((uint32_t)(last - m_sampleOffsets.begin()) - 1, firstPixel + 1);
+			}
+			endPixel = std::min(endPixel, pixelCount);
+
+			renderWave(firstPixel, endPixel, counters);
+			firstPixel = endPixel;
+		}
 	}
 
-	glm::vec4 Renderer::perPixel(uint32_t x, uint32_t y)
+	void Renderer::renderWave(uint32_t firstPixel, uint32_t endPixel, FrameCounters& counters)
 	{
-		uint32_t seed = x + y * m_finalImage->getWidth();
-		seed *= m_frameIndex;
+		uint32_t width = m_width;
+		uint64_t firstPath = pixelSampleOffset(firstPixel);
+		uint32_t pathCount = (uint32_t)(pixelSampleOffset(endPixel) - firstPath);
 
-		glm::vec3 light(0.0f);
-		glm::vec3 contribution(1.0f); // throughput
+		// Kept across waves and frames, only ever grown to the largest wave
+		if (m_paths.size() < pathCount)
+		{
+			m_paths.resize(pathCount);
+			m_pathHits.resize(pathCount);
+			m_rayQueue.resize(pathCount);
+			m_shadeQueue.resize(pathCount);
+			m_pathTypes.resize(pathCount);
+		}
 
-		for (size_t s = 0 ; s < m_settings.samplesPerPixel ; s++)
+		// Generate: one camera ray per sample, numbered like perPixel does.
+		parallelChunks(endPixel - firstPixel, [this, width, firstPixel, firstPath](uint32_t begin, uint32_t end)
 		{
-			Ray ray;
+			for (uint32_t pixel = firstPixel + begin; pixel < firstPixel + end; pixel++)
+			{
+				uint32_t offset = (uint32_t)(pixelSampleOffset(pixel) - firstPath);
+				uint32_t samples = pixelSampleCount(pixel);
+				uint32_t firstSample = (uint32_t)m_accumulationData[pixel].w;
 
-			ray.origin = m_activeCamera->getPosition();
-			ray.direction = m_activeCamera->getRayDirections()[x + y * m_finalImage->getWidth()];
+				for (uint32_t s = 0; s < samples; s++)
+				{
+					uint32_t index = offset + s;
 
-			for (int i = 0; i < m_settings.bounces; i++)
+					PathState& path = m_paths[index];
+					path.sampler.startPixelSample(m_settings.sampler, pixel % width, pixel / width, firstSample + s);
+					path.ray = cameraRay(pixel % width, pixel / width, path.sampler);
+					path.throughput = glm::vec3(1.0f);
+					path.light = glm::vec3(0.0f);
+					path.scatterPdf = 0.0f;
+					path.active = true;
+
+					m_rayQueue[index] = index;
+				}
+			}
+		});
+
+		constexpr uint32_t TYPE_COUNT = (uint32_t)MaterialType::Count;
+		constexpr uint8_t MISSED = 0xff;
+
+		uint32_t queueSize = pathCount;
+		for (int i = 0; i < m_settings.bounces && queueSize > 0; i++)
+		{
+			counters.bounceRays[i] += queueSize;
+
+			// Intersect
+			parallelChunks(queueSize, [this, i, &counters](uint32_t begin, uint32_t end)
 			{
-				seed += i;
+				BVH::TraversalStats& stats = BVH::threadTraversalStats();
+				stats = BVH::TraversalStats();
 
-				HitPayload payload = traceRay(ray);
-				if (payload.hitDistance >= 0)
+				for (uint32_t q = begin; q < end; q++)
 				{
-					const std::shared_ptr<Hittable> closestSphere = m_activeScene->objects[payload.objectIndex];
-					const Material& material = m_activeScene->materials[closestSphere->materialIndex];
+					uint32_t index = m_rayQueue[q];
+					m_paths[index].sampler.startBounce(i);
+					m_pathHits[index] = traceRay(m_paths[index].ray);
+				}
 
-					contribution *= material.albedo;
-					light += material.emission() * material.albedo;
+				counters.add(stats);
+			});
 
-					glm::vec3 unitDirection = glm::normalize(ray.direction);
+			// Sort: misses pick up the sky and end, hits are bucketed by material type. A counting sort over
+			// queue chunks, so it runs on the pool and keeps queue order within every type.
+			uint32_t chunkCount = (queueSize + WAVEFRONT_CHUNK - 1) / WAVEFRONT_CHUNK;
+			m_chunkOffsets.assign((size_t)chunkCount * TYPE_COUNT, 0);
 
-					if (material.refractiveIndex > 0)
-					{
-						auto e = payload.frontFace ? 1.0f / material.refractiveIndex : material.refractiveIndex;
-						double cosTheta = fmin(glm::dot(-unitDirection, payload.normal), 1.0);
-						double sinTheta = sqrt(1.0 - cosTheta * cosTheta);
-
-						bool cannotRefract = e * sinTheta > 1.0;
-
-						if (cannotRefract || reflectance(cosTheta, e) > Utils::randomFloat(seed))
-						{
-							ray.origin = payload.position + payload.normal * 0.0001f;
-							ray.direction = glm::reflect(
-								unitDirection,
-								payload.normal
-							);
-						}
-						else
-						{
-							ray.origin = payload.position - payload.normal * 0.0001f;
-							ray.direction = glm::refract(
-								unitDirection,
-								payload.normal,
-								e
-							);
-						}
-					}
-					else
+			parallelChunks(queueSize, [this](uint32_t begin, uint32_t end)
+			{
+				uint32_t* counts = m_chunkOffsets.data() + (size_t)(begin / WAVEFRONT_CHUNK) * TYPE_COUNT;
+				for (uint32_t q = begin; q < end; q++)
+				{
+					uint32_t index = m_rayQueue[q];
+					const HitPayload& payload = m_pathHits[index];
+					PathState& path = m_paths[index];
+
+					if (payload.hitDistance < 0)
 					{
-						ray.origin = payload.position + payload.normal * 0.0001f;
-						ray.direction = glm::reflect(
-							unitDirection,
-							payload.normal + material.roughness * Utils::InUnitSphere(seed)
-						) + material.fuzz * Utils::InUnitSphere(seed);
+						path.light += skyColor(path.ray) * path.throughput;
+						m_pathTypes[q] = MISSED;
+						continue;
 					}
 
-					auto z = 1e-8;
-					if ((fabs(ray.direction[0]) < z) && (fabs(ray.direction[1]) < z) && (fabs(ray.direction[2]) < z))
+					uint8_t type = (uint8_t)classify(m_activeScene->materials[payload.materialIndex]);
+					m_pathTypes[q] = type;
+					counts[type]++;
+				}
+			});
+
+			uint32_t typeStarts[TYPE_COUNT + 1];
+			uint32_t hitCount = 0;
+			for (uint32_t type = 0; type < TYPE_COUNT; type++)
+			{
+				typeStarts[type] = hitCount;
+				for (uint32_t chunk = 0; chunk < chunkCount; chunk++)
+				{
+					uint32_t count = m_chunkOffsets[(size_t)chunk * TYPE_COUNT + type];
+					m_chunkOffsets[(size_t)chunk * TYPE_COUNT + type] = hitCount;
+					hitCount += count;
+				}
+			}
+			typeStarts[TYPE_COUNT] = hitCount;
+
+			parallelChunks(queueSize, [this](uint32_t begin, uint32_t end)
+			{
+				uint32_t* offsets = m_chunkOffsets.data() + (size_t)(begin / WAVEFRONT_CHUNK) * TYPE_COUNT;
+				for (uint32_t q = begin; q < end; q++)
+				{
+					if (m_pathTypes[q] != MISSED)
+						m_shadeQueue[offsets[m_pathTypes[q]]++] = m_rayQueue[q];
+				}
+			});
+
+			// Shade one material type at a time
+			for (uint32_t type = 0; type < TYPE_COUNT; type++)
+			{
+				uint32_t typeStart = typeStarts[type];
+				parallelChunks(typeStarts[type + 1] - typeStart, [this, i, typeStart, &counters](uint32_t begin, uint32_t end)
+				{
+					// Shadow rays are traced while shading
+					BVH::TraversalStats& stats = BVH::threadTraversalStats();
+					stats = BVH::TraversalStats();
+
+					for (uint32_t q = typeStart + begin; q < typeStart + end; q++)
 					{
-						ray.direction = payload.normal;
+						uint32_t index = m_shadeQueue[q];
+						const HitPayload& payload = m_pathHits[index];
+						PathState& path = m_paths[index];
+
+						shade(path, payload, m_activeScene->materials[payload.materialIndex]);
+						path.active = survives(path, i);
 					}
-					
+
+					counters.add(stats);
+				});
+			}
+
+			// Compact the survivors into the next queue, again counted per chunk and then scattered
+			uint32_t hitChunkCount = (hitCount + WAVEFRONT_CHUNK - 1) / WAVEFRONT_CHUNK;
+			m_chunkOffsets.assign(hitChunkCount, 0);
+
+			parallelChunks(hitCount, [this](uint32_t begin, uint32_t end)
+			{
+				uint32_t& count = m_chunkOffsets[begin / WAVEFRONT_CHUNK];
+				for (uint32_t q = begin; q < end; q++)
+					count += m_paths[m_shadeQueue[q]].active ? 1 : 0;
+			});
+
+			queueSize = 0;
+			for (uint32_t chunk = 0; chunk < hitChunkCount; chunk++)
+			{
+				uint32_t count = m_chunkOffsets[chunk];
+				m_chunkOffsets[chunk] = queueSize;
+				queueSize += count;
+			}
+
+			parallelChunks(hitCount, [this](uint32_t begin, uint32_t end)
+			{
+				uint32_t offset = m_chunkOffsets[begin / WAVEFRONT_CHUNK];
+				for (uint32_t q = begin; q < end; q++)
+				{
+					uint32_t index = m_shadeQueue[q];
+					if (m_paths[index].active)
+						m_rayQueue[offset++] = index;
+				}
+			});
+		}
+
+		// Resolve: gather the samples of each pixel the same way perPixel does.
+		parallelChunks(endPixel - firstPixel, [this, width, firstPixel, firstPath](uint32_t begin, uint32_t end)
+		{
+			for (uint32_t pixel = firstPixel + begin; pixel < firstPixel + end; pixel++)
+			{
+				uint32_t offset = (uint32_t)(pixelSampleOffset(pixel) - firstPath);
+
+				PixelSamples samples;
+				for (uint32_t s = 0; s < pixelSampleCount(pixel); s++)
+					samples.add(m_paths[offset + s].light);
+
+				accumulate(pixel % width, pixel / width, samples);
+			}
+		});
+	}
+
+	void Renderer::PixelSamples::add(const glm::vec3& sample)
+	{
+		float sampleLuminance = luminance(sample);
+
+		light += sample;
+		luminanceSquares += sampleLuminance * sampleLuminance;
+		count++;
+	}
+
+	void Renderer::accumulate(uint32_t x, uint32_t y, const PixelSamples& samples)
+	{
+		uint32_t pixel = x + y * m_width;
+
+		m_accumulationData[pixel] += glm::vec4(samples.light, (float)samples.count);
+		m_luminanceSquares[pixel] += samples.luminanceSquares;
+	}
+
+	void Renderer::resolve()
+	{
+		Clef::Timer timer;
+
+		uint32_t* image = m_outputData ? m_outputData : m_imageData;
+		if (m_settings.sampleHeatmap)
+		{
+			// Samples against what uniform sampling would have taken, on a log scale over the boost range
+			float uniformCount = (float)m_frameIndex * std::max(m_settings.samplesPerPixel, 1);
+			parallelChunks(m_width * m_height, [this, image, uniformCount](uint32_t begin, uint32_t end)
+			{
+				for (uint32_t pixel = begin; pixel < end; pixel++)
+				{
+					float t = 0.5f + 0.5f * std::log2(std::max(m_accumulationData[pixel].w, 1.0f) / uniformCount) / std::log2((float)MAX_ADAPTIVE_BOOST);
+					image[pixel] = Utils::convertToRGBA(glm::vec4(heatmapColor(glm::clamp(t, 0.0f, 1.0f)), 1.0f));
+				}
+			});
+		}
+		else
+		{
+			Tonemap tonemap = m_settings.tonemap;
+			parallelChunks(m_width * m_height, [this, image, tonemap](uint32_t begin, uint32_t end)
+			{
+				ResolveKernels::resolve(m_accumulationData + begin, image + begin, end - begin, tonemap);
+			});
+		}
+
+		m_resolveTime = timer.elapsedMillis();
+	}
+
+	float Renderer::getAveragePathLength() const
+	{
+		if (m_pathCount == 0)
+			return 0.0f;
+
+		// Packets trace a pixel's camera ray once for all its samples, but every path still starts with one.
+		uint64_t rays = m_pathCount;
+		for (size_t i = 1; i < m_bounceRayCounts.size(); i++)
+			rays += m_bounceRayCounts[i];
+		return (float)rays / m_pathCount;
+	}
+
+	void Renderer::screenshot()
+	{
+		if (saveImage("./render.jpg"))
+			std::cout << "File <render.jpg> saved." << std::endl;
+	}
+
+	bool Renderer::saveImage(const std::string& filePath) const
+	{
+		const uint32_t* imageData = getImageData();
+		if (!imageData)
+			return false;
+
+		// Row 0 is the bottom of the image.
+		stbi_flip_vertically_on_write(1);
+
+		std::string extension = filePath.substr(filePath.find_last_of('.') + 1);
+		int result;
+		if (extension == "png")
+			result = stbi_write_png(filePath.c_str(), m_width, m_height, 4, imageData, m_width * 4);
+		else if (extension == "bmp")
+			result = stbi_write_bmp(filePath.c_str(), m_width, m_height, 4, imageData);
+		else
+			result = stbi_write_jpg(filePath.c_str(), m_width, m_height, 4, imageData, 100);
+
+		if (!result)
+			std::cout << "> Failed to write " << filePath << "!" << std::endl;
+
+		return result != 0;
+	}
+
+	Renderer::PixelSamples Renderer::perPixel(uint32_t x, uint32_t y, uint32_t count, const HitPayload* primaryHit)
+	{
+		// Every pixel's sequence carries on from the samples it has accumulated
+		uint32_t firstSample = (uint32_t)m_accumulationData[x + y * m_width].w;
+
+		PixelSamples samples;
+		for (uint32_t s = 0; s < count; s++)
+		{
+			PathState path;
+			path.sampler.startPixelSample(m_settings.sampler, x, y, firstSample + s);
+			path.ray = cameraRay(x, y, path.sampler);
+			path.throughput = glm::vec3(1.0f);
+			path.light = glm::vec3(0.0f);
+			path.scatterPdf = 0.0f;
+
+			for (int i = 0; i < m_settings.bounces; i++)
+			{
+				path.sampler.startBounce(i);
+
+				HitPayload payload;
+				if (i == 0 && s == 0 && primaryHit)
+				{
+					payload = *primaryHit;
 				}
 				else
 				{
-					float a = 0.5 * (glm::normalize(ray.direction).y + 1.0);
-					// glm::vec3 skyColor = (1.0f - a) * glm::vec3(1.0) + a * glm::vec3(0.5, 0.7, 1.0);
-					glm::vec3 skyColor = CLEAR_COLOR;
-					light += skyColor * contribution;
+					payload = traceRay(path.ray);
+					t_bounceRays[i]++;
+				}
+				if (payload.hitDistance >= 0)
+				{
+					shade(path, payload, m_activeScene->materials[payload.materialIndex]);
+					if (!survives(path, i))
+						break;
+				}
+				else
+				{
+					path.light += skyColor(path.ray) * path.throughput;
 					break;
 				}
 			}
+
+			samples.add(path.light);
 		}
 
-		float scale = 1.0f / m_settings.samplesPerPixel;
-		light.r = std::sqrt(scale * light.r);
-		light.g = std::sqrt(scale * light.g);
-		light.b = std::sqrt(scale * light.b);
+		return samples;
+	}
+
+	Ray Renderer::cameraRay(uint32_t x, uint32_t y, Sampler& sampler) const
+	{
+		glm::vec2 u = sampler.get2D();
+
+		// Filters are separable, each axis is sampled on its own
+		glm::vec2 offset;
+		for (int i = 0; i < 2; i++)
+		{
+			if (m_settings.filter == PixelFilter::Tent)
+				offset[i] = u[i] < 0.5f ? std::sqrt(2.0f * u[i]) - 1.0f : 1.0f - std::sqrt(2.0f - 2.0f * u[i]);
+			else if (m_settings.filter == PixelFilter::BlackmanHarris)
+				offset[i] = sampleBlackmanHarris(u[i]);
+			else
+				offset[i] = u[i] - 0.5f;
+		}
 
-		return glm::vec4(light, 1.0f);
+		return m_activeCamera->generateRay(glm::vec2((float)x, (float)y) + 0.5f + offset, sampler.get2D());
 	}
 
-	HitPayload Renderer::traceRay(const Ray& ray)
+	void Renderer::shade(PathState& path, const HitPayload& payload, const Material& material) const
+	{
+		if (material.isEmissive())
+		{
+			// A light the previous bounce could also have sampled directly, the two estimates are split by MIS.
+			float weight = 1.0f;
+			// Instances are not in the light sampler, nothing but scattering finds them
+			if (m_settings.lightSampling && path.scatterPdf > 0.0f && payload.primitiveIndex != UINT32_MAX)
+			{
+				const Scene& scene = *m_activeScene;
+				float lightPdf = scene.lights.pdf(path.scatterPosition, path.scatterNormal, payload.primitiveIndex)
+					* scene.primitives.directionPdf(payload.primitiveIndex, path.scatterPosition, payload.position);
+				weight = powerHeuristic(path.scatterPdf, lightPdf);
+			}
+
+			path.light += material.radiance() * path.throughput * weight;
+		}
+
+		if (m_settings.lightSampling && material.isDiffuse())
+			path.light += sampleDirectLight(payload, material, path.sampler) * path.throughput;
+
+		path.throughput *= material.albedo;
+		path.scatterPdf = scatter(path.ray, payload, material, path.sampler);
+		path.scatterPosition = payload.position;
+		path.scatterNormal = payload.normal;
+	}
+
+	bool Renderer::survives(PathState& path, int bounce) const
+	{
+		float maxThroughput = std::max(path.throughput.r, std::max(path.throughput.g, path.throughput.b));
+		if (maxThroughput <= 0.0f)
+			return false;
+
+		if (!m_settings.russianRoulette || bounce + 1 < m_settings.rouletteDepth)
+			return true;
+
+		// Continue with probability of the throughput, dividing by it keeps the expected value unchanged
+		float probability = std::min(maxThroughput, 1.0f);
+		if (path.sampler.get1D() >= probability)
+			return false;
+
+		path.throughput /= probability;
+		return true;
+	}
+
+	glm::vec3 Renderer::sampleDirectLight(const HitPayload& payload, const Material& material, Sampler& sampler) const
 	{
-		int closestObject = -1;
-		float hitDistance = std::numeric_limits<float>::max();
+		const Scene& scene = *m_activeScene;
+		if (scene.lights.isEmpty())
+			return glm::vec3(0.0f);
+
+		uint32_t light;
+		float selectionPdf;
+		bool sampled = scene.lights.sample(payload.position, payload.normal, sampler.get1D(), light, selectionPdf);
+		glm::vec2 u = sampler.get2D();
+
+		Ray shadowRay;
+		shadowRay.origin = payload.position + payload.normal * 0.0001f;
+
+		// From the surface point itself, as the scattering side evaluates the pdf, only the shadow ray is offset
+		float distance, directionPdf;
+		if (!sampled || light == payload.primitiveIndex || !scene.primitives.sampleDirection(light, payload.position, u, shadowRay.direction, distance, directionPdf))
+			return glm::vec3(0.0f);
+
+		float cosine = glm::dot(payload.normal, shadowRay.direction);
+		if (cosine <= 0.0f)
+			return glm::vec3(0.0f);
+
+		// Blocked when anything is hit before the light itself
+		RayHit hit = { distance * 0.999f, 0, glm::vec2(0.0f) };
+		if (scene.intersect(shadowRay, hit))
+			return glm::vec3(0.0f);
+
+		const Material& lightMaterial = scene.materials[scene.primitives.getMaterialIndex(light)];
+		float lightPdf = selectionPdf * directionPdf;
+
+		// Lambertian, albedo / pi, sampled by scatter with pdf cosine / pi
+		float brdf = glm::one_over_pi<float>();
+		float weight = powerHeuristic(lightPdf, cosine * glm::one_over_pi<float>());
+
+		return lightMaterial.radiance() * material.albedo * (brdf * cosine * weight / lightPdf);
+	}
 
-		for (size_t i = 0; i < m_activeScene->objects.size(); i++)
+	float Renderer::scatter(Ray& ray, const HitPayload& payload, const Material& material, Sampler& sampler) const
+	{
+		glm::vec3 unitDirection = glm::normalize(ray.direction);
+
+		if (material.refractiveIndex > 0)
 		{
-			const auto& object = m_activeScene->objects[i];
-			
-			float closestT = object->intersect(ray);
-			if (closestT > 0.0f && closestT < hitDistance)
+			auto e = payload.frontFace ? 1.0f / material.refractiveIndex : material.refractiveIndex;
+			double cosTheta = fmin(glm::dot(-unitDirection, payload.normal), 1.0);
+			double sinTheta = sqrt(1.0 - cosTheta * cosTheta);
+
+			bool cannotRefract = e * sinTheta > 1.0;
+
+			if (cannotRefract || reflectance(cosTheta, e) > sampler.get1D())
 			{
-				hitDistance = closestT;
-				closestObject = (int)i;
+				ray.origin = payload.position + payload.normal * 0.0001f;
+				ray.direction = glm::reflect(
+					unitDirection,
+					payload.normal
+				);
 			}
+			else
+			{
+				ray.origin = payload.position - payload.normal * 0.0001f;
+				ray.direction = glm::refract(
+					unitDirection,
+					payload.normal,
+					e
+				);
+			}
+		}
+		else if (material.isDiffuse())
+		{
+			// Cosine weighted around the normal
+			ray.origin = payload.position + payload.normal * 0.0001f;
+			ray.direction = payload.normal + Utils::uniformSphere(sampler.get2D());
+		}
+		else
+		{
+			ray.origin = payload.position + payload.normal * 0.0001f;
+			ray.direction = glm::reflect(
+				unitDirection,
+				payload.normal + material.roughness * Utils::uniformSphere(sampler.get2D())
+			) + material.fuzz * Utils::uniformSphere(sampler.get2D());
+		}
+
+		auto z = 1e-8;
+		if ((fabs(ray.direction[0]) < z) && (fabs(ray.direction[1]) < z) && (fabs(ray.direction[2]) < z))
+		{
+			ray.direction = payload.normal;
 		}
 
-		if (closestObject < 0)
+		if (!material.isDiffuse())
+			return 0.0f;
+
+		return glm::max(glm::dot(payload.normal, glm::normalize(ray.direction)), 0.0f) * glm::one_over_pi<float>();
+	}
+
+	Renderer::MaterialType Renderer::classify(const Material& material)
+	{
+		// scatter takes the refraction branch for any dielectric, emissive or not.
+		if (material.refractiveIndex > 0)
+			return MaterialType::Dielectric;
+		if (material.emissionPower > 0)
+			return MaterialType::Emissive;
+		if (material.roughness == 0.0f)
+			return MaterialType::Metal;
+		return MaterialType::Diffuse;
+	}
+
+	glm::vec3 Renderer::skyColor(const Ray& ray) const
+	{
+		float a = 0.5 * (glm::normalize(ray.direction).y + 1.0);
+		// return (1.0f - a) * glm::vec3(1.0) + a * glm::vec3(0.5, 0.7, 1.0);
+		return CLEAR_COLOR;
+	}
+
+	HitPayload Renderer::traceRay(const Ray& ray)
+	{
+		RayHit hit = { std::numeric_limits<float>::max(), 0, glm::vec2(0.0f) };
+
+		if (!m_activeScene->intersect(ray, hit))
 			return miss(ray);
 
-		return closestHit(ray, hitDistance, closestObject);
+		return closestHit(ray, hit);
+	}
+
+	void Renderer::tracePrimaryPacket(uint32_t x, uint32_t y, uint32_t count, HitPayload* payloads)
+	{
+		// The first sample of each pixel, its camera ray drawn exactly as perPixel draws it.
+		// Unused lanes repeat the last ray so the packet never holds garbage.
+		RayPacket packet;
+		packet.count = count;
+		for (uint32_t i = 0; i < (uint32_t)RayPacket::SIZE; i++)
+		{
+			uint32_t px = x + std::min(i, count - 1);
+
+			Sampler sampler;
+			sampler.startPixelSample(m_settings.sampler, px, y, (uint32_t)m_accumulationData[px + y * m_width].w);
+			packet.set(i, cameraRay(px, y, sampler));
+		}
+
+		t_bounceRays[0] += count;
+
+		PacketHit hit;
+		hit.reset(count);
+		m_activeScene->intersect(packet, hit);
+
+		for (uint32_t i = 0; i < count; i++)
+			payloads[i] = hit.isHit(i) ? closestHit(packet.get(i), hit.get(i)) : miss(packet.get(i));
 	}
 
-	HitPayload Renderer::closestHit(const Ray& ray, float hitDistance, int objectIndex)
+	HitPayload Renderer::closestHit(const Ray& ray, const RayHit& hit)
 	{
 		HitPayload payload;
-		payload.hitDistance = hitDistance;
-		payload.objectIndex = objectIndex;
-		payload.position = ray.origin + ray.direction * hitDistance;
+		payload.hitDistance = hit.distance;
+		payload.position = ray.origin + ray.direction * hit.distance;
 
-		const auto& closestObject = m_activeScene->objects[objectIndex];
-		closestObject->setHitPayload(ray, payload);
+		m_activeScene->setHitPayload(hit, ray, payload);
 
 		return payload;
 	}
@@ -1,26 +1,70 @@
 #pragma once
 
-#include "Clef/Image.h"
-
 #include "HitPayload.h"
 #include "Camera.h"
 #include "Ray.h"
+#include "RayPacket.h"
+#include "Resolve.h"
+#include "Sampler.h"
 #include "Scene.h"
+#include "ThreadPool.h"
 
 #include <glm/vec4.hpp>
+#include <algorithm>
 #include <memory>
-#include <execution>
+#include <string>
+#include <atomic>
+#include <mutex>
+#include <vector>
 
 namespace Vibrato
 {
 	class Renderer
 	{
 	public:
+		enum class Integrator
+		{
+			MegaKernel = 0, // whole path per pixel, bounce by bounce
+			Wavefront       // every path one bounce at a time, shading batched by material type
+		};
+
+		// Pixel reconstruction filter, camera rays are spread over its footprint so every sample weighs the same.
+		enum class PixelFilter
+		{
+			Box = 0,       // uniform over the pixel
+			Tent,          // triangle two pixels wide
+			BlackmanHarris // four term Blackman-Harris window three pixels wide, sharp with little ringing
+		};
+
+		enum class TileOrder
+		{
+			Scanline = 0,
+			Morton,
+			Hilbert
+		};
+
 		struct Settings
 		{
+			Integrator integrator = Integrator::MegaKernel;
 			bool accumulate = true;
 			int samplesPerPixel = 1;
 			int bounces = 10;
+			bool packetTracing = true; // trace each pixel's first camera ray in RayPacket::SIZE packets
+			Sampler::Type sampler = Sampler::Type::Sobol;
+			PixelFilter filter = PixelFilter::Box;
+			Tonemap tonemap = Tonemap::Gamma;
+			bool lightSampling = true; // next-event estimation on diffuse surfaces, combined with BSDF sampling by MIS
+			bool russianRoulette = true; // end dim paths early, survivors are reweighted so the result stays unbiased
+			int rouletteDepth = 3; // bounces every path gets before roulette starts
+
+			bool adaptiveSampling = false; // stop sampling converged pixels and spend their samples on noisy ones
+			float noiseThreshold = 0.01f; // standard error of a displayed pixel value below which it counts as converged
+			int adaptiveMinSamples = 16; // samples every pixel gets before its error estimate is trusted
+			bool sampleHeatmap = false; // show samples per pixel instead of the image, blue below the uniform count, red above
+
+			int threadCount = 0; // 0 uses every hardware thread
+			int tileSize = 16;
+			TileOrder tileOrder = TileOrder::Hilbert;
 		};
 
 	public:
@@ -29,30 +73,183 @@ namespace Vibrato
 		void onResize(uint32_t width, uint32_t height);
 		void render(const Scene& scene, const Camera& camera);
 
-		std::shared_ptr<Clef::Image> getFinalImage() const { return m_finalImage; }
+		// RGBA8, bottom row first. Valid until the next onResize.
+		inline const uint32_t* getImageData() const { return m_outputData ? m_outputData : m_imageData; }
+		// Resolves the next frames into this width * height buffer instead of the renderer's own, e.g. mapped
+		// upload memory so the image goes to the GPU without another copy. Cleared by onResize, nullptr resets it.
+		void setOutputBuffer(uint32_t* output) { m_outputData = output; }
+		inline uint32_t getWidth() const { return m_width; }
+		inline uint32_t getHeight() const { return m_height; }
+
 		void screenshot();
+		// Format follows the extension: png, bmp, anything else is written as jpg.
+		bool saveImage(const std::string& filePath) const;
 
 		void resetFrameIndex() { m_frameIndex = 1; }
 
 		Settings& getSettings() { return m_settings; }
 
+		// BVH traversal counters summed over the last rendered frame.
+		const BVH::TraversalStats& getTraversalStats() const { return m_traversalStats; }
+		// Rays traced at each bounce during the last frame, [0] are camera rays.
+		const std::vector<uint64_t>& getBounceRayCounts() const { return m_bounceRayCounts; }
+		// Rays per path (one path per sample) over the last frame, shadow rays not included.
+		float getAveragePathLength() const;
+		// Time spent turning the accumulation buffer into the image during the last frame.
+		float getResolveTime() const { return m_resolveTime; }
+		// Pixels that still take samples, every pixel unless adaptive sampling has converged some.
+		uint32_t getActivePixelCount() const { return m_activePixelCount; }
+		// Samples taken over the last frame, across all pixels.
+		uint64_t getSampleCount() const { return m_pathCount; }
+
+	private:
+		// Traversal counters gathered from the render threads during a frame.
+		struct FrameCounters
+		{
+			std::atomic<uint64_t> rays = 0, nodesVisited = 0, primitiveTests = 0;
+
+			std::mutex bounceMutex;
+			std::vector<uint64_t> bounceRays;
+
+			inline void add(const BVH::TraversalStats& stats)
+			{
+				rays += stats.rays;
+				nodesVisited += stats.nodesVisited;
+				primitiveTests += stats.primitiveTests;
+			}
+
+			inline void addBounceRays(const std::vector<uint64_t>& threadBounceRays)
+			{
+				std::lock_guard<std::mutex> lock(bounceMutex);
+				for (size_t i = 0; i < threadBounceRays.size() && i < bounceRays.size(); i++)
+					bounceRays[i] += threadBounceRays[i];
+			}
+		};
+
+		// Wavefront queues are sorted by these, in this order.
+		enum class MaterialType
+		{
+			Diffuse = 0,
+			Metal,
+			Dielectric,
+			Emissive,
+			Count
+		};
+
+		struct Tile
+		{
+			uint32_t x, y; // top left pixel
+		};
+
+		// One frame's samples of a pixel.
+		struct PixelSamples
+		{
+			glm::vec3 light{ 0.0f }; // summed radiance
+			float luminanceSquares = 0.0f; // summed squared luminance, for the variance estimate
+			uint32_t count = 0;
+
+			void add(const glm::vec3& sample);
+		};
+
+		struct PathState
+		{
+			Ray ray;
+			glm::vec3 throughput;
+			glm::vec3 light;
+			Sampler sampler;
+			float scatterPdf; // solid angle pdf of the bounce that made ray, 0 for camera rays and specular bounces
+			glm::vec3 scatterPosition; // surface point where that bounce happened, before the ray origin was offset from it
+			glm::vec3 scatterNormal; // surface normal where that bounce happened, only valid while scatterPdf > 0
+			bool active;
+		};
 
 	private:
+		void updateTiles();
+		void renderTile(const Tile& tile);
+		void renderWavefront(FrameCounters& counters);
+		// Traces the samples of pixels [firstPixel, endPixel) through every bounce.
+		void renderWave(uint32_t firstPixel, uint32_t endPixel, FrameCounters& counters);
 
-		glm::vec4 perPixel(uint32_t x, uint32_t y); // RayGen Shader
+		// Runs fn(begin, end) over [0, count) in chunks on the thread pool.
+		template<typename Fn>
+		void parallelChunks(uint32_t count, Fn&& fn);
+		// Decides how many samples each pixel takes this frame.
+		void planSamples();
+		inline uint32_t pixelSampleCount(uint32_t pixel) const
+		{
+			return m_sampleOffsets.empty() ? (uint32_t)std::max(m_settings.samplesPerPixel, 1) : (uint32_t)(m_sampleOffsets[pixel + 1] - m_sampleOffsets[pixel]);
+		}
+		inline uint64_t pixelSampleOffset(uint32_t pixel) const
+		{
+			return m_sampleOffsets.empty() ? (uint64_t)pixel * (uint32_t)std::max(m_settings.samplesPerPixel, 1) : m_sampleOffsets[pixel];
+		}
+		// Standard error of the displayed value, from the pixel's accumulated samples.
+		float pixelError(uint32_t pixel) const;
+
+		void accumulate(uint32_t x, uint32_t y, const PixelSamples& samples);
+		// Writes the image from the accumulation buffer, after every pixel of the frame is traced.
+		void resolve();
+
+		// primaryHit, when given, replaces tracing the camera ray.
+		PixelSamples perPixel(uint32_t x, uint32_t y, uint32_t count, const HitPayload* primaryHit = nullptr); // RayGen Shader
+
+		// Camera ray through a filter sample around the pixel and a point on the lens, uses the sampler's camera dimensions.
+		Ray cameraRay(uint32_t x, uint32_t y, Sampler& sampler) const;
+
+		// Adds the light picked up at a hit and bounces the path, shared by both integrators.
+		void shade(PathState& path, const HitPayload& payload, const Material& material) const;
+		// Ends paths that can no longer add light and plays Russian roulette with the rest,
+		// bounce is the one just shaded. Returns false when the path is done.
+		bool survives(PathState& path, int bounce) const;
+		// Light arriving from one sampled emitter, zero when its shadow ray is blocked.
+		glm::vec3 sampleDirectLight(const HitPayload& payload, const Material& material, Sampler& sampler) const;
+		// Bounces the ray off the surface, returns the solid angle pdf of the new direction or 0 for specular bounces.
+		float scatter(Ray& ray, const HitPayload& payload, const Material& material, Sampler& sampler) const;
+		glm::vec3 skyColor(const Ray& ray) const;
+
+		static MaterialType classify(const Material& material);
 
 		HitPayload traceRay(const Ray& ray);
-		HitPayload closestHit(const Ray& ray, float hitDistance, int objectIndex); // ClosestHit Shader
+		void tracePrimaryPacket(uint32_t x, uint32_t y, uint32_t count, HitPayload* payloads);
+		HitPayload closestHit(const Ray& ray, const RayHit& hit); // ClosestHit Shader
 		HitPayload miss(const Ray& ray); // Miss Shader
 
 	private:
-		std::shared_ptr<Clef::Image> m_finalImage;
+		uint32_t m_width = 0, m_height = 0;
 		uint32_t* m_imageData = nullptr;
+		uint32_t* m_outputData = nullptr;
+
+		ThreadPool m_threadPool;
 
-		std::vector<uint32_t> m_imgHorizontalIter, m_imgVerticalIter;
+		// Tiles in scheduling order, rebuilt when the size or order setting changes.
+		std::vector<Tile> m_tiles;
+		uint32_t m_tileSize = 0;
+		TileOrder m_tileOrder = TileOrder::Scanline;
 
 		Settings m_settings;
+		// Summed linear radiance of every sample so far, sample count in w.
 		glm::vec4* m_accumulationData = nullptr;
+		// Summed squared luminance of the same samples.
+		float* m_luminanceSquares = nullptr;
+
+		// Adaptive sampling, pixel p takes samples [m_sampleOffsets[p], m_sampleOffsets[p + 1]) of the frame.
+		// Empty when every pixel takes samplesPerPixel.
+		std::vector<uint64_t> m_sampleOffsets;
+		std::vector<float> m_pixelErrors;
+		uint32_t m_activePixelCount = 0;
+
+		BVH::TraversalStats m_traversalStats;
+		std::vector<uint64_t> m_bounceRayCounts;
+		uint64_t m_pathCount = 0;
+		float m_resolveTime = 0.0f;
+
+		// Wavefront state for one wave, paths are indexed pixelSampleOffset(pixel) + sample from the wave's first pixel.
+		std::vector<PathState> m_paths;
+		std::vector<HitPayload> m_pathHits;
+		std::vector<uint32_t> m_rayQueue;
+		std::vector<uint32_t> m_shadeQueue;   // hits of the current bounce, sorted by material type
+		std::vector<uint8_t> m_pathTypes;     // material type per ray queue entry
+		std::vector<uint32_t> m_chunkOffsets; // per chunk counts, then write offsets, of the parallel sort and compaction
 
 		const Scene* m_activeScene = nullptr;
 		const Camera* m_activeCamera = nullptr;
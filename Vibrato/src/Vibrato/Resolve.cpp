@@ -0,0 +1,220 @@
+#include "Resolve.h"
+
+#include "SIMD.h"
+
+#include <cmath>
+
+namespace Vibrato
+{
+	namespace ResolveKernels
+	{
+		// The sRGB curve from three square roots (Chilliant), with the exact linear toe.
+		constexpr float SRGB_TOE = 0.0031308f;
+		constexpr float SRGB_TOE_SLOPE = 12.92f;
+		constexpr float SRGB_C1 = 0.585122381f;
+		constexpr float SRGB_C2 = 0.783140355f;
+		constexpr float SRGB_C3 = -0.368262736f;
+
+		// ACES filmic fit, (x (a x + b)) / (x (c x + d) + e)
+		constexpr float ACES_A = 2.51f;
+		constexpr float ACES_B = 0.03f;
+		constexpr float ACES_C = 2.43f;
+		constexpr float ACES_D = 0.59f;
+		constexpr float ACES_E = 0.14f;
+
+		// Written like max_ps and min_ps, which return the second operand when either is NaN,
+		// so NaN and infinite colors resolve to the same bytes on every path.
+		static inline float maxScalar(float a, float b) { return a > b ? a : b; }
+		static inline float minScalar(float a, float b) { return a < b ? a : b; }
+
+		static float tonemapScalar(float x, Tonemap tonemap)
+		{
+			x = maxScalar(x, 0.0f);
+			if (tonemap == Tonemap::Gamma)
+				return minScalar(std::sqrt(x), 1.0f);
+
+			if (tonemap == Tonemap::ACES)
+				x = (x * (ACES_A * x + ACES_B)) / (x * (ACES_C * x + ACES_D) + ACES_E);
+			x = minScalar(x, 1.0f);
+
+			if (x <= SRGB_TOE)
+				return SRGB_TOE_SLOPE * x;
+
+			float s1 = std::sqrt(x);
+			float s2 = std::sqrt(s1);
+			float s3 = std::sqrt(s2);
+			return SRGB_C1 * s1 + SRGB_C2 * s2 + SRGB_C3 * s3;
+		}
+
+		// Clamped before the cast, converting a value outside the uint32 range (NaN included) is undefined
+		static inline uint32_t toChannel(float x)
+		{
+			return (uint32_t)(minScalar(maxScalar(x, 0.0f), 1.0f) * 255.0f);
+		}
+
+		void resolveScalar(const glm::vec4* accumulation, uint32_t* image, uint32_t count, Tonemap tonemap)
+		{
+			for (uint32_t i = 0; i < count; i++)
+			{
+				const glm::vec4& sum = accumulation[i];
+				float samples = maxScalar(sum.w, 1.0f);
+
+				uint32_t r = toChannel(tonemapScalar(sum.r / samples, tonemap));
+				uint32_t g = toChannel(tonemapScalar(sum.g / samples, tonemap));
+				uint32_t b = toChannel(tonemapScalar(sum.b / samples, tonemap));
+				image[i] = (255u << 24) | (b << 16) | (g << 8) | r;
+			}
+		}
+
+#if VIBRATO_SIMD_X86
+
+		static inline __m128 tonemapSSE(__m128 x, Tonemap tonemap)
+		{
+			const __m128 one = _mm_set1_ps(1.0f);
+
+			x = _mm_max_ps(x, _mm_setzero_ps());
+			if (tonemap == Tonemap::Gamma)
+				return _mm_min_ps(_mm_sqrt_ps(x), one);
+
+			if (tonemap == Tonemap::ACES)
+			{
+				__m128 numerator = _mm_mul_ps(x, _mm_add_ps(_mm_mul_ps(_mm_set1_ps(ACES_A), x), _mm_set1_ps(ACES_B)));
+				__m128 denominator = _mm_add_ps(_mm_mul_ps(x, _mm_add_ps(_mm_mul_ps(_mm_set1_ps(ACES_C), x), _mm_set1_ps(ACES_D))), _mm_set1_ps(ACES_E));
+				x = _mm_div_ps(numerator, denominator);
+			}
+			x = _mm_min_ps(x, one);
+
+			__m128 s1 = _mm_sqrt_ps(x);
+			__m128 s2 = _mm_sqrt_ps(s1);
+			__m128 s3 = _mm_sqrt_ps(s2);
+			__m128 curve = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(SRGB_C1), s1), _mm_mul_ps(_mm_set1_ps(SRGB_C2), s2)), _mm_mul_ps(_mm_set1_ps(SRGB_C3), s3));
+			__m128 toe = _mm_mul_ps(_mm_set1_ps(SRGB_TOE_SLOPE), x);
+
+			// No blendv before SSE4.1
+			__m128 isToe = _mm_cmple_ps(x, _mm_set1_ps(SRGB_TOE));
+			return _mm_or_ps(_mm_and_ps(isToe, toe), _mm_andnot_ps(isToe, curve));
+		}
+
+		void resolveSSE(const glm::vec4* accumulation, uint32_t* image, uint32_t count, Tonemap tonemap)
+		{
+			const __m128 one = _mm_set1_ps(1.0f);
+			const __m128 scale = _mm_set1_ps(255.0f);
+			const __m128 rgbMask = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+			const __m128 alpha = _mm_set_ps(1.0f, 0.0f, 0.0f, 0.0f);
+
+			uint32_t i = 0;
+			for (; i + 4 <= count; i += 4)
+			{
+				__m128i channels[4];
+				for (int p = 0; p < 4; p++)
+				{
+					__m128 sum = _mm_loadu_ps(&accumulation[i + p].x);
+					__m128 samples = _mm_max_ps(_mm_shuffle_ps(sum, sum, _MM_SHUFFLE(3, 3, 3, 3)), one);
+
+					__m128 color = tonemapSSE(_mm_div_ps(sum, samples), tonemap);
+					color = _mm_or_ps(_mm_and_ps(rgbMask, color), alpha);
+					channels[p] = _mm_cvttps_epi32(_mm_mul_ps(color, scale));
+				}
+
+				// 32 to 16 to 8 bits, four RGBA8 pixels in memory order
+				__m128i low = _mm_packs_epi32(channels[0], channels[1]);
+				__m128i high = _mm_packs_epi32(channels[2], channels[3]);
+				_mm_storeu_si128((__m128i*)&image[i], _mm_packus_epi16(low, high));
+			}
+
+			resolveScalar(accumulation + i, image + i, count - i, tonemap);
+		}
+
+		VIBRATO_TARGET_AVX2
+		static inline __m256 tonemapAVX2(__m256 x, Tonemap tonemap)
+		{
+			const __m256 one = _mm256_set1_ps(1.0f);
+
+			x = _mm256_max_ps(x, _mm256_setzero_ps());
+			if (tonemap == Tonemap::Gamma)
+				return _mm256_min_ps(_mm256_sqrt_ps(x), one);
+
+			if (tonemap == Tonemap::ACES)
+			{
+				__m256 numerator = _mm256_mul_ps(x, _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(ACES_A), x), _mm256_set1_ps(ACES_B)));
+				__m256 denominator = _mm256_add_ps(_mm256_mul_ps(x, _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(ACES_C), x), _mm256_set1_ps(ACES_D))), _mm256_set1_ps(ACES_E));
+				x = _mm256_div_ps(numerator, denominator);
+			}
+			x = _mm256_min_ps(x, one);
+
+			__m256 s1 = _mm256_sqrt_ps(x);
+			__m256 s2 = _mm256_sqrt_ps(s1);
+			__m256 s3 = _mm256_sqrt_ps(s2);
+			__m256 curve = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(SRGB_C1), s1), _mm256_mul_ps(_mm256_set1_ps(SRGB_C2), s2)), _mm256_mul_ps(_mm256_set1_ps(SRGB_C3), s3));
+			__m256 toe = _mm256_mul_ps(_mm256_set1_ps(SRGB_TOE_SLOPE), x);
+
+			return _mm256_blendv_ps(curve, toe, _mm256_cmp_ps(x, _mm256_set1_ps(SRGB_TOE), _CMP_LE_OQ));
+		}
+
+		VIBRATO_TARGET_AVX2
+		void resolveAVX2(const glm::vec4* accumulation, uint32_t* image, uint32_t count, Tonemap tonemap)
+		{
+			const __m256 one = _mm256_set1_ps(1.0f);
+			const __m256 scale = _mm256_set1_ps(255.0f);
+			// Packing works within 128 bit lanes, this puts the eight pixels back in order
+			const __m256i pixelOrder = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+
+			uint32_t i = 0;
+			for (; i + 8 <= count; i += 8)
+			{
+				__m256i channels[4];
+				for (int p = 0; p < 4; p++)
+				{
+					__m256 sum = _mm256_loadu_ps(&accumulation[i + 2 * p].x);
+					__m256 samples = _mm256_max_ps(_mm256_permute_ps(sum, _MM_SHUFFLE(3, 3, 3, 3)), one);
+
+					__m256 color = tonemapAVX2(_mm256_div_ps(sum, samples), tonemap);
+					color = _mm256_blend_ps(color, one, 0x88); // alpha of both pixels
+					channels[p] = _mm256_cvttps_epi32(_mm256_mul_ps(color, scale));
+				}
+
+				__m256i low = _mm256_packs_epi32(channels[0], channels[1]);
+				__m256i high = _mm256_packs_epi32(channels[2], channels[3]);
+				__m256i bytes = _mm256_packus_epi16(low, high);
+				_mm256_storeu_si256((__m256i*)&image[i], _mm256_permutevar8x32_epi32(bytes, pixelOrder));
+			}
+
+			resolveScalar(accumulation + i, image + i, count - i, tonemap);
+		}
+
+#else
+
+		void resolveSSE(const glm::vec4* accumulation, uint32_t* image, uint32_t count, Tonemap tonemap)
+		{
+			resolveScalar(accumulation, image, count, tonemap);
+		}
+
+		void resolveAVX2(const glm::vec4* accumulation, uint32_t* image, uint32_t count, Tonemap tonemap)
+		{
+			resolveScalar(accumulation, image, count, tonemap);
+		}
+
+#endif
+
+		void resolve(const glm::vec4* accumulation, uint32_t* image, uint32_t count, Tonemap tonemap)
+		{
+#if VIBRATO_SIMD_X86
+			if (SIMD::cpuSupportsAVX2())
+				resolveAVX2(accumulation, image, count, tonemap);
+			else
+				resolveSSE(accumulation, image, count, tonemap);
+#else
+			resolveScalar(accumulation, image, count, tonemap);
+#endif
+		}
+
+		const char* getKernelName()
+		{
+#if VIBRATO_SIMD_X86
+			return SIMD::cpuSupportsAVX2() ? "AVX2" : "SSE";
+#else
+			return "Scalar";
+#endif
+		}
+	}
+}
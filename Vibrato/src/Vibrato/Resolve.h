@@ -0,0 +1,32 @@
+#pragma once
+
+#include <glm/vec4.hpp>
+
+#include <cstdint>
+
+namespace Vibrato
+{
+	// How accumulated linear radiance is mapped to display values.
+	enum class Tonemap
+	{
+		Gamma = 0, // square root, gamma 2
+		SRGB,      // sRGB transfer curve, values above 1 clip
+		ACES       // ACES filmic fit (Narkowicz), then the sRGB curve
+	};
+
+	// Divides every accumulated sum by its sample count in w, tonemaps it and packs it to RGBA8 with alpha 255.
+	// Kernels agree up to float contraction, the sRGB curve is an approximation within half a step of 8 bits.
+	namespace ResolveKernels
+	{
+		void resolveScalar(const glm::vec4* accumulation, uint32_t* image, uint32_t count, Tonemap tonemap);
+
+		// Four channels of a pixel per SSE register.
+		void resolveSSE(const glm::vec4* accumulation, uint32_t* image, uint32_t count, Tonemap tonemap);
+		// Two pixels per AVX2 register, eight per iteration.
+		void resolveAVX2(const glm::vec4* accumulation, uint32_t* image, uint32_t count, Tonemap tonemap);
+
+		// The widest kernel the CPU runs.
+		void resolve(const glm::vec4* accumulation, uint32_t* image, uint32_t count, Tonemap tonemap);
+		const char* getKernelName();
+	}
+}
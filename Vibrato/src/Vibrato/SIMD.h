@@ -0,0 +1,57 @@
+#pragma once
+
+// SSE is part of the x64 baseline, AVX2 code paths are compiled per function and only run
+// after checking the CPU at runtime, so the binary still starts on machines without AVX2.
+
+#if defined(_M_X64) || defined(__x86_64__) || defined(__SSE2__)
+	#define VIBRATO_SIMD_X86 1
+	#include <immintrin.h>
+	#if defined(_MSC_VER)
+		#include <intrin.h>
+	#endif
+#else
+	#define VIBRATO_SIMD_X86 0
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+	#define VIBRATO_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#else
+	#define VIBRATO_TARGET_AVX2
+#endif
+
+namespace Vibrato
+{
+	namespace SIMD
+	{
+		inline bool cpuSupportsAVX2()
+		{
+#if VIBRATO_SIMD_X86
+	#if defined(_MSC_VER)
+			int info[4];
+			__cpuid(info, 0);
+			if (info[0] < 7)
+				return false;
+
+			__cpuid(info, 1);
+			bool osxsave = (info[2] & (1 << 27)) != 0;
+			bool avx = (info[2] & (1 << 28)) != 0;
+			bool fma = (info[2] & (1 << 12)) != 0;
+			if (!osxsave || !avx || !fma)
+				return false;
+
+			// The OS has to save the YMM registers on context switches
+			if ((_xgetbv(0) & 0x6) != 0x6)
+				return false;
+
+			__cpuidex(info, 7, 0);
+			return (info[1] & (1 << 5)) != 0;
+	#else
+			static const bool s_avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+			return s_avx2;
+	#endif
+#else
+			return false;
+#endif
+		}
+	}
+}
@@ -0,0 +1,257 @@
+#include "Sampler.h"
+
+#include "Utils.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace Vibrato
+{
+	static constexpr uint32_t BLUE_NOISE_SIZE = 64; // power of two, lookups wrap with a mask
+
+	static uint32_t reverseBits(uint32_t x)
+	{
+		x = (x << 16) | (x >> 16);
+		x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+		x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+		x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+		x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+		return x;
+	}
+
+	static uint32_t mix(uint32_t a, uint32_t b)
+	{
+		return Utils::PCG_Hash(a ^ (b + 0x9e3779b9u + (a << 6) + (a >> 2)));
+	}
+
+	// Owen scrambling through the hash-based permutation from Burley, "Practical Hash-based Owen Scrambling".
+	// Only lower bits affect higher ones, so the first 2^k values still map onto the first 2^k.
+	static uint32_t nestedUniformScramble(uint32_t x, uint32_t seed)
+	{
+		x = reverseBits(x);
+		x += seed;
+		x ^= x * 0x6c50b47cu;
+		x ^= x * 0xb82f1e52u;
+		x ^= x * 0xc7afe638u;
+		x ^= x * 0x8d22f6e6u;
+		return reverseBits(x);
+	}
+
+	// The first two Sobol dimensions, van der Corput and the one with direction numbers v ^= v >> 1.
+	static uint32_t sobol0(uint32_t index)
+	{
+		return reverseBits(index);
+	}
+
+	static uint32_t sobol1(uint32_t index)
+	{
+		uint32_t x = 0;
+		for (uint32_t v = 1u << 31; index; index >>= 1, v ^= v >> 1)
+		{
+			if (index & 1)
+				x ^= v;
+		}
+		return x;
+	}
+
+	static float toUnitFloat(uint32_t x)
+	{
+		// The top 24 bits, so the result never rounds up to 1
+		return (float)(x >> 8) * (1.0f / 16777216.0f);
+	}
+
+	// Void-and-cluster (Ulichney) ranking of a tileable mask, values in (0, 1).
+	static std::vector<float> generateBlueNoise()
+	{
+		constexpr int size = (int)BLUE_NOISE_SIZE;
+		constexpr int count = size * size;
+		constexpr float sigma = 1.5f;
+
+		// Gaussian energy by toroidal offset
+		std::vector<float> kernel(count);
+		for (int y = 0; y < size; y++)
+		{
+			for (int x = 0; x < size; x++)
+			{
+				int dx = std::min(x, size - x);
+				int dy = std::min(y, size - y);
+				kernel[x + y * size] = std::exp(-(float)(dx * dx + dy * dy) / (2.0f * sigma * sigma));
+			}
+		}
+
+		std::vector<uint8_t> pattern(count, 0);
+		std::vector<float> energy(count, 0.0f);
+
+		auto toggle = [&](int index)
+		{
+			pattern[index] ^= 1;
+			float sign = pattern[index] ? 1.0f : -1.0f;
+
+			int px = index % size, py = index / size;
+			for (int y = 0; y < size; y++)
+			{
+				const float* row = &kernel[((y - py) & (size - 1)) * size];
+				for (int x = 0; x < size; x++)
+					energy[x + y * size] += sign * row[(x - px) & (size - 1)];
+			}
+		};
+
+		auto tightestCluster = [&]()
+		{
+			int best = -1;
+			for (int i = 0; i < count; i++)
+			{
+				if (pattern[i] && (best < 0 || energy[i] > energy[best]))
+					best = i;
+			}
+			return best;
+		};
+
+		auto largestVoid = [&]()
+		{
+			int best = -1;
+			for (int i = 0; i < count; i++)
+			{
+				if (!pattern[i] && (best < 0 || energy[i] < energy[best]))
+					best = i;
+			}
+			return best;
+		};
+
+		// A tenth of the texels at random, relaxed until moving the tightest cluster would put it right back
+		int initialCount = count / 10;
+		uint32_t seed = 1;
+		for (int placed = 0; placed < initialCount;)
+		{
+			seed = Utils::PCG_Hash(seed);
+			int index = (int)(seed % count);
+			if (!pattern[index])
+			{
+				toggle(index);
+				placed++;
+			}
+		}
+
+		for (int iteration = 0; iteration < count; iteration++)
+		{
+			int cluster = tightestCluster();
+			toggle(cluster);
+
+			int largest = largestVoid();
+			toggle(largest);
+
+			if (largest == cluster)
+				break;
+		}
+
+		std::vector<int> rank(count);
+
+		// Below the initial count, ranks come from taking clusters away from a copy
+		{
+			std::vector<uint8_t> initialPattern = pattern;
+			std::vector<float> initialEnergy = energy;
+
+			for (int r = initialCount - 1; r >= 0; r--)
+			{
+				int cluster = tightestCluster();
+				toggle(cluster);
+				rank[cluster] = r;
+			}
+
+			pattern = initialPattern;
+			energy = initialEnergy;
+		}
+
+		// Above it, from filling the largest voids. Past half the mask that is also the tightest cluster
+		// of the remaining empty texels, since every texel's total energy is the same.
+		for (int r = initialCount; r < count; r++)
+		{
+			int largest = largestVoid();
+			toggle(largest);
+			rank[largest] = r;
+		}
+
+		std::vector<float> mask(count);
+		for (int i = 0; i < count; i++)
+			mask[i] = (rank[i] + 0.5f) / count;
+		return mask;
+	}
+
+	static const std::vector<float>& blueNoise()
+	{
+		// Generated on first use, static initialisation is thread-safe
+		static const std::vector<float> mask = generateBlueNoise();
+		return mask;
+	}
+
+	void Sampler::startPixelSample(Type type, uint32_t x, uint32_t y, uint32_t sampleIndex)
+	{
+		m_type = type;
+		m_x = x;
+		m_y = y;
+		m_pixelHash = mix(mix(0, x), y);
+		m_sampleIndex = sampleIndex;
+		m_dimension = 0;
+	}
+
+	void Sampler::startBounce(uint32_t bounce)
+	{
+		m_dimension = CAMERA_DIMENSIONS + bounce * BOUNCE_DIMENSIONS;
+	}
+
+	float Sampler::get1D()
+	{
+		glm::vec2 pair = samplePair(m_dimension & ~1u);
+		float value = (m_dimension & 1) ? pair.y : pair.x;
+		m_dimension++;
+		return value;
+	}
+
+	glm::vec2 Sampler::get2D()
+	{
+		// Pairs start on even dimensions, so both values come from the same 2D point
+		m_dimension = (m_dimension + 1) & ~1u;
+		glm::vec2 pair = samplePair(m_dimension);
+		m_dimension += 2;
+		return pair;
+	}
+
+	glm::vec2 Sampler::samplePair(uint32_t dimension) const
+	{
+		uint32_t pair = dimension / 2;
+
+		if (m_type == Type::Random)
+		{
+			uint32_t hash = mix(mix(m_pixelHash, m_sampleIndex), dimension);
+			return glm::vec2(toUnitFloat(hash), toUnitFloat(mix(hash, 1)));
+		}
+
+		// Blue noise uses the same points in every pixel, Sobol shuffles and scrambles them per pixel
+		uint32_t seed = m_type == Type::Sobol ? mix(m_pixelHash, pair) : mix(0x2545f491u, pair);
+
+		uint32_t index = nestedUniformScramble(m_sampleIndex, seed);
+		glm::vec2 point(
+			toUnitFloat(nestedUniformScramble(sobol0(index), mix(seed, 0))),
+			toUnitFloat(nestedUniformScramble(sobol1(index), mix(seed, 1)))
+		);
+
+		if (m_type == Type::BlueNoise)
+		{
+			// Toroidal shift per pixel, each dimension reads the mask at its own offset
+			const std::vector<float>& mask = blueNoise();
+			for (int i = 0; i < 2; i++)
+			{
+				uint32_t offset = mix(seed, 2 + i);
+				uint32_t x = (m_x + offset) & (BLUE_NOISE_SIZE - 1);
+				uint32_t y = (m_y + (offset >> 16)) & (BLUE_NOISE_SIZE - 1);
+
+				point[i] += mask[x + y * BLUE_NOISE_SIZE];
+				if (point[i] >= 1.0f)
+					point[i] -= 1.0f;
+			}
+		}
+
+		return point;
+	}
+}
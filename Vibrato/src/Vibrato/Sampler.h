@@ -0,0 +1,46 @@
+#pragma once
+
+#include <glm/vec2.hpp>
+
+#include <cstdint>
+
+namespace Vibrato
+{
+	// Sample values for one path. Every value is a function of (pixel, sample index, dimension) only,
+	// so nothing correlates across pixels or frames and each decision along a path gets its own dimension.
+	class Sampler
+	{
+	public:
+		enum class Type
+		{
+			Random = 0, // independent hashed values
+			Sobol,      // Owen-scrambled Sobol, padded two dimensions at a time and shuffled per pixel
+			BlueNoise   // the same scrambled Sobol points in every pixel, shifted per pixel by a blue-noise mask
+		};
+
+		// Dimensions 0 and 1 are the film position, 2 and 3 the lens, each bounce owns the next BOUNCE_DIMENSIONS.
+		static constexpr uint32_t CAMERA_DIMENSIONS = 4;
+		static constexpr uint32_t BOUNCE_DIMENSIONS = 8;
+
+	public:
+		// sampleIndex keeps counting across accumulated frames, so the sequence carries on instead of restarting.
+		void startPixelSample(Type type, uint32_t x, uint32_t y, uint32_t sampleIndex);
+		// Moves to the dimensions of a bounce, so the same decision always draws from the same dimension.
+		void startBounce(uint32_t bounce);
+
+		// Values are in [0, 1).
+		float get1D();
+		glm::vec2 get2D();
+
+	private:
+		// Both dimensions of the pair starting at an even dimension.
+		glm::vec2 samplePair(uint32_t dimension) const;
+
+	private:
+		Type m_type = Type::Random;
+		uint32_t m_x = 0, m_y = 0;
+		uint32_t m_pixelHash = 0;
+		uint32_t m_sampleIndex = 0;
+		uint32_t m_dimension = 0;
+	};
+}
@@ -0,0 +1,223 @@
+#include "Scene.h"
+
+namespace Vibrato
+{
+	static bool sameMaterial(const Material& a, const Material& b)
+	{
+		return a.albedo == b.albedo && a.roughness == b.roughness && a.fuzz == b.fuzz && a.refractiveIndex == b.refractiveIndex &&
+			a.emissionColor == b.emissionColor && a.emissionPower == b.emissionPower;
+	}
+
+	void Scene::commit()
+	{
+		primitives.build(objects, meshes);
+		bvh.build(primitives);
+		wideBvh.build(bvh, primitives);
+		invalidateMarkedMeshes();
+		tlas.build(instances);
+
+		// After the BVH build, which reorders primitive ids.
+		updateLights();
+
+		m_builtSAHCost = bvh.getBuildStats().sahCost;
+		m_committedMaterials = materials;
+		m_dirtyObjects.clear();
+		m_dirtyMeshes.clear();
+		m_dirtyMaterials.clear();
+		m_dirtyInstances = false;
+		m_dirtyStructure = false;
+	}
+
+	bool Scene::invalidateMarkedMeshes()
+	{
+		// The mesh's own BVH may be as stale as its BLAS
+		bool instanced = false;
+		for (uint32_t mesh : m_dirtyMeshes)
+		{
+			if (mesh < meshes.size())
+			{
+				meshes[mesh]->hierarchy.reset();
+				instanced |= tlas.invalidate(meshes[mesh]);
+			}
+		}
+		for (const std::shared_ptr<TriangleMesh>& mesh : m_dirtyInstancedMeshes)
+		{
+			mesh->hierarchy.reset();
+			instanced |= tlas.invalidate(mesh);
+		}
+
+		m_dirtyInstancedMeshes.clear();
+		return instanced;
+	}
+
+	bool Scene::instancesUseMaterial(int material) const
+	{
+		for (const MeshInstance& instance : instances)
+		{
+			int used = instance.materialIndex >= 0 ? instance.materialIndex : (instance.mesh ? instance.mesh->materialIndex : -1);
+			if (used == material)
+				return true;
+		}
+		return false;
+	}
+
+	void Scene::updateLights()
+	{
+		lights.build(primitives, materials);
+	}
+
+	void Scene::markObjectDirty(uint32_t object)
+	{
+		m_dirtyObjects.push_back(object);
+	}
+
+	void Scene::markMeshDirty(uint32_t mesh)
+	{
+		m_dirtyMeshes.push_back(mesh);
+	}
+
+	void Scene::markMeshDirty(const std::shared_ptr<TriangleMesh>& mesh)
+	{
+		m_dirtyInstancedMeshes.push_back(mesh);
+	}
+
+	void Scene::markMaterialDirty(uint32_t material)
+	{
+		m_dirtyMaterials.push_back(material);
+	}
+
+	void Scene::markInstancesDirty()
+	{
+		m_dirtyInstances = true;
+	}
+
+	void Scene::markStructureDirty()
+	{
+		m_dirtyStructure = true;
+	}
+
+	bool Scene::update()
+	{
+		if (m_dirtyObjects.empty() && m_dirtyMeshes.empty() && m_dirtyInstancedMeshes.empty() && m_dirtyMaterials.empty()
+			&& !m_dirtyInstances && !m_dirtyStructure)
+			return false;
+
+		// Materials added since the commit have nothing to compare against
+		if (m_dirtyStructure || m_committedMaterials.size() != materials.size() || bvh.isEmpty())
+		{
+			commit();
+			return true;
+		}
+
+		std::vector<uint8_t> moved;
+		bool visible = false, lightsChanged = false;
+
+		for (uint32_t object : m_dirtyObjects)
+		{
+			int id = object < objects.size() ? primitives.getObjectPrimitive(object) : -1;
+			if (id < 0)
+				continue;
+
+			const Hittable& hittable = *objects[object];
+			if (const Sphere* sphere = dynamic_cast<const Sphere*>(&hittable))
+			{
+				if (primitives.setSphere(id, sphere->position, sphere->radius))
+				{
+					moved.resize(primitives.size(), 0);
+					moved[id] = 1;
+					visible = true;
+					lightsChanged |= primitives.getMaterialIndex(id) < (int)materials.size() && materials[primitives.getMaterialIndex(id)].isEmissive();
+				}
+			}
+
+			if (primitives.setMaterialIndex(id, hittable.materialIndex))
+				visible = lightsChanged = true;
+		}
+
+		for (uint32_t mesh : m_dirtyMeshes)
+		{
+			if (mesh < meshes.size() && primitives.setMeshMaterialIndex(mesh, meshes[mesh]->materialIndex))
+				visible = lightsChanged = true;
+		}
+
+		// Instanced meshes get a new BLAS, and the top level picks up their material
+		if (invalidateMarkedMeshes())
+			m_dirtyInstances = true;
+
+		for (uint32_t material : m_dirtyMaterials)
+		{
+			if (material >= materials.size() || sameMaterial(materials[material], m_committedMaterials[material]))
+				continue;
+
+			const Material& before = m_committedMaterials[material];
+			lightsChanged |= before.radiance() != materials[material].radiance();
+			// Nothing shows a material no primitive or instance uses
+			visible |= primitives.usesMaterial((int)material) || instancesUseMaterial((int)material);
+			m_committedMaterials[material] = materials[material];
+		}
+
+		m_dirtyObjects.clear();
+		m_dirtyMeshes.clear();
+		m_dirtyMaterials.clear();
+
+		if (m_dirtyInstances)
+		{
+			tlas.build(instances);
+			m_dirtyInstances = false;
+			visible = true;
+		}
+
+		if (!moved.empty())
+		{
+			std::vector<uint8_t> changedNodes;
+			bvh.refit(primitives, moved, changedNodes);
+
+			if (bvh.getBuildStats().sahCost > m_builtSAHCost * REBUILD_COST_RATIO)
+			{
+				bvh.build(primitives);
+				wideBvh.build(bvh, primitives);
+				m_builtSAHCost = bvh.getBuildStats().sahCost;
+				lightsChanged = true; // ids were reordered
+			}
+			else
+			{
+				wideBvh.refit(bvh, changedNodes);
+			}
+		}
+
+		if (lightsChanged)
+			updateLights();
+
+		return visible;
+	}
+
+	bool Scene::intersect(const Ray& ray, RayHit& hit) const
+	{
+		bool found = wideBvh.intersect(ray, primitives, hit);
+		found |= tlas.intersect(ray, hit);
+		return found;
+	}
+
+	void Scene::intersect(const RayPacket& packet, PacketHit& hit) const
+	{
+		wideBvh.intersect(packet, primitives, hit);
+		if (tlas.isEmpty())
+			return;
+
+		// Instances are traced ray by ray, each one sees a different transform anyway
+		for (uint32_t i = 0; i < packet.count; i++)
+		{
+			RayHit laneHit = hit.get(i);
+			if (tlas.intersect(packet.get(i), laneHit))
+				hit.set(i, laneHit);
+		}
+	}
+
+	void Scene::setHitPayload(const RayHit& hit, const Ray& ray, HitPayload& payload) const
+	{
+		if (hit.instance != UINT32_MAX)
+			tlas.setHitPayload(hit, ray, payload);
+		else
+			primitives.setHitPayload(hit, ray, payload);
+	}
+}
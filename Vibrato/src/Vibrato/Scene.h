@@ -1,6 +1,12 @@
 #pragma once
 
 #include "Hittables.h"
+#include "Material.h"
+#include "LightSampler.h"
+#include "PrimitiveStore.h"
+#include "BVH.h"
+#include "WideBVH.h"
+#include "TLAS.h"
 
 #include <glm/glm.hpp>
 
@@ -9,38 +15,67 @@
 
 namespace Vibrato
 {
-	struct Material
+	class Scene
 	{
-		glm::vec3 albedo{ 1.0f };
-		float roughness = 1.0f;
-		float fuzz = 0.0f;
+	public:
+		// Flattens objects and meshes into the primitive store and rebuilds the acceleration structure,
+		// call after adding, removing or editing objects.
+		void commit();
+		// Rebuilds only the emitter list, enough after changing which materials emit.
+		void updateLights();
 
-		float refractiveIndex = 0.0f;
+		// Edits to existing objects, meshes and materials can be marked instead of committed, update() then
+		// patches them in and refits the acceleration structure rather than rebuilding it.
+		// Only positions, radii and material indices are picked up, anything else still needs commit().
+		void markObjectDirty(uint32_t object);
+		// A marked mesh that is also instanced gets its BLAS rebuilt, new geometry included.
+		void markMeshDirty(uint32_t mesh);
+		// For meshes that are only instanced: rebuilds their BLAS and the top level.
+		void markMeshDirty(const std::shared_ptr<TriangleMesh>& mesh);
+		void markMaterialDirty(uint32_t material);
+		// Applies everything marked since the last update or commit, returns whether the image can have changed.
+		bool update();
+		// Instances can be moved, re-materialed, added or removed freely, marking them rebuilds only the top level.
+		void markInstancesDirty();
+		// Objects, meshes or instances were added or removed, the next update commits.
+		void markStructureDirty();
 
-		glm::vec3 emissionColor{ 1.0f };
-		float emissionPower = 0.0f;
+		// Closest hit over the primitives and every instance, returns false when nothing in (0, hit.distance) was hit.
+		bool intersect(const Ray& ray, RayHit& hit) const;
+		void intersect(const RayPacket& packet, PacketHit& hit) const;
+		// payload.position must already be set.
+		void setHitPayload(const RayHit& hit, const Ray& ray, HitPayload& payload) const;
 
-		glm::vec3 emission() const { return emissionColor * emissionPower; }
+	public:
+		std::vector <std::shared_ptr<Hittable>> objects;
+		std::vector<std::shared_ptr<TriangleMesh>> meshes;
+		std::vector<Material> materials;
+		std::vector<MeshInstance> instances;
 
-		void reset()
-		{
-			roughness = 1.0f;
-			fuzz = 0.0f;
+		// Render-side representation, objects and meshes are only read when committing.
+		PrimitiveStore primitives;
+		BVH bvh;         // binary SAH build, kept for its statistics
+		WideBVH wideBvh; // collapsed from bvh and used for traversal
+		TLAS tlas;       // instances, traced after wideBvh
 
-			refractiveIndex = 0.0f;
+		// Emissive primitives, sampled for next-event estimation. Instances are only found by scattering.
+		LightSampler lights;
 
-			emissionColor.r = 1.0f;
-			emissionColor.g = 1.0f;
-			emissionColor.b = 1.0f;
+	private:
+		// Invalidates the BLASes of marked meshes, returns whether any of them was instanced.
+		bool invalidateMarkedMeshes();
+		// Whether any instance shades with the material, through its own override or its mesh's.
+		bool instancesUseMaterial(int material) const;
 
-			emissionPower = 0.0f;
-		}
-	};
+	private:
+		// Refitting loosens the tree, past this much of the SAH cost it had when built it is rebuilt instead.
+		static constexpr float REBUILD_COST_RATIO = 1.5f;
 
-	class Scene
-	{
-	public:
-		std::vector <std::shared_ptr<Hittable>> objects;
-		std::vector<Material> materials;
+		std::vector<uint32_t> m_dirtyObjects, m_dirtyMeshes, m_dirtyMaterials;
+		std::vector<std::shared_ptr<TriangleMesh>> m_dirtyInstancedMeshes;
+		bool m_dirtyInstances = false;
+		bool m_dirtyStructure = false;
+		std::vector<Material> m_committedMaterials; // to tell which marked materials really changed
+		float m_builtSAHCost = 0.0f;
 	};
 }
@@ -0,0 +1,329 @@
+#include "SceneLoader.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <unordered_map>
+
+namespace Vibrato
+{
+	// A mesh file the scene uses and everything that places it, so every file is loaded once.
+	struct MeshLoad
+	{
+		std::string path;
+		std::vector<int> meshMaterials; // one per mesh entry, empty when the path is only instanced
+		std::vector<MeshInstance> instances;
+	};
+
+	static bool parseError(const std::string& filePath, uint32_t lineNumber, const std::string& line, const char* message, std::string& error)
+	{
+		error = filePath + ":" + std::to_string(lineNumber) + ": " + message;
+		std::cout << "> " << error << "\n>   " << line << std::endl;
+		return false;
+	}
+
+	// Reads everything but the meshes themselves, those are only listed.
+	static bool parseScene(const std::string& filePath, int firstMaterial, SceneFragment& scene, std::vector<MeshLoad>& meshes, std::string& error)
+	{
+		std::ifstream file(filePath);
+		if (!file)
+		{
+			error = "failed to open " + filePath;
+			std::cout << "> Failed to open " << filePath << "!" << std::endl;
+			return false;
+		}
+
+		std::string directory;
+		size_t slash = filePath.find_last_of("/\\");
+		if (slash != std::string::npos)
+			directory = filePath.substr(0, slash + 1);
+
+		// Index into meshes by path, for mesh and instance entries alike
+		std::unordered_map<std::string, size_t> meshIndices;
+		auto findMesh = [&](const std::string& path) -> MeshLoad&
+		{
+			auto found = meshIndices.find(path);
+			if (found == meshIndices.end())
+			{
+				found = meshIndices.emplace(path, meshes.size()).first;
+				meshes.emplace_back().path = directory + path;
+			}
+			return meshes[found->second];
+		};
+
+		std::string line;
+		uint32_t lineNumber = 0;
+		while (std::getline(file, line))
+		{
+			lineNumber++;
+
+			std::istringstream stream(line.substr(0, line.find('#')));
+			std::string type;
+			if (!(stream >> type))
+				continue;
+
+			if (type == "camera")
+			{
+				CameraDescription description;
+				if (!(stream >> description.position.x >> description.position.y >> description.position.z
+					>> description.direction.x >> description.direction.y >> description.direction.z))
+					return parseError(filePath, lineNumber, line, "expected camera <px> <py> <pz> <dx> <dy> <dz> [fov] [options]", error);
+
+				std::string option;
+				while (stream >> option)
+				{
+					bool valid;
+					if (option == "aperture")
+						valid = (bool)(stream >> description.aperture);
+					else if (option == "focus")
+						valid = (bool)(stream >> description.focusDistance);
+					else
+					{
+						std::istringstream fov(option);
+						valid = (bool)(fov >> description.verticalFOV);
+						if (!valid)
+							return parseError(filePath, lineNumber, line, "unknown camera option", error);
+					}
+
+					if (!valid)
+						return parseError(filePath, lineNumber, line, "missing camera option value", error);
+				}
+
+				scene.camera = description;
+				scene.hasCamera = true;
+			}
+			else if (type == "material")
+			{
+				Material material;
+				if (!(stream >> material.albedo.r >> material.albedo.g >> material.albedo.b))
+					return parseError(filePath, lineNumber, line, "expected material <r> <g> <b> [options]", error);
+
+				std::string option;
+				while (stream >> option)
+				{
+					bool valid;
+					if (option == "roughness")
+						valid = (bool)(stream >> material.roughness);
+					else if (option == "fuzz")
+						valid = (bool)(stream >> material.fuzz);
+					else if (option == "ior")
+						valid = (bool)(stream >> material.refractiveIndex);
+					else if (option == "emission")
+						valid = (bool)(stream >> material.emissionColor.r >> material.emissionColor.g >> material.emissionColor.b >> material.emissionPower);
+					else
+						return parseError(filePath, lineNumber, line, "unknown material option", error);
+
+					if (!valid)
+						return parseError(filePath, lineNumber, line, "missing material option value", error);
+				}
+
+				scene.materials.push_back(material);
+			}
+			else if (type == "sphere")
+			{
+				auto sphere = std::make_shared<Sphere>();
+				int material;
+				if (!(stream >> sphere->position.x >> sphere->position.y >> sphere->position.z >> sphere->radius >> material))
+					return parseError(filePath, lineNumber, line, "expected sphere <x> <y> <z> <radius> <material>", error);
+
+				if (material < 0 || material >= (int)scene.materials.size())
+					return parseError(filePath, lineNumber, line, "material is not defined yet", error);
+
+				sphere->materialIndex = firstMaterial + material;
+				scene.objects.push_back(sphere);
+			}
+			else if (type == "mesh")
+			{
+				std::string path;
+				int material;
+				if (!(stream >> path >> material))
+					return parseError(filePath, lineNumber, line, "expected mesh <path> <material>", error);
+
+				if (material < 0 || material >= (int)scene.materials.size())
+					return parseError(filePath, lineNumber, line, "material is not defined yet", error);
+
+				findMesh(path).meshMaterials.push_back(firstMaterial + material);
+			}
+			else if (type == "instance")
+			{
+				std::string path;
+				int material;
+				glm::vec3 position;
+				if (!(stream >> path >> material >> position.x >> position.y >> position.z))
+					return parseError(filePath, lineNumber, line, "expected instance <path> <material> <x> <y> <z> [options]", error);
+
+				if (material < 0 || material >= (int)scene.materials.size())
+					return parseError(filePath, lineNumber, line, "material is not defined yet", error);
+
+				glm::mat4 rotation(1.0f);
+				float scale = 1.0f;
+
+				std::string option;
+				while (stream >> option)
+				{
+					bool valid;
+					if (option == "rotate")
+					{
+						float degrees;
+						glm::vec3 axis;
+						valid = (bool)(stream >> degrees >> axis.x >> axis.y >> axis.z);
+						if (valid && axis == glm::vec3(0.0f))
+							return parseError(filePath, lineNumber, line, "rotation axis must not be zero", error);
+						if (valid)
+							rotation = glm::rotate(glm::mat4(1.0f), glm::radians(degrees), axis);
+					}
+					else if (option == "scale")
+					{
+						valid = (bool)(stream >> scale);
+						// The transform is inverted for tracing
+						if (valid && scale == 0.0f)
+							return parseError(filePath, lineNumber, line, "scale must not be zero", error);
+					}
+					else
+						return parseError(filePath, lineNumber, line, "unknown instance option", error);
+
+					if (!valid)
+						return parseError(filePath, lineNumber, line, "missing instance option value", error);
+				}
+
+				MeshInstance& instance = findMesh(path).instances.emplace_back();
+				instance.transform = glm::translate(glm::mat4(1.0f), position) * rotation * glm::scale(glm::mat4(1.0f), glm::vec3(scale));
+				instance.materialIndex = firstMaterial + material;
+			}
+			else
+			{
+				return parseError(filePath, lineNumber, line, "unknown entry", error);
+			}
+		}
+
+		return true;
+	}
+
+	bool loadScene(const std::string& filePath, Scene& scene, CameraDescription& camera)
+	{
+		SceneLoadTask task(filePath, (int)scene.materials.size());
+		task.wait();
+
+		for (const SceneFragment& fragment : task.takeFragments())
+		{
+			fragment.appendTo(scene);
+			if (fragment.hasCamera)
+				camera = fragment.camera;
+		}
+
+		return task.getProgress().error.empty();
+	}
+
+	void SceneFragment::appendTo(Scene& scene) const
+	{
+		scene.materials.insert(scene.materials.end(), materials.begin(), materials.end());
+		scene.objects.insert(scene.objects.end(), objects.begin(), objects.end());
+		scene.meshes.insert(scene.meshes.end(), meshes.begin(), meshes.end());
+		if (!materials.empty() || !objects.empty() || !meshes.empty())
+			scene.markStructureDirty();
+
+		scene.instances.insert(scene.instances.end(), instances.begin(), instances.end());
+		if (!instances.empty())
+			scene.markInstancesDirty();
+	}
+
+	SceneLoadTask::SceneLoadTask(const std::string& filePath, int firstMaterial)
+		: m_filePath(filePath)
+	{
+		m_thread = std::thread(&SceneLoadTask::run, this, firstMaterial);
+	}
+
+	SceneLoadTask::~SceneLoadTask()
+	{
+		m_cancel = true;
+		wait();
+	}
+
+	std::vector<SceneFragment> SceneLoadTask::takeFragments()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		std::vector<SceneFragment> fragments;
+		fragments.swap(m_fragments);
+		return fragments;
+	}
+
+	SceneLoadTask::Progress SceneLoadTask::getProgress() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_progress;
+	}
+
+	void SceneLoadTask::wait()
+	{
+		if (m_thread.joinable())
+			m_thread.join();
+	}
+
+	void SceneLoadTask::fail(const std::string& error)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_progress.error.empty())
+			m_progress.error = error;
+	}
+
+	void SceneLoadTask::run(int firstMaterial)
+	{
+		SceneFragment scene;
+		std::vector<MeshLoad> meshes;
+		std::string error;
+		if (!parseScene(m_filePath, firstMaterial, scene, meshes, error))
+		{
+			fail(error);
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_progress.done = true;
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_fragments.push_back(std::move(scene));
+			m_progress.meshCount = (uint32_t)meshes.size();
+		}
+
+		// One file at a time, the OBJ parser already spreads each file over every thread
+		for (uint32_t i = 0; i < (uint32_t)meshes.size() && !m_cancel; i++)
+		{
+			MeshLoad& load = meshes[i];
+			auto mesh = std::make_shared<TriangleMesh>();
+			std::string meshError;
+			bool loaded = mesh->load(load.path, meshError, !load.instances.empty());
+			if (!loaded)
+			{
+				std::cout << "> Failed to load " << load.path << ": " << meshError << std::endl;
+				fail("failed to load " + load.path + ": " + meshError);
+			}
+
+			SceneFragment fragment;
+			fragment.fileOrder = i + 1;
+			if (loaded)
+			{
+				// Further mesh entries of the same file differ only in material, they get copies
+				for (size_t entry = 0; entry < load.meshMaterials.size(); entry++)
+				{
+					auto entryMesh = entry == 0 ? mesh : std::make_shared<TriangleMesh>(*mesh);
+					entryMesh->materialIndex = load.meshMaterials[entry];
+					fragment.meshes.push_back(entryMesh);
+				}
+
+				fragment.instances = std::move(load.instances);
+				for (MeshInstance& instance : fragment.instances)
+					instance.mesh = mesh;
+			}
+
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (loaded)
+				m_fragments.push_back(std::move(fragment));
+			m_progress.loadedMeshes++;
+		}
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_progress.done = true;
+	}
+}
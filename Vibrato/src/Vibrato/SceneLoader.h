@@ -0,0 +1,100 @@
+#pragma once
+
+#include "Scene.h"
+
+#include <glm/glm.hpp>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Vibrato
+{
+	struct CameraDescription
+	{
+		glm::vec3 position{ 0.0f, 1.0f, 5.0f };
+		glm::vec3 direction{ 0.0f, 0.0f, -1.0f };
+		float verticalFOV = 45.0f;
+		float aperture = 0.0f; // lens diameter, 0 for a pinhole
+		float focusDistance = 5.0f;
+	};
+
+	// Plain text scene files, one entry per line, '#' starts a comment:
+	//
+	//   camera   <px> <py> <pz> <dx> <dy> <dz> [fov] [aperture <v>] [focus <v>]
+	//   material <r> <g> <b> [roughness <v>] [fuzz <v>] [ior <v>] [emission <r> <g> <b> <power>]
+	//   sphere   <x> <y> <z> <radius> <material>
+	//   mesh     <path> <material>
+	//   instance <path> <material> <x> <y> <z> [rotate <degrees> <ax> <ay> <az>] [scale <s>]
+	//
+	// Materials are numbered in the order they appear, mesh paths are relative to the scene file.
+	// Every path is loaded once, instances of it share that mesh, placed at x y z after rotating and scaling it.
+	// Appends to the scene without committing it, returns false and prints the offending line on errors.
+	// A mesh that fails to load is left out and the rest of the scene is still appended.
+	bool loadScene(const std::string& filePath, Scene& scene, CameraDescription& camera);
+
+	// Part of a scene file as SceneLoadTask hands it out, material indices already point into the target scene.
+	struct SceneFragment
+	{
+		std::vector<Material> materials;
+		std::vector<std::shared_ptr<Hittable>> objects;
+		std::vector<std::shared_ptr<TriangleMesh>> meshes;
+		std::vector<MeshInstance> instances;
+
+		bool hasCamera = false;
+		CameraDescription camera;
+
+		uint32_t fileOrder = 0; // 0 for the first fragment, then meshes by where the file first names them
+
+		// Appends without committing and marks what changed, so the next update picks it up.
+		void appendTo(Scene& scene) const;
+	};
+
+	// Loads a scene file on a thread of its own. The file is parsed first: its camera, materials and spheres
+	// become the first fragment. Meshes then load one file after another, each becomes a fragment as soon as
+	// it is done, so whoever shows the scene can render what is there while the rest streams in.
+	class SceneLoadTask
+	{
+	public:
+		struct Progress
+		{
+			uint32_t meshCount = 0, loadedMeshes = 0; // known once the file is parsed, failed meshes count as loaded
+			bool done = false;
+			std::string error; // the first one, loading goes on with the other meshes
+		};
+
+	public:
+		// firstMaterial is the number of materials the target scene has before the first fragment goes in.
+		SceneLoadTask(const std::string& filePath, int firstMaterial = 0);
+		// Meshes not started yet are skipped, waits for the one loading.
+		~SceneLoadTask();
+
+		SceneLoadTask(const SceneLoadTask&) = delete;
+		SceneLoadTask& operator=(const SceneLoadTask&) = delete;
+
+		// Fragments finished since the last call, the first one first, then meshes in file order.
+		std::vector<SceneFragment> takeFragments();
+		Progress getProgress() const;
+		// Blocks until everything is loaded or has failed.
+		void wait();
+
+		inline const std::string& getFilePath() const { return m_filePath; }
+
+	private:
+		void run(int firstMaterial);
+		void fail(const std::string& error);
+
+	private:
+		std::string m_filePath;
+
+		mutable std::mutex m_mutex;
+		std::vector<SceneFragment> m_fragments;
+		Progress m_progress;
+		std::atomic<bool> m_cancel{ false };
+
+		std::thread m_thread;
+	};
+}
@@ -0,0 +1,200 @@
+#include "TLAS.h"
+
+#include "Clef/Timer.h"
+
+#include <algorithm>
+
+namespace Vibrato
+{
+	void BLAS::build(const std::shared_ptr<TriangleMesh>& mesh)
+	{
+		primitives.build({}, { mesh });
+
+		// Prebuilt with the mesh (or loaded with it from its cache) unless edited since, else only needed to collapse from
+		if (mesh->hasCurrentHierarchy())
+		{
+			wideBvh.build(*mesh->hierarchy, primitives);
+		}
+		else
+		{
+			BVH bvh;
+			bvh.build(primitives);
+			wideBvh.build(bvh, primitives);
+		}
+
+		bounds = mesh->getBounds();
+	}
+
+	void TLAS::build(const std::vector<MeshInstance>& instances)
+	{
+		Clef::Timer timer;
+
+		m_nodes.clear();
+		m_instances.clear();
+
+		// Only meshes still instanced carry over
+		std::map<std::weak_ptr<const TriangleMesh>, std::shared_ptr<BLAS>, std::owner_less<>> blases;
+		for (const MeshInstance& instance : instances)
+		{
+			if (!instance.mesh || instance.mesh->getTriangleCount() == 0)
+				continue;
+
+			std::shared_ptr<BLAS>& blas = blases[instance.mesh];
+			if (!blas)
+			{
+				auto kept = m_blases.find(instance.mesh);
+				if (kept != m_blases.end())
+				{
+					blas = kept->second;
+				}
+				else
+				{
+					blas = std::make_shared<BLAS>();
+					blas->build(instance.mesh);
+				}
+			}
+
+			Instance& placed = m_instances.emplace_back();
+			placed.blas = blas;
+			placed.toObject = glm::inverse(instance.transform);
+			placed.normalToWorld = glm::mat3(glm::transpose(placed.toObject));
+			placed.materialIndex = instance.materialIndex >= 0 ? instance.materialIndex : instance.mesh->materialIndex;
+
+			// World bounds around the transformed corners of the mesh bounds
+			for (int corner = 0; corner < 8; corner++)
+			{
+				glm::vec3 p((corner & 1) ? blas->bounds.max.x : blas->bounds.min.x,
+					(corner & 2) ? blas->bounds.max.y : blas->bounds.min.y,
+					(corner & 4) ? blas->bounds.max.z : blas->bounds.min.z);
+				placed.bounds.grow(glm::vec3(instance.transform * glm::vec4(p, 1.0f)));
+			}
+		}
+
+		m_blases.swap(blases);
+
+		if (!m_instances.empty())
+		{
+			m_nodes.reserve(m_instances.size() * 2);
+			Node& root = m_nodes.emplace_back();
+			root.leftFirst = 0;
+			root.count = (uint32_t)m_instances.size();
+			subdivide(0);
+		}
+
+		m_buildTimeMs = timer.elapsedMillis();
+	}
+
+	void TLAS::clear()
+	{
+		m_nodes.clear();
+		m_instances.clear();
+		m_blases.clear();
+	}
+
+	bool TLAS::invalidate(const std::shared_ptr<TriangleMesh>& mesh)
+	{
+		return m_blases.erase(mesh) > 0;
+	}
+
+	void TLAS::subdivide(uint32_t nodeIndex)
+	{
+		Node node = m_nodes[nodeIndex];
+
+		AABB bounds, centroidBounds;
+		for (uint32_t i = node.leftFirst; i < node.leftFirst + node.count; i++)
+		{
+			bounds.grow(m_instances[i].bounds);
+			centroidBounds.grow(m_instances[i].bounds.centroid());
+		}
+		m_nodes[nodeIndex].bounds = bounds;
+
+		if (node.count <= MAX_LEAF_SIZE)
+			return;
+
+		// Instances are few and rebuilt often, a median split is good enough
+		int axis = centroidBounds.longestAxis();
+		auto first = m_instances.begin() + node.leftFirst;
+		auto mid = first + node.count / 2;
+		std::nth_element(first, mid, first + node.count, [axis](const Instance& a, const Instance& b)
+		{
+			return a.bounds.centroid()[axis] < b.bounds.centroid()[axis];
+		});
+
+		uint32_t leftIndex = (uint32_t)m_nodes.size();
+
+		Node& left = m_nodes.emplace_back();
+		left.leftFirst = node.leftFirst;
+		left.count = node.count / 2;
+
+		Node& right = m_nodes.emplace_back();
+		right.leftFirst = node.leftFirst + node.count / 2;
+		right.count = node.count - node.count / 2;
+
+		m_nodes[nodeIndex].leftFirst = leftIndex;
+		m_nodes[nodeIndex].count = 0;
+
+		subdivide(leftIndex);
+		subdivide(leftIndex + 1);
+	}
+
+	Ray TLAS::toObject(const Instance& instance, const Ray& ray)
+	{
+		// The direction is not renormalized, so distances along the ray stay the same in both spaces
+		Ray local;
+		local.origin = glm::vec3(instance.toObject * glm::vec4(ray.origin, 1.0f));
+		local.direction = glm::vec3(instance.toObject * glm::vec4(ray.direction, 0.0f));
+		return local;
+	}
+
+	bool TLAS::intersect(const Ray& ray, RayHit& hit) const
+	{
+		if (m_nodes.empty())
+			return false;
+
+		glm::vec3 invDirection = safeInverse(ray.direction);
+
+		bool found = false;
+
+		uint32_t stack[64];
+		uint32_t stackSize = 0;
+		stack[stackSize++] = 0;
+
+		while (stackSize > 0)
+		{
+			const Node& node = m_nodes[stack[--stackSize]];
+			if (node.bounds.intersect(ray, invDirection, hit.distance) == std::numeric_limits<float>::max())
+				continue;
+
+			if (node.count > 0)
+			{
+				for (uint32_t i = node.leftFirst; i < node.leftFirst + node.count; i++)
+				{
+					const Instance& instance = m_instances[i];
+					if (instance.blas->wideBvh.intersect(toObject(instance, ray), instance.blas->primitives, hit))
+					{
+						hit.instance = i;
+						found = true;
+					}
+				}
+				continue;
+			}
+
+			stack[stackSize++] = node.leftFirst + 1;
+			stack[stackSize++] = node.leftFirst;
+		}
+
+		return found;
+	}
+
+	void TLAS::setHitPayload(const RayHit& hit, const Ray& ray, HitPayload& payload) const
+	{
+		const Instance& instance = m_instances[hit.instance];
+		instance.blas->primitives.setHitPayload(hit, toObject(instance, ray), payload);
+
+		// Inverse transpose keeps normals perpendicular under non-uniform scale, the side the ray is on does not change
+		payload.normal = glm::normalize(instance.normalToWorld * payload.normal);
+		payload.materialIndex = instance.materialIndex;
+		payload.objectIndex = -1;
+		payload.primitiveIndex = UINT32_MAX;
+	}
+}
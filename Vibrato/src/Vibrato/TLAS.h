@@ -0,0 +1,92 @@
+#pragma once
+
+#include "AABB.h"
+#include "BVH.h"
+#include "HitPayload.h"
+#include "Hittables.h"
+#include "PrimitiveStore.h"
+#include "Ray.h"
+#include "WideBVH.h"
+
+#include <glm/glm.hpp>
+
+#include <map>
+#include <memory>
+#include <vector>
+
+namespace Vibrato
+{
+	// A mesh placed in the scene with its own transform. Every instance of a mesh shares its triangles and
+	// bottom level structure, so copies cost a transform each.
+	struct MeshInstance
+	{
+		std::shared_ptr<TriangleMesh> mesh;
+		glm::mat4 transform{ 1.0f }; // object to world
+		int materialIndex = -1;      // -1 keeps the mesh's own
+	};
+
+	// Bottom level: one mesh in its own space, traced like the scene's primitives are.
+	struct BLAS
+	{
+		PrimitiveStore primitives;
+		WideBVH wideBvh;
+		AABB bounds;
+
+		void build(const std::shared_ptr<TriangleMesh>& mesh);
+	};
+
+	// Top level: a binary BVH over instance bounds in world space. Leaves transform the ray into the
+	// instance's space and trace its BLAS. BLASes are built once per mesh and kept across builds, so
+	// rebuilding after moving instances only touches the instances themselves.
+	class TLAS
+	{
+	public:
+		// Reuses the BLAS of every mesh it still has one for, a mesh whose geometry changed must be invalidated first.
+		void build(const std::vector<MeshInstance>& instances);
+		void clear();
+		// Drops the mesh's BLAS, returns whether it had one (the mesh was instanced and a build is due).
+		bool invalidate(const std::shared_ptr<TriangleMesh>& mesh);
+
+		// Closer hits than hit.distance set hit.instance, returns false when there was none.
+		bool intersect(const Ray& ray, RayHit& hit) const;
+		// For a hit intersect returned, payload.position must already be set.
+		void setHitPayload(const RayHit& hit, const Ray& ray, HitPayload& payload) const;
+
+		inline bool isEmpty() const { return m_nodes.empty(); }
+		inline uint32_t getInstanceCount() const { return (uint32_t)m_instances.size(); }
+		inline uint32_t getMeshCount() const { return (uint32_t)m_blases.size(); }
+		inline float getBuildTime() const { return m_buildTimeMs; }
+
+	private:
+		struct Instance
+		{
+			std::shared_ptr<const BLAS> blas;
+			glm::mat4 toObject;
+			glm::mat3 normalToWorld;
+			AABB bounds;
+			int materialIndex;
+		};
+
+		struct Node
+		{
+			AABB bounds;
+			uint32_t leftFirst = 0; // left child for interior nodes, first instance for leaves
+			uint32_t count = 0;     // 0 for interior nodes
+		};
+
+		void subdivide(uint32_t nodeIndex);
+
+		static Ray toObject(const Instance& instance, const Ray& ray);
+
+	private:
+		static constexpr uint32_t MAX_LEAF_SIZE = 2;
+
+		std::vector<Node> m_nodes;
+		std::vector<Instance> m_instances; // in leaf order
+
+		// By mesh ownership rather than address, a new mesh allocated where a freed one was is not mistaken for it
+		std::map<std::weak_ptr<const TriangleMesh>, std::shared_ptr<BLAS>, std::owner_less<>> m_blases;
+
+		float m_buildTimeMs = 0.0f;
+	};
+}
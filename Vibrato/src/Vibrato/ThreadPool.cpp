@@ -0,0 +1,154 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+namespace Vibrato
+{
+	ThreadPool::ThreadPool(uint32_t threadCount)
+	{
+		start(threadCount);
+	}
+
+	ThreadPool::~ThreadPool()
+	{
+		stop();
+	}
+
+	void ThreadPool::resize(uint32_t threadCount)
+	{
+		if (threadCount == 0)
+			threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+
+		if (threadCount == getThreadCount())
+			return;
+
+		stop();
+		start(threadCount);
+	}
+
+	void ThreadPool::start(uint32_t threadCount)
+	{
+		if (threadCount == 0)
+			threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+
+		m_stop = false;
+
+		m_queues.clear();
+		for (uint32_t i = 0; i < threadCount; i++)
+			m_queues.push_back(std::make_unique<Queue>());
+
+		for (uint32_t i = 1; i < threadCount; i++)
+			m_workers.emplace_back(&ThreadPool::workerLoop, this, i);
+	}
+
+	void ThreadPool::stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stop = true;
+		}
+		m_wake.notify_all();
+
+		for (std::thread& worker : m_workers)
+			worker.join();
+
+		m_workers.clear();
+	}
+
+	void ThreadPool::run(uint32_t taskCount, const std::function<void(uint32_t)>& task)
+	{
+		if (taskCount == 0)
+			return;
+
+		uint32_t threadCount = (uint32_t)m_queues.size();
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+
+			for (uint32_t i = 0; i < threadCount; i++)
+			{
+				std::lock_guard<std::mutex> queueLock(m_queues[i]->mutex);
+				m_queues[i]->task = &task;
+				m_queues[i]->begin = (uint32_t)((uint64_t)taskCount * i / threadCount);
+				m_queues[i]->end = (uint32_t)((uint64_t)taskCount * (i + 1) / threadCount);
+			}
+
+			m_generation++;
+		}
+		m_wake.notify_all();
+
+		work(0);
+
+		// Workers may still be finishing the last stolen tasks.
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_done.wait(lock, [this] { return m_active == 0; });
+	}
+
+	void ThreadPool::workerLoop(uint32_t worker)
+	{
+		uint64_t generation;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			generation = m_generation;
+		}
+
+		while (true)
+		{
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_wake.wait(lock, [this, generation] { return m_stop || m_generation != generation; });
+
+				if (m_stop)
+					return;
+
+				generation = m_generation;
+				m_active++;
+			}
+
+			work(worker);
+
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				if (--m_active == 0)
+					m_done.notify_all();
+			}
+		}
+	}
+
+	void ThreadPool::work(uint32_t worker)
+	{
+		const Task* function;
+		uint32_t task;
+		while (pop(worker, function, task))
+			(*function)(task);
+	}
+
+	bool ThreadPool::pop(uint32_t worker, const Task*& function, uint32_t& task)
+	{
+		{
+			Queue& own = *m_queues[worker];
+			std::lock_guard<std::mutex> lock(own.mutex);
+			if (own.begin < own.end)
+			{
+				function = own.task;
+				task = own.begin++;
+				return true;
+			}
+		}
+
+		uint32_t threadCount = (uint32_t)m_queues.size();
+		for (uint32_t i = 1; i < threadCount; i++)
+		{
+			Queue& victim = *m_queues[(worker + i) % threadCount];
+			std::lock_guard<std::mutex> lock(victim.mutex);
+			if (victim.begin < victim.end)
+			{
+				function = victim.task;
+				task = --victim.end;
+				return true;
+			}
+		}
+
+		return false;
+	}
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Vibrato
+{
+	// Fixed set of worker threads running index-based jobs.
+	// Every thread gets a contiguous slice of the task range and works it front to back,
+	// threads that run dry steal single tasks from the back of the others' slices.
+	class ThreadPool
+	{
+	public:
+		// 0 threads uses every hardware thread.
+		explicit ThreadPool(uint32_t threadCount = 0);
+		~ThreadPool();
+
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+
+		void resize(uint32_t threadCount);
+
+		// Includes the thread calling run, which works along.
+		inline uint32_t getThreadCount() const { return (uint32_t)m_workers.size() + 1; }
+
+		// Calls task(i) for every i in [0, taskCount) and returns once all of them are done.
+		// Slice order follows index order, so neighbouring indices should be neighbouring work.
+		void run(uint32_t taskCount, const std::function<void(uint32_t)>& task);
+
+	private:
+		using Task = std::function<void(uint32_t)>;
+
+		// Range of task indices owned by one thread, padded so queues never share a cache line.
+		// The task travels with the range, so a worker still finishing an earlier run can never pair
+		// an index with the wrong or a missing function.
+		struct alignas(64) Queue
+		{
+			std::mutex mutex;
+			const Task* task = nullptr;
+			uint32_t begin = 0, end = 0;
+		};
+
+		void start(uint32_t threadCount);
+		void stop();
+
+		void workerLoop(uint32_t worker);
+		void work(uint32_t worker);
+		bool pop(uint32_t worker, const Task*& function, uint32_t& task);
+
+	private:
+		std::vector<std::thread> m_workers;
+		std::vector<std::unique_ptr<Queue>> m_queues; // [0] belongs to the calling thread
+
+		std::mutex m_mutex;
+		std::condition_variable m_wake, m_done;
+		uint64_t m_generation = 0;
+		uint32_t m_active = 0;
+		bool m_stop = false;
+	};
+}
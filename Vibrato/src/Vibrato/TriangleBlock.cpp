@@ -0,0 +1,311 @@
+#include "TriangleBlock.h"
+
+#include "SIMD.h"
+
+#include <cmath>
+
+namespace Vibrato
+{
+	namespace TriangleKernels
+	{
+		template<int N>
+		int intersectScalar(const TriangleBlock<N>& block, const Ray& ray, float& hitDistance, float& u, float& v)
+		{
+			int closest = -1;
+
+			for (int i = 0; i < N; i++)
+			{
+				// pvec = d x e2
+				float px = ray.direction.y * block.e2z[i] - ray.direction.z * block.e2y[i];
+				float py = ray.direction.z * block.e2x[i] - ray.direction.x * block.e2z[i];
+				float pz = ray.direction.x * block.e2y[i] - ray.direction.y * block.e2x[i];
+
+				float det = block.e1x[i] * px + block.e1y[i] * py + block.e1z[i] * pz;
+				if (std::abs(det) < DETERMINANT_EPSILON)
+					continue;
+
+				float invDet = 1.0f / det;
+
+				float tx = ray.origin.x - block.v0x[i];
+				float ty = ray.origin.y - block.v0y[i];
+				float tz = ray.origin.z - block.v0z[i];
+
+				float laneU = (tx * px + ty * py + tz * pz) * invDet;
+				if (laneU < 0.0f || laneU > 1.0f)
+					continue;
+
+				// qvec = tvec x e1
+				float qx = ty * block.e1z[i] - tz * block.e1y[i];
+				float qy = tz * block.e1x[i] - tx * block.e1z[i];
+				float qz = tx * block.e1y[i] - ty * block.e1x[i];
+
+				float laneV = (ray.direction.x * qx + ray.direction.y * qy + ray.direction.z * qz) * invDet;
+				if (laneV < 0.0f || laneU + laneV > 1.0f)
+					continue;
+
+				float t = (block.e2x[i] * qx + block.e2y[i] * qy + block.e2z[i] * qz) * invDet;
+				if (t > 0.0f && t < hitDistance)
+				{
+					hitDistance = t;
+					u = laneU;
+					v = laneV;
+					closest = i;
+				}
+			}
+
+			return closest;
+		}
+
+		template int intersectScalar<4>(const TriangleBlock<4>&, const Ray&, float&, float&, float&);
+		template int intersectScalar<8>(const TriangleBlock<8>&, const Ray&, float&, float&, float&);
+
+		void intersectPacketScalar(const TriangleBlock<8>& block, const RayPacket& packet, PacketHit& hit)
+		{
+			for (int r = 0; r < RayPacket::SIZE; r++)
+			{
+				if (hit.distance[r] < 0.0f)
+					continue;
+
+				float u, v;
+				int lane = intersectScalar<8>(block, packet.get(r), hit.distance[r], u, v);
+				if (lane >= 0)
+				{
+					hit.primitiveIndex[r] = block.primitive[lane];
+					hit.u[r] = u;
+					hit.v[r] = v;
+				}
+			}
+		}
+
+#if VIBRATO_SIMD_X86
+
+		int intersectSSE(const TriangleBlock<4>& block, const Ray& ray, float& hitDistance, float& u, float& v)
+		{
+			const __m128 dx = _mm_set1_ps(ray.direction.x);
+			const __m128 dy = _mm_set1_ps(ray.direction.y);
+			const __m128 dz = _mm_set1_ps(ray.direction.z);
+
+			const __m128 e1x = _mm_load_ps(block.e1x);
+			const __m128 e1y = _mm_load_ps(block.e1y);
+			const __m128 e1z = _mm_load_ps(block.e1z);
+			const __m128 e2x = _mm_load_ps(block.e2x);
+			const __m128 e2y = _mm_load_ps(block.e2y);
+			const __m128 e2z = _mm_load_ps(block.e2z);
+
+			__m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+			__m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+			__m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+
+			__m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+			__m128 absDet = _mm_andnot_ps(_mm_set1_ps(-0.0f), det);
+			__m128 mask = _mm_cmpge_ps(absDet, _mm_set1_ps(DETERMINANT_EPSILON));
+
+			__m128 invDet = _mm_div_ps(_mm_set1_ps(1.0f), det);
+
+			__m128 tx = _mm_sub_ps(_mm_set1_ps(ray.origin.x), _mm_load_ps(block.v0x));
+			__m128 ty = _mm_sub_ps(_mm_set1_ps(ray.origin.y), _mm_load_ps(block.v0y));
+			__m128 tz = _mm_sub_ps(_mm_set1_ps(ray.origin.z), _mm_load_ps(block.v0z));
+
+			__m128 laneU = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, px), _mm_mul_ps(ty, py)), _mm_mul_ps(tz, pz)), invDet);
+
+			__m128 qx = _mm_sub_ps(_mm_mul_ps(ty, e1z), _mm_mul_ps(tz, e1y));
+			__m128 qy = _mm_sub_ps(_mm_mul_ps(tz, e1x), _mm_mul_ps(tx, e1z));
+			__m128 qz = _mm_sub_ps(_mm_mul_ps(tx, e1y), _mm_mul_ps(ty, e1x));
+
+			__m128 laneV = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), invDet);
+			__m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), invDet);
+
+			const __m128 zero = _mm_setzero_ps();
+			const __m128 one = _mm_set1_ps(1.0f);
+			mask = _mm_and_ps(mask, _mm_cmpge_ps(laneU, zero));
+			mask = _mm_and_ps(mask, _mm_cmpge_ps(laneV, zero));
+			mask = _mm_and_ps(mask, _mm_cmple_ps(_mm_add_ps(laneU, laneV), one));
+			mask = _mm_and_ps(mask, _mm_cmpgt_ps(t, zero));
+			mask = _mm_and_ps(mask, _mm_cmplt_ps(t, _mm_set1_ps(hitDistance)));
+
+			int bits = _mm_movemask_ps(mask);
+			if (bits == 0)
+				return -1;
+
+			alignas(16) float ts[4], us[4], vs[4];
+			_mm_store_ps(ts, t);
+			_mm_store_ps(us, laneU);
+			_mm_store_ps(vs, laneV);
+
+			int closest = -1;
+			for (int i = 0; i < 4; i++)
+			{
+				if ((bits & (1 << i)) && ts[i] < hitDistance)
+				{
+					hitDistance = ts[i];
+					u = us[i];
+					v = vs[i];
+					closest = i;
+				}
+			}
+
+			return closest;
+		}
+
+		VIBRATO_TARGET_AVX2
+		int intersectAVX2(const TriangleBlock<8>& block, const Ray& ray, float& hitDistance, float& u, float& v)
+		{
+			const __m256 dx = _mm256_set1_ps(ray.direction.x);
+			const __m256 dy = _mm256_set1_ps(ray.direction.y);
+			const __m256 dz = _mm256_set1_ps(ray.direction.z);
+
+			const __m256 e1x = _mm256_load_ps(block.e1x);
+			const __m256 e1y = _mm256_load_ps(block.e1y);
+			const __m256 e1z = _mm256_load_ps(block.e1z);
+			const __m256 e2x = _mm256_load_ps(block.e2x);
+			const __m256 e2y = _mm256_load_ps(block.e2y);
+			const __m256 e2z = _mm256_load_ps(block.e2z);
+
+			__m256 px = _mm256_fmsub_ps(dy, e2z, _mm256_mul_ps(dz, e2y));
+			__m256 py = _mm256_fmsub_ps(dz, e2x, _mm256_mul_ps(dx, e2z));
+			__m256 pz = _mm256_fmsub_ps(dx, e2y, _mm256_mul_ps(dy, e2x));
+
+			__m256 det = _mm256_fmadd_ps(e1x, px, _mm256_fmadd_ps(e1y, py, _mm256_mul_ps(e1z, pz)));
+			__m256 absDet = _mm256_andnot_ps(_mm256_set1_ps(-0.0f), det);
+			__m256 mask = _mm256_cmp_ps(absDet, _mm256_set1_ps(DETERMINANT_EPSILON), _CMP_GE_OQ);
+
+			__m256 invDet = _mm256_div_ps(_mm256_set1_ps(1.0f), det);
+
+			__m256 tx = _mm256_sub_ps(_mm256_set1_ps(ray.origin.x), _mm256_load_ps(block.v0x));
+			__m256 ty = _mm256_sub_ps(_mm256_set1_ps(ray.origin.y), _mm256_load_ps(block.v0y));
+			__m256 tz = _mm256_sub_ps(_mm256_set1_ps(ray.origin.z), _mm256_load_ps(block.v0z));
+
+			__m256 laneU = _mm256_mul_ps(_mm256_fmadd_ps(tx, px, _mm256_fmadd_ps(ty, py, _mm256_mul_ps(tz, pz))), invDet);
+
+			__m256 qx = _mm256_fmsub_ps(ty, e1z, _mm256_mul_ps(tz, e1y));
+			__m256 qy = _mm256_fmsub_ps(tz, e1x, _mm256_mul_ps(tx, e1z));
+			__m256 qz = _mm256_fmsub_ps(tx, e1y, _mm256_mul_ps(ty, e1x));
+
+			__m256 laneV = _mm256_mul_ps(_mm256_fmadd_ps(dx, qx, _mm256_fmadd_ps(dy, qy, _mm256_mul_ps(dz, qz))), invDet);
+			__m256 t = _mm256_mul_ps(_mm256_fmadd_ps(e2x, qx, _mm256_fmadd_ps(e2y, qy, _mm256_mul_ps(e2z, qz))), invDet);
+
+			const __m256 zero = _mm256_setzero_ps();
+			const __m256 one = _mm256_set1_ps(1.0f);
+			mask = _mm256_and_ps(mask, _mm256_cmp_ps(laneU, zero, _CMP_GE_OQ));
+			mask = _mm256_and_ps(mask, _mm256_cmp_ps(laneV, zero, _CMP_GE_OQ));
+			mask = _mm256_and_ps(mask, _mm256_cmp_ps(_mm256_add_ps(laneU, laneV), one, _CMP_LE_OQ));
+			mask = _mm256_and_ps(mask, _mm256_cmp_ps(t, zero, _CMP_GT_OQ));
+			mask = _mm256_and_ps(mask, _mm256_cmp_ps(t, _mm256_set1_ps(hitDistance), _CMP_LT_OQ));
+
+			int bits = _mm256_movemask_ps(mask);
+			if (bits == 0)
+				return -1;
+
+			alignas(32) float ts[8], us[8], vs[8];
+			_mm256_store_ps(ts, t);
+			_mm256_store_ps(us, laneU);
+			_mm256_store_ps(vs, laneV);
+
+			int closest = -1;
+			for (int i = 0; i < 8; i++)
+			{
+				if ((bits & (1 << i)) && ts[i] < hitDistance)
+				{
+					hitDistance = ts[i];
+					u = us[i];
+					v = vs[i];
+					closest = i;
+				}
+			}
+
+			return closest;
+		}
+
+		VIBRATO_TARGET_AVX2
+		void intersectPacketAVX2(const TriangleBlock<8>& block, const RayPacket& packet, PacketHit& hit)
+		{
+			const __m256 ox = _mm256_load_ps(packet.originX);
+			const __m256 oy = _mm256_load_ps(packet.originY);
+			const __m256 oz = _mm256_load_ps(packet.originZ);
+			const __m256 dx = _mm256_load_ps(packet.directionX);
+			const __m256 dy = _mm256_load_ps(packet.directionY);
+			const __m256 dz = _mm256_load_ps(packet.directionZ);
+
+			const __m256 zero = _mm256_setzero_ps();
+			const __m256 one = _mm256_set1_ps(1.0f);
+			const __m256 epsilon = _mm256_set1_ps(DETERMINANT_EPSILON);
+			const __m256 signBit = _mm256_set1_ps(-0.0f);
+
+			__m256 hitDistance = _mm256_load_ps(hit.distance);
+			__m256 hitPrimitive = _mm256_load_ps((const float*)hit.primitiveIndex);
+			__m256 hitU = _mm256_load_ps(hit.u);
+			__m256 hitV = _mm256_load_ps(hit.v);
+
+			// One triangle broadcast against all rays at a time, padding lanes are only ever at the end of a block.
+			for (int i = 0; i < 8 && block.primitive[i] != UINT32_MAX; i++)
+			{
+				const __m256 e1x = _mm256_set1_ps(block.e1x[i]);
+				const __m256 e1y = _mm256_set1_ps(block.e1y[i]);
+				const __m256 e1z = _mm256_set1_ps(block.e1z[i]);
+				const __m256 e2x = _mm256_set1_ps(block.e2x[i]);
+				const __m256 e2y = _mm256_set1_ps(block.e2y[i]);
+				const __m256 e2z = _mm256_set1_ps(block.e2z[i]);
+
+				__m256 px = _mm256_fmsub_ps(dy, e2z, _mm256_mul_ps(dz, e2y));
+				__m256 py = _mm256_fmsub_ps(dz, e2x, _mm256_mul_ps(dx, e2z));
+				__m256 pz = _mm256_fmsub_ps(dx, e2y, _mm256_mul_ps(dy, e2x));
+
+				__m256 det = _mm256_fmadd_ps(e1x, px, _mm256_fmadd_ps(e1y, py, _mm256_mul_ps(e1z, pz)));
+				__m256 mask = _mm256_cmp_ps(_mm256_andnot_ps(signBit, det), epsilon, _CMP_GE_OQ);
+
+				__m256 invDet = _mm256_div_ps(one, det);
+
+				__m256 tx = _mm256_sub_ps(ox, _mm256_set1_ps(block.v0x[i]));
+				__m256 ty = _mm256_sub_ps(oy, _mm256_set1_ps(block.v0y[i]));
+				__m256 tz = _mm256_sub_ps(oz, _mm256_set1_ps(block.v0z[i]));
+
+				__m256 u = _mm256_mul_ps(_mm256_fmadd_ps(tx, px, _mm256_fmadd_ps(ty, py, _mm256_mul_ps(tz, pz))), invDet);
+
+				__m256 qx = _mm256_fmsub_ps(ty, e1z, _mm256_mul_ps(tz, e1y));
+				__m256 qy = _mm256_fmsub_ps(tz, e1x, _mm256_mul_ps(tx, e1z));
+				__m256 qz = _mm256_fmsub_ps(tx, e1y, _mm256_mul_ps(ty, e1x));
+
+				__m256 v = _mm256_mul_ps(_mm256_fmadd_ps(dx, qx, _mm256_fmadd_ps(dy, qy, _mm256_mul_ps(dz, qz))), invDet);
+				__m256 t = _mm256_mul_ps(_mm256_fmadd_ps(e2x, qx, _mm256_fmadd_ps(e2y, qy, _mm256_mul_ps(e2z, qz))), invDet);
+
+				mask = _mm256_and_ps(mask, _mm256_cmp_ps(u, zero, _CMP_GE_OQ));
+				mask = _mm256_and_ps(mask, _mm256_cmp_ps(v, zero, _CMP_GE_OQ));
+				mask = _mm256_and_ps(mask, _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_LE_OQ));
+				mask = _mm256_and_ps(mask, _mm256_cmp_ps(t, zero, _CMP_GT_OQ));
+				mask = _mm256_and_ps(mask, _mm256_cmp_ps(t, hitDistance, _CMP_LT_OQ));
+
+				if (_mm256_movemask_ps(mask) == 0)
+					continue;
+
+				hitDistance = _mm256_blendv_ps(hitDistance, t, mask);
+				hitPrimitive = _mm256_blendv_ps(hitPrimitive, _mm256_castsi256_ps(_mm256_set1_epi32((int)block.primitive[i])), mask);
+				hitU = _mm256_blendv_ps(hitU, u, mask);
+				hitV = _mm256_blendv_ps(hitV, v, mask);
+			}
+
+			_mm256_store_ps(hit.distance, hitDistance);
+			_mm256_store_ps((float*)hit.primitiveIndex, hitPrimitive);
+			_mm256_store_ps(hit.u, hitU);
+			_mm256_store_ps(hit.v, hitV);
+		}
+
+#else
+
+		int intersectSSE(const TriangleBlock<4>& block, const Ray& ray, float& hitDistance, float& u, float& v)
+		{
+			return intersectScalar<4>(block, ray, hitDistance, u, v);
+		}
+
+		int intersectAVX2(const TriangleBlock<8>& block, const Ray& ray, float& hitDistance, float& u, float& v)
+		{
+			return intersectScalar<8>(block, ray, hitDistance, u, v);
+		}
+
+		void intersectPacketAVX2(const TriangleBlock<8>& block, const RayPacket& packet, PacketHit& hit)
+		{
+			intersectPacketScalar(block, packet, hit);
+		}
+
+#endif
+	}
+}
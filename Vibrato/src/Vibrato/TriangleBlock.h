@@ -0,0 +1,44 @@
+#pragma once
+
+#include "Ray.h"
+#include "RayPacket.h"
+
+#include <cstdint>
+
+namespace Vibrato
+{
+	// N triangles of one BVH leaf in SoA form. Padding lanes have degenerate edges and never hit.
+	template<int N>
+	struct TriangleBlock
+	{
+		alignas(N * 4) float v0x[N];
+		alignas(N * 4) float v0y[N];
+		alignas(N * 4) float v0z[N];
+		alignas(N * 4) float e1x[N];
+		alignas(N * 4) float e1y[N];
+		alignas(N * 4) float e1z[N];
+		alignas(N * 4) float e2x[N];
+		alignas(N * 4) float e2y[N];
+		alignas(N * 4) float e2z[N];
+
+		uint32_t primitive[N]; // primitive id in the store
+	};
+
+	// Two-sided Moller-Trumbore against every lane of a block.
+	// Returns the lane of the nearest hit in (0, hitDistance) and updates hitDistance, u and v,
+	// or -1 when no lane was hit. u and v weight v1 and v2 respectively.
+	namespace TriangleKernels
+	{
+		constexpr float DETERMINANT_EPSILON = 1e-12f;
+
+		template<int N>
+		int intersectScalar(const TriangleBlock<N>& block, const Ray& ray, float& hitDistance, float& u, float& v);
+
+		int intersectSSE(const TriangleBlock<4>& block, const Ray& ray, float& hitDistance, float& u, float& v);
+		int intersectAVX2(const TriangleBlock<8>& block, const Ray& ray, float& hitDistance, float& u, float& v);
+
+		// Every triangle of the block against every ray of the packet, updating the per-lane closest hits.
+		void intersectPacketScalar(const TriangleBlock<8>& block, const RayPacket& packet, PacketHit& hit);
+		void intersectPacketAVX2(const TriangleBlock<8>& block, const RayPacket& packet, PacketHit& hit);
+	}
+}
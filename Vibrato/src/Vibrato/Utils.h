@@ -1,6 +1,10 @@
 #pragma once
 
 #include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+
+#include <cstring>
+#include <utility>
 
 namespace Utils
 {
@@ -44,4 +48,72 @@ namespace Utils
 			randomFloat(seed) * 2.0f - 1.0f
 		));
 	}
-}
\ No newline at end of file
+
+	// Uniformly distributed unit vector, u in [0, 1).
+	static glm::vec3 uniformSphere(const glm::vec2& u)
+	{
+		float z = 1.0f - 2.0f * u.x;
+		float r = glm::sqrt(glm::max(0.0f, 1.0f - z * z));
+		float phi = glm::two_pi<float>() * u.y;
+		return glm::vec3(r * glm::cos(phi), r * glm::sin(phi), z);
+	}
+
+	// Z-order index of a 2D cell, x in the even bits and y in the odd ones.
+	static uint32_t mortonIndex(uint32_t x, uint32_t y)
+	{
+		auto spread = [](uint32_t v)
+		{
+			v &= 0x0000ffff;
+			v = (v | (v << 8)) & 0x00ff00ff;
+			v = (v | (v << 4)) & 0x0f0f0f0f;
+			v = (v | (v << 2)) & 0x33333333;
+			v = (v | (v << 1)) & 0x55555555;
+			return v;
+		};
+		return spread(x) | (spread(y) << 1);
+	}
+
+	// Distance along the Hilbert curve filling an n x n grid, n a power of two.
+	static uint32_t hilbertIndex(uint32_t n, uint32_t x, uint32_t y)
+	{
+		uint32_t d = 0;
+		for (uint32_t s = n / 2; s > 0; s /= 2)
+		{
+			uint32_t rx = (x & s) > 0;
+			uint32_t ry = (y & s) > 0;
+			d += s * s * ((3 * rx) ^ ry);
+
+			// Rotate the quadrant so the curve stays continuous
+			if (ry == 0)
+			{
+				if (rx == 1)
+				{
+					x = s - 1 - (x & (s - 1));
+					y = s - 1 - (y & (s - 1));
+				}
+				std::swap(x, y);
+			}
+		}
+		return d;
+	}
+
+	// FNV-1a over 8 byte words, then the remaining bytes. Not the standard byte-wise one, but several times faster.
+	// Chain calls by passing the previous result as hash.
+	static uint64_t hashBytes(const void* bytes, size_t size, uint64_t hash = 0xcbf29ce484222325ull)
+	{
+		constexpr uint64_t PRIME = 0x100000001b3ull;
+		const uint8_t* data = (const uint8_t*)bytes;
+
+		size_t i = 0;
+		for (; i + 8 <= size; i += 8)
+		{
+			uint64_t word;
+			std::memcpy(&word, data + i, 8);
+			hash = (hash ^ word) * PRIME;
+		}
+		for (; i < size; i++)
+			hash = (hash ^ data[i]) * PRIME;
+
+		return hash;
+	}
+}
@@ -0,0 +1,681 @@
+#include "WideBVH.h"
+
+#include "SIMD.h"
+
+#include <cassert>
+#include <limits>
+
+namespace Vibrato
+{
+	namespace
+	{
+		// Orders the hit children so the nearest one ends up on top of the stack.
+		template<typename Entry>
+		inline void sortDescending(Entry* entries, int count)
+		{
+			for (int i = 1; i < count; i++)
+			{
+				Entry entry = entries[i];
+				int j = i - 1;
+				while (j >= 0 && entries[j].distance < entry.distance)
+				{
+					entries[j + 1] = entries[j];
+					j--;
+				}
+				entries[j + 1] = entry;
+			}
+		}
+	}
+
+	void WideBVH::build(const BVH& bvh, const PrimitiveStore& primitives, int width)
+	{
+		clear();
+
+		if (width == 0)
+			width = SIMD::cpuSupportsAVX2() ? 8 : 4;
+
+		m_width = width;
+
+#if VIBRATO_SIMD_X86
+		m_kernel = m_width == 8 ? Kernel::AVX2 : Kernel::SSE;
+		if (m_kernel == Kernel::AVX2 && !SIMD::cpuSupportsAVX2())
+			m_kernel = Kernel::Scalar;
+#else
+		m_kernel = Kernel::Scalar;
+#endif
+
+		const std::vector<BVH::Node>& nodes = bvh.getNodes();
+		if (nodes.empty())
+			return;
+
+		if (nodes[0].isLeaf())
+		{
+			uint32_t leaf = m_width == 8 ? makeLeaf<8>(nodes[0], bvh.getPrimitiveIndices(), primitives, m_blocks8) : makeLeaf<4>(nodes[0], bvh.getPrimitiveIndices(), primitives, m_blocks4);
+			m_root = { leaf, nodes[0].count, 0.0f };
+			return;
+		}
+
+		m_root = { 0, 0, 0.0f };
+		if (m_width == 8)
+			collapse<8>(bvh, 0, primitives, m_nodes8, m_blocks8);
+		else
+			collapse<4>(bvh, 0, primitives, m_nodes4, m_blocks4);
+	}
+
+	void WideBVH::clear()
+	{
+		m_nodes4.clear();
+		m_nodes8.clear();
+		m_binaryChildren.clear();
+		m_leaves.clear();
+		m_sphereIds.clear();
+		m_blocks4.clear();
+		m_blocks8.clear();
+		m_root = { 0, 0, 0.0f };
+	}
+
+	void WideBVH::refit(const BVH& bvh, const std::vector<uint8_t>& changedNodes)
+	{
+		if (m_width == 8)
+			refitNodes<8>(bvh, changedNodes, m_nodes8);
+		else
+			refitNodes<4>(bvh, changedNodes, m_nodes4);
+	}
+
+	template<int N>
+	void WideBVH::refitNodes(const BVH& bvh, const std::vector<uint8_t>& changedNodes, std::vector<WideBVHNode<N>>& wideNodes)
+	{
+		const std::vector<BVH::Node>& nodes = bvh.getNodes();
+
+		for (uint32_t n = 0; n < (uint32_t)wideNodes.size(); n++)
+		{
+			WideBVHNode<N>& node = wideNodes[n];
+			for (int i = 0; i < N; i++)
+			{
+				uint32_t binaryIndex = m_binaryChildren[n * N + i];
+				if (binaryIndex == UINT32_MAX || !changedNodes[binaryIndex])
+					continue;
+
+				const AABB& bounds = nodes[binaryIndex].bounds;
+				node.minX[i] = bounds.min.x;
+				node.minY[i] = bounds.min.y;
+				node.minZ[i] = bounds.min.z;
+				node.maxX[i] = bounds.max.x;
+				node.maxY[i] = bounds.max.y;
+				node.maxZ[i] = bounds.max.z;
+			}
+		}
+	}
+
+	const char* WideBVH::getKernelName() const
+	{
+		switch (m_kernel)
+		{
+		case Kernel::AVX2: return "8-wide AVX2";
+		case Kernel::SSE:  return "4-wide SSE";
+		default:           return m_width == 8 ? "8-wide scalar" : "4-wide scalar";
+		}
+	}
+
+	template<int N>
+	uint32_t WideBVH::collapse(const BVH& bvh, uint32_t binaryIndex, const PrimitiveStore& primitives, std::vector<WideBVHNode<N>>& wideNodes, std::vector<TriangleBlock<N>>& blocks)
+	{
+		const std::vector<BVH::Node>& nodes = bvh.getNodes();
+
+		uint32_t wideIndex = (uint32_t)wideNodes.size();
+		wideNodes.emplace_back();
+		m_binaryChildren.resize(wideNodes.size() * N, UINT32_MAX);
+
+		// Open up the interior child with the largest surface area until all N slots are used.
+		uint32_t children[N];
+		int childCount = 2;
+		children[0] = nodes[binaryIndex].leftFirst;
+		children[1] = nodes[binaryIndex].leftFirst + 1;
+
+		while (childCount < N)
+		{
+			int best = -1;
+			float bestArea = -1.0f;
+			for (int i = 0; i < childCount; i++)
+			{
+				const BVH::Node& child = nodes[children[i]];
+				if (!child.isLeaf() && child.bounds.surfaceArea() > bestArea)
+				{
+					best = i;
+					bestArea = child.bounds.surfaceArea();
+				}
+			}
+
+			if (best < 0)
+				break;
+
+			uint32_t opened = children[best];
+			children[best] = nodes[opened].leftFirst;
+			children[childCount++] = nodes[opened].leftFirst + 1;
+		}
+
+		// Recurse first, wideNodes may reallocate while the children are collapsed.
+		uint32_t childIndices[N];
+		for (int i = 0; i < childCount; i++)
+		{
+			const BVH::Node& child = nodes[children[i]];
+			childIndices[i] = child.isLeaf() ? makeLeaf<N>(child, bvh.getPrimitiveIndices(), primitives, blocks) : collapse<N>(bvh, children[i], primitives, wideNodes, blocks);
+		}
+
+		WideBVHNode<N>& node = wideNodes[wideIndex];
+		for (int i = 0; i < N; i++)
+		{
+			if (i < childCount)
+			{
+				const BVH::Node& child = nodes[children[i]];
+				node.minX[i] = child.bounds.min.x;
+				node.minY[i] = child.bounds.min.y;
+				node.minZ[i] = child.bounds.min.z;
+				node.maxX[i] = child.bounds.max.x;
+				node.maxY[i] = child.bounds.max.y;
+				node.maxZ[i] = child.bounds.max.z;
+				node.child[i] = childIndices[i];
+				node.count[i] = child.isLeaf() ? child.count : 0;
+				m_binaryChildren[wideIndex * N + i] = children[i];
+			}
+			else
+			{
+				const float inf = std::numeric_limits<float>::infinity();
+				node.minX[i] = node.minY[i] = node.minZ[i] = inf;
+				node.maxX[i] = node.maxY[i] = node.maxZ[i] = inf;
+				node.child[i] = 0;
+				node.count[i] = 0;
+			}
+		}
+
+		return wideIndex;
+	}
+
+	template<int N>
+	uint32_t WideBVH::makeLeaf(const BVH::Node& node, const std::vector<uint32_t>& primitiveIndices, const PrimitiveStore& primitives, std::vector<TriangleBlock<N>>& blocks)
+	{
+		Leaf leaf;
+		leaf.firstSphere = (uint32_t)m_sphereIds.size();
+		leaf.firstBlock = (uint32_t)blocks.size();
+
+		const PrimitiveStore::TriangleHot& triangles = primitives.getTriangles();
+		uint32_t sphereCount = primitives.getSphereCount();
+
+		int lane = N;
+		for (uint32_t i = node.leftFirst; i < node.leftFirst + node.count; i++)
+		{
+			uint32_t id = primitiveIndices[i];
+			if (primitives.isSphere(id))
+			{
+				m_sphereIds.push_back(id);
+				continue;
+			}
+
+			if (lane == N)
+			{
+				// Padding lanes keep zero edges, their determinant is 0 and they never hit.
+				TriangleBlock<N>& block = blocks.emplace_back();
+				for (int i = 0; i < N; i++)
+				{
+					block.v0x[i] = block.v0y[i] = block.v0z[i] = 0.0f;
+					block.e1x[i] = block.e1y[i] = block.e1z[i] = 0.0f;
+					block.e2x[i] = block.e2y[i] = block.e2z[i] = 0.0f;
+					block.primitive[i] = UINT32_MAX;
+				}
+				lane = 0;
+			}
+
+			uint32_t t = id - sphereCount;
+			TriangleBlock<N>& block = blocks.back();
+			block.v0x[lane] = triangles.v0x[t];
+			block.v0y[lane] = triangles.v0y[t];
+			block.v0z[lane] = triangles.v0z[t];
+			block.e1x[lane] = triangles.e1x[t];
+			block.e1y[lane] = triangles.e1y[t];
+			block.e1z[lane] = triangles.e1z[t];
+			block.e2x[lane] = triangles.e2x[t];
+			block.e2y[lane] = triangles.e2y[t];
+			block.e2z[lane] = triangles.e2z[t];
+			block.primitive[lane] = id;
+			lane++;
+		}
+
+		leaf.sphereCount = (uint32_t)m_sphereIds.size() - leaf.firstSphere;
+		leaf.blockCount = (uint32_t)blocks.size() - leaf.firstBlock;
+
+		m_leaves.push_back(leaf);
+		return (uint32_t)m_leaves.size() - 1;
+	}
+
+	template<int N>
+	bool WideBVH::intersectLeaf(uint32_t leafIndex, const std::vector<TriangleBlock<N>>& blocks, const Ray& ray, const PrimitiveStore& primitives, RayHit& hit) const
+	{
+		const Leaf& leaf = m_leaves[leafIndex];
+
+		bool found = false;
+		for (uint32_t i = leaf.firstSphere; i < leaf.firstSphere + leaf.sphereCount; i++)
+		{
+			uint32_t id = m_sphereIds[i];
+			float t = primitives.intersectSphere(id, ray);
+			if (t > 0.0f && t < hit.distance)
+			{
+				hit.distance = t;
+				hit.primitiveIndex = id;
+				found = true;
+			}
+		}
+
+		for (uint32_t i = leaf.firstBlock; i < leaf.firstBlock + leaf.blockCount; i++)
+		{
+			const TriangleBlock<N>& block = blocks[i];
+
+			float u, v;
+			int lane;
+			if constexpr (N == 8)
+				lane = m_kernel == Kernel::AVX2 ? TriangleKernels::intersectAVX2(block, ray, hit.distance, u, v) : TriangleKernels::intersectScalar<8>(block, ray, hit.distance, u, v);
+			else
+				lane = m_kernel == Kernel::SSE ? TriangleKernels::intersectSSE(block, ray, hit.distance, u, v) : TriangleKernels::intersectScalar<4>(block, ray, hit.distance, u, v);
+
+			if (lane >= 0)
+			{
+				hit.primitiveIndex = block.primitive[lane];
+				hit.barycentrics = glm::vec2(u, v);
+				found = true;
+			}
+		}
+
+		return found;
+	}
+
+	bool WideBVH::intersect(const Ray& ray, const PrimitiveStore& primitives, RayHit& hit) const
+	{
+		if (m_leaves.empty())
+			return false;
+
+		BVH::threadTraversalStats().rays++;
+
+		if (m_root.count > 0)
+		{
+			BVH::threadTraversalStats().primitiveTests += m_root.count;
+			if (m_width == 8)
+				return intersectLeaf<8>(m_root.child, m_blocks8, ray, primitives, hit);
+			return intersectLeaf<4>(m_root.child, m_blocks4, ray, primitives, hit);
+		}
+
+		switch (m_kernel)
+		{
+		case Kernel::AVX2: return intersectAVX2(ray, primitives, hit);
+		case Kernel::SSE:  return intersectSSE(ray, primitives, hit);
+		default:
+			if (m_width == 8)
+				return intersectScalar<8>(m_nodes8, ray, primitives, hit);
+			return intersectScalar<4>(m_nodes4, ray, primitives, hit);
+		}
+	}
+
+	bool WideBVH::intersect(const RayPacket& packet, const PrimitiveStore& primitives, PacketHit& hit) const
+	{
+		if (m_leaves.empty())
+			return false;
+
+		if (supportsPackets())
+			return intersectPacketAVX2(packet, primitives, hit);
+
+		bool found = false;
+		for (uint32_t i = 0; i < packet.count; i++)
+		{
+			RayHit rayHit = hit.get(i);
+			if (intersect(packet.get(i), primitives, rayHit))
+			{
+				hit.distance[i] = rayHit.distance;
+				hit.primitiveIndex[i] = rayHit.primitiveIndex;
+				hit.u[i] = rayHit.barycentrics.x;
+				hit.v[i] = rayHit.barycentrics.y;
+				found = true;
+			}
+		}
+		return found;
+	}
+
+	template<int N>
+	bool WideBVH::intersectScalar(const std::vector<WideBVHNode<N>>& nodes, const Ray& ray, const PrimitiveStore& primitives, RayHit& hit) const
+	{
+		BVH::TraversalStats& stats = BVH::threadTraversalStats();
+
+		glm::vec3 invDirection = safeInverse(ray.direction);
+
+		bool found = false;
+
+		StackEntry stack[STACK_SIZE];
+		int stackSize = 0;
+		stack[stackSize++] = m_root;
+
+		while (stackSize > 0)
+		{
+			StackEntry entry = stack[--stackSize];
+			if (entry.distance >= hit.distance)
+				continue;
+
+			if (entry.count > 0)
+			{
+				stats.primitiveTests += entry.count;
+				if constexpr (N == 8)
+					found |= intersectLeaf<8>(entry.child, m_blocks8, ray, primitives, hit);
+				else
+					found |= intersectLeaf<4>(entry.child, m_blocks4, ray, primitives, hit);
+				continue;
+			}
+
+			stats.nodesVisited++;
+
+			const WideBVHNode<N>& node = nodes[entry.child];
+
+			StackEntry hits[N];
+			int hitCount = 0;
+			for (int i = 0; i < N; i++)
+			{
+				AABB bounds;
+				bounds.min = glm::vec3(node.minX[i], node.minY[i], node.minZ[i]);
+				bounds.max = glm::vec3(node.maxX[i], node.maxY[i], node.maxZ[i]);
+
+				float tNear = bounds.intersect(ray, invDirection, hit.distance);
+				if (tNear != std::numeric_limits<float>::max())
+					hits[hitCount++] = { node.child[i], node.count[i], tNear };
+			}
+
+			sortDescending(hits, hitCount);
+			assert(stackSize + hitCount <= STACK_SIZE && "traversal stack overflow");
+			for (int i = 0; i < hitCount; i++)
+				stack[stackSize++] = hits[i];
+		}
+
+		return found;
+	}
+
+#if VIBRATO_SIMD_X86
+
+	bool WideBVH::intersectSSE(const Ray& ray, const PrimitiveStore& primitives, RayHit& hit) const
+	{
+		BVH::TraversalStats& stats = BVH::threadTraversalStats();
+
+		glm::vec3 invDirection = safeInverse(ray.direction);
+
+		const __m128 originX = _mm_set1_ps(ray.origin.x);
+		const __m128 originY = _mm_set1_ps(ray.origin.y);
+		const __m128 originZ = _mm_set1_ps(ray.origin.z);
+		const __m128 invDirX = _mm_set1_ps(invDirection.x);
+		const __m128 invDirY = _mm_set1_ps(invDirection.y);
+		const __m128 invDirZ = _mm_set1_ps(invDirection.z);
+		const __m128 zero = _mm_setzero_ps();
+
+		bool found = false;
+
+		StackEntry stack[STACK_SIZE];
+		int stackSize = 0;
+		stack[stackSize++] = m_root;
+
+		while (stackSize > 0)
+		{
+			StackEntry entry = stack[--stackSize];
+			if (entry.distance >= hit.distance)
+				continue;
+
+			if (entry.count > 0)
+			{
+				stats.primitiveTests += entry.count;
+				found |= intersectLeaf<4>(entry.child, m_blocks4, ray, primitives, hit);
+				continue;
+			}
+
+			stats.nodesVisited++;
+
+			const WideBVHNode<4>& node = m_nodes4[entry.child];
+
+			__m128 t0x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.minX), originX), invDirX);
+			__m128 t1x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.maxX), originX), invDirX);
+			__m128 t0y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.minY), originY), invDirY);
+			__m128 t1y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.maxY), originY), invDirY);
+			__m128 t0z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.minZ), originZ), invDirZ);
+			__m128 t1z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.maxZ), originZ), invDirZ);
+
+			__m128 tNear = _mm_max_ps(_mm_max_ps(_mm_min_ps(t0x, t1x), _mm_min_ps(t0y, t1y)), _mm_max_ps(_mm_min_ps(t0z, t1z), zero));
+			__m128 tFar = _mm_min_ps(_mm_min_ps(_mm_max_ps(t0x, t1x), _mm_max_ps(t0y, t1y)), _mm_min_ps(_mm_max_ps(t0z, t1z), _mm_set1_ps(hit.distance)));
+
+			int mask = _mm_movemask_ps(_mm_cmple_ps(tNear, tFar));
+			if (mask == 0)
+				continue;
+
+			alignas(16) float distances[4];
+			_mm_store_ps(distances, tNear);
+
+			StackEntry hits[4];
+			int hitCount = 0;
+			for (int i = 0; i < 4; i++)
+			{
+				if (mask & (1 << i))
+					hits[hitCount++] = { node.child[i], node.count[i], distances[i] };
+			}
+
+			sortDescending(hits, hitCount);
+			assert(stackSize + hitCount <= STACK_SIZE && "traversal stack overflow");
+			for (int i = 0; i < hitCount; i++)
+				stack[stackSize++] = hits[i];
+		}
+
+		return found;
+	}
+
+	VIBRATO_TARGET_AVX2
+	bool WideBVH::intersectAVX2(const Ray& ray, const PrimitiveStore& primitives, RayHit& hit) const
+	{
+		BVH::TraversalStats& stats = BVH::threadTraversalStats();
+
+		// (b - o) * d^-1 is evaluated as b * d^-1 - o * d^-1 so it maps onto a single FMA.
+		glm::vec3 invDirection = safeInverse(ray.direction);
+
+		const __m256 invDirX = _mm256_set1_ps(invDirection.x);
+		const __m256 invDirY = _mm256_set1_ps(invDirection.y);
+		const __m256 invDirZ = _mm256_set1_ps(invDirection.z);
+		const __m256 scaledOriginX = _mm256_mul_ps(_mm256_set1_ps(ray.origin.x), invDirX);
+		const __m256 scaledOriginY = _mm256_mul_ps(_mm256_set1_ps(ray.origin.y), invDirY);
+		const __m256 scaledOriginZ = _mm256_mul_ps(_mm256_set1_ps(ray.origin.z), invDirZ);
+		const __m256 zero = _mm256_setzero_ps();
+
+		bool found = false;
+
+		StackEntry stack[STACK_SIZE];
+		int stackSize = 0;
+		stack[stackSize++] = m_root;
+
+		while (stackSize > 0)
+		{
+			StackEntry entry = stack[--stackSize];
+			if (entry.distance >= hit.distance)
+				continue;
+
+			if (entry.count > 0)
+			{
+				stats.primitiveTests += entry.count;
+				found |= intersectLeaf<8>(entry.child, m_blocks8, ray, primitives, hit);
+				continue;
+			}
+
+			stats.nodesVisited++;
+
+			const WideBVHNode<8>& node = m_nodes8[entry.child];
+
+			__m256 t0x = _mm256_fmsub_ps(_mm256_load_ps(node.minX), invDirX, scaledOriginX);
+			__m256 t1x = _mm256_fmsub_ps(_mm256_load_ps(node.maxX), invDirX, scaledOriginX);
+			__m256 t0y = _mm256_fmsub_ps(_mm256_load_ps(node.minY), invDirY, scaledOriginY);
+			__m256 t1y = _mm256_fmsub_ps(_mm256_load_ps(node.maxY), invDirY, scaledOriginY);
+			__m256 t0z = _mm256_fmsub_ps(_mm256_load_ps(node.minZ), invDirZ, scaledOriginZ);
+			__m256 t1z = _mm256_fmsub_ps(_mm256_load_ps(node.maxZ), invDirZ, scaledOriginZ);
+
+			__m256 tNear = _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(t0x, t1x), _mm256_min_ps(t0y, t1y)), _mm256_max_ps(_mm256_min_ps(t0z, t1z), zero));
+			__m256 tFar = _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(t0x, t1x), _mm256_max_ps(t0y, t1y)), _mm256_min_ps(_mm256_max_ps(t0z, t1z), _mm256_set1_ps(hit.distance)));
+
+			int mask = _mm256_movemask_ps(_mm256_cmp_ps(tNear, tFar, _CMP_LE_OQ));
+			if (mask == 0)
+				continue;
+
+			alignas(32) float distances[8];
+			_mm256_store_ps(distances, tNear);
+
+			StackEntry hits[8];
+			int hitCount = 0;
+			for (int i = 0; i < 8; i++)
+			{
+				if (mask & (1 << i))
+					hits[hitCount++] = { node.child[i], node.count[i], distances[i] };
+			}
+
+			sortDescending(hits, hitCount);
+			assert(stackSize + hitCount <= STACK_SIZE && "traversal stack overflow");
+			for (int i = 0; i < hitCount; i++)
+				stack[stackSize++] = hits[i];
+		}
+
+		return found;
+	}
+
+	VIBRATO_TARGET_AVX2
+	static inline float horizontalMin(__m256 v)
+	{
+		__m128 m = _mm_min_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+		m = _mm_min_ps(m, _mm_movehl_ps(m, m));
+		m = _mm_min_ss(m, _mm_shuffle_ps(m, m, 1));
+		return _mm_cvtss_f32(m);
+	}
+
+	VIBRATO_TARGET_AVX2
+	static inline float horizontalMax(__m256 v)
+	{
+		__m128 m = _mm_max_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+		m = _mm_max_ps(m, _mm_movehl_ps(m, m));
+		m = _mm_max_ss(m, _mm_shuffle_ps(m, m, 1));
+		return _mm_cvtss_f32(m);
+	}
+
+	VIBRATO_TARGET_AVX2
+	bool WideBVH::intersectPacketAVX2(const RayPacket& packet, const PrimitiveStore& primitives, PacketHit& hit) const
+	{
+		BVH::TraversalStats& stats = BVH::threadTraversalStats();
+		stats.rays += packet.count;
+
+		alignas(32) float invX[RayPacket::SIZE], invY[RayPacket::SIZE], invZ[RayPacket::SIZE];
+		for (int i = 0; i < RayPacket::SIZE; i++)
+		{
+			glm::vec3 inv = safeInverse(glm::vec3(packet.directionX[i], packet.directionY[i], packet.directionZ[i]));
+			invX[i] = inv.x;
+			invY[i] = inv.y;
+			invZ[i] = inv.z;
+		}
+
+		const __m256 invDirX = _mm256_load_ps(invX);
+		const __m256 invDirY = _mm256_load_ps(invY);
+		const __m256 invDirZ = _mm256_load_ps(invZ);
+		const __m256 scaledOriginX = _mm256_mul_ps(_mm256_load_ps(packet.originX), invDirX);
+		const __m256 scaledOriginY = _mm256_mul_ps(_mm256_load_ps(packet.originY), invDirY);
+		const __m256 scaledOriginZ = _mm256_mul_ps(_mm256_load_ps(packet.originZ), invDirZ);
+		const __m256 zero = _mm256_setzero_ps();
+		const __m256 inf = _mm256_set1_ps(std::numeric_limits<float>::infinity());
+
+		StackEntry stack[STACK_SIZE];
+		int stackSize = 0;
+		stack[stackSize++] = m_root;
+
+		while (stackSize > 0)
+		{
+			StackEntry entry = stack[--stackSize];
+
+			// entry.distance is the nearest entry over the packet, skip when no ray can still improve.
+			__m256 hitDistance = _mm256_load_ps(hit.distance);
+			if (entry.distance >= horizontalMax(hitDistance))
+				continue;
+
+			if (entry.count > 0)
+			{
+				stats.primitiveTests += (uint64_t)entry.count * packet.count;
+
+				const Leaf& leaf = m_leaves[entry.child];
+				for (uint32_t i = leaf.firstSphere; i < leaf.firstSphere + leaf.sphereCount; i++)
+				{
+					uint32_t id = m_sphereIds[i];
+					for (uint32_t r = 0; r < packet.count; r++)
+					{
+						float t = primitives.intersectSphere(id, packet.get(r));
+						if (t > 0.0f && t < hit.distance[r])
+						{
+							hit.distance[r] = t;
+							hit.primitiveIndex[r] = id;
+						}
+					}
+				}
+
+				for (uint32_t i = leaf.firstBlock; i < leaf.firstBlock + leaf.blockCount; i++)
+					TriangleKernels::intersectPacketAVX2(m_blocks8[i], packet, hit);
+
+				continue;
+			}
+
+			stats.nodesVisited++;
+
+			const WideBVHNode<8>& node = m_nodes8[entry.child];
+
+			// Child by child, each slab test covers the whole packet.
+			StackEntry hits[8];
+			int hitCount = 0;
+			for (int i = 0; i < 8; i++)
+			{
+				if (node.minX[i] == std::numeric_limits<float>::infinity())
+					break;
+
+				__m256 t0x = _mm256_fmsub_ps(_mm256_set1_ps(node.minX[i]), invDirX, scaledOriginX);
+				__m256 t1x = _mm256_fmsub_ps(_mm256_set1_ps(node.maxX[i]), invDirX, scaledOriginX);
+				__m256 t0y = _mm256_fmsub_ps(_mm256_set1_ps(node.minY[i]), invDirY, scaledOriginY);
+				__m256 t1y = _mm256_fmsub_ps(_mm256_set1_ps(node.maxY[i]), invDirY, scaledOriginY);
+				__m256 t0z = _mm256_fmsub_ps(_mm256_set1_ps(node.minZ[i]), invDirZ, scaledOriginZ);
+				__m256 t1z = _mm256_fmsub_ps(_mm256_set1_ps(node.maxZ[i]), invDirZ, scaledOriginZ);
+
+				__m256 tNear = _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(t0x, t1x), _mm256_min_ps(t0y, t1y)), _mm256_max_ps(_mm256_min_ps(t0z, t1z), zero));
+				__m256 tFar = _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(t0x, t1x), _mm256_max_ps(t0y, t1y)), _mm256_min_ps(_mm256_max_ps(t0z, t1z), hitDistance));
+
+				__m256 mask = _mm256_cmp_ps(tNear, tFar, _CMP_LE_OQ);
+				if (_mm256_movemask_ps(mask) == 0)
+					continue;
+
+				hits[hitCount++] = { node.child[i], node.count[i], horizontalMin(_mm256_blendv_ps(inf, tNear, mask)) };
+			}
+
+			sortDescending(hits, hitCount);
+			assert(stackSize + hitCount <= STACK_SIZE && "traversal stack overflow");
+			for (int i = 0; i < hitCount; i++)
+				stack[stackSize++] = hits[i];
+		}
+
+		bool found = false;
+		for (uint32_t r = 0; r < packet.count && !found; r++)
+			found = hit.isHit(r);
+
+		return found;
+	}
+
+#else
+
+	bool WideBVH::intersectSSE(const Ray& ray, const PrimitiveStore& primitives, RayHit& hit) const
+	{
+		return intersectScalar<4>(m_nodes4, ray, primitives, hit);
+	}
+
+	bool WideBVH::intersectAVX2(const Ray& ray, const PrimitiveStore& primitives, RayHit& hit) const
+	{
+		return intersectScalar<8>(m_nodes8, ray, primitives, hit);
+	}
+
+	bool WideBVH::intersectPacketAVX2(const RayPacket& packet, const PrimitiveStore& primitives, PacketHit& hit) const
+	{
+		return false;
+	}
+
+#endif
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#include "BVH.h"
+#include "PrimitiveStore.h"
+#include "Ray.h"
+#include "RayPacket.h"
+#include "TriangleBlock.h"
+
+#include <vector>
+
+namespace Vibrato
+{
+	// Child bounds are stored per component so one SIMD slab test covers every child of a node.
+	// Unused slots have +inf bounds, which every ray misses.
+	template<int N>
+	struct WideBVHNode
+	{
+		alignas(N * 4) float minX[N];
+		alignas(N * 4) float minY[N];
+		alignas(N * 4) float minZ[N];
+		alignas(N * 4) float maxX[N];
+		alignas(N * 4) float maxY[N];
+		alignas(N * 4) float maxZ[N];
+
+		uint32_t child[N]; // node index for interior children, leaf index for leaves
+		uint32_t count[N]; // primitive count for leaves, 0 for interior children and empty slots
+	};
+
+	// 4-wide (SSE) or 8-wide (AVX2) hierarchy collapsed from the binary SAH BVH.
+	// Leaf triangles are packed into blocks of the same width so one kernel call tests a whole block.
+	class WideBVH
+	{
+	public:
+		WideBVH() = default;
+
+		// width 0 picks 8 when the CPU supports AVX2 and 4 otherwise.
+		// The store must be the one the BVH was built over.
+		void build(const BVH& bvh, const PrimitiveStore& primitives, int width = 0);
+		void clear();
+		// Copies the bounds of the binary nodes flagged in changedNodes (see BVH::refit) into the child slots built from them.
+		// Only bounds change, so the primitives must not have been reordered and triangles must not have moved.
+		void refit(const BVH& bvh, const std::vector<uint8_t>& changedNodes);
+
+		// Returns false when nothing in (0, hit.distance) was hit.
+		bool intersect(const Ray& ray, const PrimitiveStore& primitives, RayHit& hit) const;
+
+		// Traces the packet as a whole when supportsPackets(), otherwise ray by ray.
+		// Returns false when no ray of the packet hit anything.
+		bool intersect(const RayPacket& packet, const PrimitiveStore& primitives, PacketHit& hit) const;
+
+		// Packets are traversed with AVX2 over the 8-wide layout.
+		inline bool supportsPackets() const { return m_kernel == Kernel::AVX2; }
+
+		// A tree whose root is a single leaf has no nodes but is not empty, every tree with primitives has a leaf.
+		inline bool isEmpty() const { return m_leaves.empty(); }
+		inline int getWidth() const { return m_width; }
+		inline uint32_t getNodeCount() const { return m_width == 8 ? (uint32_t)m_nodes8.size() : (uint32_t)m_nodes4.size(); }
+
+		// Name of the traversal kernel picked at build time.
+		const char* getKernelName() const;
+
+	private:
+		struct Leaf
+		{
+			uint32_t firstSphere, sphereCount; // range in m_sphereIds
+			uint32_t firstBlock, blockCount;   // range in m_blocks4 or m_blocks8
+		};
+
+		template<int N>
+		uint32_t collapse(const BVH& bvh, uint32_t binaryIndex, const PrimitiveStore& primitives, std::vector<WideBVHNode<N>>& wideNodes, std::vector<TriangleBlock<N>>& blocks);
+
+		template<int N>
+		uint32_t makeLeaf(const BVH::Node& node, const std::vector<uint32_t>& primitiveIndices, const PrimitiveStore& primitives, std::vector<TriangleBlock<N>>& blocks);
+
+		template<int N>
+		void refitNodes(const BVH& bvh, const std::vector<uint8_t>& changedNodes, std::vector<WideBVHNode<N>>& wideNodes);
+
+		template<int N>
+		bool intersectScalar(const std::vector<WideBVHNode<N>>& nodes, const Ray& ray, const PrimitiveStore& primitives, RayHit& hit) const;
+
+		bool intersectSSE(const Ray& ray, const PrimitiveStore& primitives, RayHit& hit) const;
+		bool intersectAVX2(const Ray& ray, const PrimitiveStore& primitives, RayHit& hit) const;
+		bool intersectPacketAVX2(const RayPacket& packet, const PrimitiveStore& primitives, PacketHit& hit) const;
+
+		template<int N>
+		bool intersectLeaf(uint32_t leafIndex, const std::vector<TriangleBlock<N>>& blocks, const Ray& ray, const PrimitiveStore& primitives, RayHit& hit) const;
+
+	private:
+		struct StackEntry
+		{
+			uint32_t child;
+			uint32_t count;
+			float distance;
+		};
+
+		static constexpr int STACK_SIZE = 512;
+
+		enum class Kernel
+		{
+			Scalar = 0,
+			SSE,
+			AVX2
+		};
+
+		std::vector<WideBVHNode<4>> m_nodes4;
+		std::vector<WideBVHNode<8>> m_nodes8;
+		std::vector<uint32_t> m_binaryChildren; // binary node every child slot was built from, width entries per node
+		std::vector<Leaf> m_leaves;
+		std::vector<uint32_t> m_sphereIds;
+		std::vector<TriangleBlock<4>> m_blocks4;
+		std::vector<TriangleBlock<8>> m_blocks8;
+
+		// The root is stored like a child entry so a single-leaf tree needs no special case.
+		StackEntry m_root = { 0, 0, 0.0f };
+
+		int m_width = 0;
+		Kernel m_kernel = Kernel::Scalar;
+	};
+}
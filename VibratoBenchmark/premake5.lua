@@ -0,0 +1,49 @@
+project "VibratoBenchmark"
+  kind "ConsoleApp"
+  language "C++"
+  cppdialect "C++17"
+  targetdir "bin/%{cfg.buildcfg}"
+  staticruntime "off"
+
+  -- The tracer core without ClefApp.cpp, so nothing pulls in GLFW, ImGui or Vulkan.
+  files
+  {
+    "src/**.h",
+    "src/**.cpp",
+
+    "../Vibrato/src/Vibrato/**.h",
+    "../Vibrato/src/Vibrato/**.cpp",
+    "../Vibrato/src/Extern/**.h",
+    "../Vibrato/src/Extern/**.cpp",
+  }
+
+  includedirs
+  {
+    "../Vibrato/src",
+    "../vendor/stb_image",
+
+    -- Header-only: Clef/Timer.h and glm, which ships with the Vulkan SDK
+    "../Clef/src",
+    "%{IncludeDir.VulkanSDK}",
+  }
+
+  defines { "VIBRATO_HEADLESS" }
+
+  targetdir ("../bin/" .. outputdir .. "/%{prj.name}")
+  objdir ("../bin-int/" .. outputdir .. "/%{prj.name}")
+
+  filter "system:windows"
+    systemversion "latest"
+    links { "psapi" }
+
+  filter "system:linux"
+    links { "pthread" }
+
+  filter "configurations:Debug"
+    runtime "Debug"
+    symbols "On"
+
+  filter "configurations:Release"
+    runtime "Release"
+    optimize "On"
+    symbols "Off"
@@ -0,0 +1,404 @@
+#include "Vibrato/Renderer.h"
+
+#include "Clef/Timer.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+	#define NOMINMAX
+	#include <windows.h>
+	#include <psapi.h>
+#else
+	#include <sys/resource.h>
+#endif
+
+// Renders a fixed set of scenes with fixed cameras and sample counts and reports one JSON object per scene.
+// Everything the tracer does is seeded from the pixel and frame index, so runs are repeatable and
+// the image hash only changes when the rendered result does.
+
+struct BenchmarkScene
+{
+	std::string name;
+	Vibrato::Scene scene;
+	glm::vec3 cameraPosition{ 0.0f, 1.0f, 5.0f };
+	glm::vec3 cameraDirection{ 0.0f, 0.0f, -1.0f };
+};
+
+struct BenchmarkResult
+{
+	std::string name;
+	uint32_t primitives = 0;
+	double buildMs = 0.0;
+	double msPerFrame = 0.0;
+	double minMsPerFrame = 0.0;
+	double raysPerSecond = 0.0;
+	uint64_t rays = 0;
+	std::vector<uint64_t> bounceRays;
+	double averagePathLength = 0.0;
+	double resolveMsPerFrame = 0.0;
+	uint64_t processPeakMemoryBytes = 0; // of the whole run so far, so it includes every scene before this one
+	uint64_t imageHash = 0;
+};
+
+// The process's peak resident size since it started, the OS keeps no per-scene figure to reset.
+static uint64_t processPeakMemoryBytes()
+{
+#if defined(_WIN32)
+	PROCESS_MEMORY_COUNTERS counters;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return (uint64_t)counters.PeakWorkingSetSize;
+	return 0;
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0;
+	#if defined(__APPLE__)
+		return (uint64_t)usage.ru_maxrss;
+	#else
+		return (uint64_t)usage.ru_maxrss * 1024;
+	#endif
+#endif
+}
+
+static uint64_t hashImage(const uint32_t* data, uint32_t count)
+{
+	// FNV-1a
+	uint64_t hash = 1469598103934665603ull;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		hash ^= data[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+// The sphere setup from ClefApp.cpp: white ground and an orange emissive sphere.
+static void addSpheres(Vibrato::Scene& scene)
+{
+	Vibrato::Material& groundMaterial = scene.materials.emplace_back();
+	groundMaterial.albedo = { 1.0f, 1.0f, 1.0f };
+	{
+		auto sphere = std::make_shared<Vibrato::Sphere>();
+		sphere->position = { 0.0f, -1000.0f, 0.0f };
+		sphere->radius = 1000.0f;
+		sphere->materialIndex = (int)(scene.materials.size() - 1);
+		scene.objects.push_back(sphere);
+	}
+
+	Vibrato::Material& lambertian = scene.materials.emplace_back();
+	lambertian.albedo = { 0.8f, 0.5f, 0.2f };
+	lambertian.emissionColor = { 0.8f, 0.5f, 0.2f };
+	lambertian.emissionPower = 5.0f;
+	{
+		auto sphere = std::make_shared<Vibrato::Sphere>();
+		sphere->position = { -4.0f, 4.0f, -3.0f };
+		sphere->radius = 1.0f;
+		sphere->materialIndex = (int)(scene.materials.size() - 1);
+		scene.objects.push_back(sphere);
+	}
+}
+
+static std::vector<std::unique_ptr<BenchmarkScene>> createScenes(const std::string& objDirectory)
+{
+	std::vector<std::unique_ptr<BenchmarkScene>> scenes;
+
+	{
+		auto& spheres = scenes.emplace_back(std::make_unique<BenchmarkScene>());
+		spheres->name = "spheres";
+		addSpheres(spheres->scene);
+	}
+
+	std::vector<std::filesystem::path> meshPaths;
+	for (const auto& entry : std::filesystem::directory_iterator(objDirectory))
+	{
+		if (entry.path().extension() == ".obj")
+			meshPaths.push_back(entry.path());
+	}
+	std::sort(meshPaths.begin(), meshPaths.end());
+
+	// Each mesh with the gem material from ClefApp.cpp, framed by a camera derived from its bounds.
+	for (const std::filesystem::path& path : meshPaths)
+	{
+		auto& benchmark = scenes.emplace_back(std::make_unique<BenchmarkScene>());
+		benchmark->name = path.stem().string();
+		addSpheres(benchmark->scene);
+
+		Vibrato::Material& gem = benchmark->scene.materials.emplace_back();
+		gem.albedo = { 0.9f, 0.9f, 0.9f };
+		gem.refractiveIndex = 2.42f;
+
+		auto mesh = std::make_shared<Vibrato::TriangleMesh>(path.string().c_str());
+		mesh->materialIndex = (int)(benchmark->scene.materials.size() - 1);
+		benchmark->scene.meshes.push_back(mesh);
+
+		Vibrato::AABB bounds = mesh->getBounds();
+		glm::vec3 center = bounds.centroid();
+		float radius = std::max(glm::length(bounds.extent()) * 0.5f, 0.001f);
+
+		benchmark->cameraPosition = center + glm::vec3(0.0f, 0.5f, 3.0f) * radius;
+		benchmark->cameraDirection = center - benchmark->cameraPosition;
+	}
+
+	return scenes;
+}
+
+static std::string toJson(const BenchmarkResult& result)
+{
+	std::ostringstream json;
+	json << "{\"scene\": \"" << result.name << "\""
+		<< ", \"primitives\": " << result.primitives
+		<< ", \"buildMs\": " << result.buildMs
+		<< ", \"msPerFrame\": " << result.msPerFrame
+		<< ", \"minMsPerFrame\": " << result.minMsPerFrame
+		<< ", \"raysPerSecond\": " << (uint64_t)result.raysPerSecond
+		<< ", \"rays\": " << result.rays
+		<< ", \"bounceRays\": [";
+	for (size_t i = 0; i < result.bounceRays.size(); i++)
+		json << (i ? ", " : "") << result.bounceRays[i];
+	json << "]"
+		<< ", \"averagePathLength\": " << result.averagePathLength
+		<< ", \"resolveMsPerFrame\": " << result.resolveMsPerFrame
+		<< ", \"processPeakMemoryBytes\": " << result.processPeakMemoryBytes
+		<< ", \"imageHash\": \"" << std::hex << result.imageHash << std::dec << "\"}";
+	return json.str();
+}
+
+// Reads back the flat objects written by toJson, one per line. Only the fields compared are kept.
+static std::map<std::string, BenchmarkResult> readBaseline(const std::string& filePath)
+{
+	std::map<std::string, BenchmarkResult> baseline;
+
+	std::ifstream file(filePath);
+	if (!file)
+	{
+		std::cout << "> Failed to open baseline " << filePath << "!" << std::endl;
+		return baseline;
+	}
+
+	auto field = [](const std::string& line, const char* key) -> std::string
+	{
+		std::string pattern = std::string("\"") + key + "\": ";
+		size_t start = line.find(pattern);
+		if (start == std::string::npos)
+			return "";
+
+		start += pattern.size();
+		if (line[start] == '"')
+			return line.substr(start + 1, line.find('"', start + 1) - start - 1);
+
+		return line.substr(start, line.find_first_of(",}", start) - start);
+	};
+
+	std::string line;
+	while (std::getline(file, line))
+	{
+		BenchmarkResult result;
+		result.name = field(line, "scene");
+		if (result.name.empty())
+			continue;
+
+		result.msPerFrame = std::atof(field(line, "msPerFrame").c_str());
+		result.raysPerSecond = std::atof(field(line, "raysPerSecond").c_str());
+		result.imageHash = std::strtoull(field(line, "imageHash").c_str(), nullptr, 16);
+		baseline[result.name] = result;
+	}
+
+	return baseline;
+}
+
+static void printUsage()
+{
+	std::cout << "Usage: VibratoBenchmark [options]\n"
+		<< "  --obj <directory>        meshes to benchmark, default ./obj\n"
+		<< "  --width <pixels>         default 640\n"
+		<< "  --height <pixels>        default 360\n"
+		<< "  --frames <count>         frames per scene at 1 spp each, default 16\n"
+		<< "  --bounces <count>        default 10\n"
+		<< "  --threads <count>        0 uses every hardware thread, default 0\n"
+		<< "  --integrator <name>      megakernel or wavefront, default megakernel\n"
+		<< "  --output <path>          write the results there as well as to stdout\n"
+		<< "  --baseline <path>        compare against an earlier --output\n"
+		<< "  --tolerance <percent>    slowdown reported as a regression, default 5\n";
+}
+
+int main(int argc, char** argv)
+{
+	std::string objDirectory = "./obj";
+	std::string outputPath, baselinePath;
+	uint32_t width = 640, height = 360;
+	int frames = 16;
+	double tolerance = 5.0;
+
+	Vibrato::Renderer renderer;
+	Vibrato::Renderer::Settings& settings = renderer.getSettings();
+
+	for (int i = 1; i < argc; i++)
+	{
+		std::string option = argv[i];
+		if (option == "--help")
+		{
+			printUsage();
+			return 0;
+		}
+
+		if (i + 1 >= argc)
+		{
+			std::cout << "> Missing value for " << option << std::endl;
+			return 1;
+		}
+
+		const char* value = argv[++i];
+		if (option == "--obj")
+			objDirectory = value;
+		else if (option == "--width")
+			width = (uint32_t)std::atoi(value);
+		else if (option == "--height")
+			height = (uint32_t)std::atoi(value);
+		else if (option == "--frames")
+			frames = std::atoi(value);
+		else if (option == "--bounces")
+			settings.bounces = std::atoi(value);
+		else if (option == "--threads")
+			settings.threadCount = std::atoi(value);
+		else if (option == "--integrator")
+		{
+			if (std::strcmp(value, "megakernel") == 0)
+				settings.integrator = Vibrato::Renderer::Integrator::MegaKernel;
+			else if (std::strcmp(value, "wavefront") == 0)
+				settings.integrator = Vibrato::Renderer::Integrator::Wavefront;
+			else
+			{
+				std::cout << "> Unknown integrator " << value << std::endl;
+				printUsage();
+				return 1;
+			}
+		}
+		else if (option == "--output")
+			outputPath = value;
+		else if (option == "--baseline")
+			baselinePath = value;
+		else if (option == "--tolerance")
+			tolerance = std::atof(value);
+		else
+		{
+			std::cout << "> Unknown option " << option << std::endl;
+			printUsage();
+			return 1;
+		}
+	}
+
+	if (width == 0 || height == 0 || frames <= 0)
+	{
+		std::cout << "> Width, height and frames must be positive" << std::endl;
+		return 1;
+	}
+
+	settings.accumulate = true;
+	settings.samplesPerPixel = 1;
+
+	std::vector<BenchmarkResult> results;
+	for (auto& benchmark : createScenes(objDirectory))
+	{
+		BenchmarkResult& result = results.emplace_back();
+		result.name = benchmark->name;
+
+		Clef::Timer buildTimer;
+		benchmark->scene.commit();
+		result.buildMs = buildTimer.elapsedMillis();
+		result.primitives = benchmark->scene.primitives.size();
+
+		Vibrato::Camera camera(45.0f, 0.1f, 100.0f);
+		camera.onResize(width, height);
+		camera.setView(benchmark->cameraPosition, benchmark->cameraDirection);
+
+		renderer.onResize(width, height);
+		renderer.resetFrameIndex();
+
+		// One untimed frame so the thread pool and buffers are warm.
+		renderer.render(benchmark->scene, camera);
+		renderer.resetFrameIndex();
+
+		result.bounceRays.assign(std::max(settings.bounces, 1), 0);
+		result.minMsPerFrame = 1e30;
+
+		double totalMs = 0.0;
+		for (int frame = 0; frame < frames; frame++)
+		{
+			Clef::Timer timer;
+			renderer.render(benchmark->scene, camera);
+			double ms = timer.elapsedMillis();
+
+			totalMs += ms;
+			result.minMsPerFrame = std::min(result.minMsPerFrame, ms);
+			result.rays += renderer.getTraversalStats().rays;
+
+			const std::vector<uint64_t>& bounceRays = renderer.getBounceRayCounts();
+			for (size_t i = 0; i < bounceRays.size() && i < result.bounceRays.size(); i++)
+				result.bounceRays[i] += bounceRays[i];
+
+			result.averagePathLength += renderer.getAveragePathLength() / frames;
+			result.resolveMsPerFrame += renderer.getResolveTime() / frames;
+		}
+
+		result.msPerFrame = totalMs / frames;
+		result.raysPerSecond = result.rays / (totalMs * 0.001);
+		result.processPeakMemoryBytes = processPeakMemoryBytes();
+		result.imageHash = hashImage(renderer.getImageData(), width * height);
+	}
+
+	std::ofstream output;
+	if (!outputPath.empty())
+		output.open(outputPath);
+
+	for (const BenchmarkResult& result : results)
+	{
+		std::string json = toJson(result);
+		std::cout << json << std::endl;
+		if (output)
+			output << json << "\n";
+	}
+
+	if (baselinePath.empty())
+		return 0;
+
+	std::map<std::string, BenchmarkResult> baseline = readBaseline(baselinePath);
+
+	int regressions = 0;
+	std::cout << "\n> Compared to " << baselinePath << " (tolerance " << tolerance << "%)" << std::endl;
+	for (const BenchmarkResult& result : results)
+	{
+		auto it = baseline.find(result.name);
+		if (it == baseline.end())
+		{
+			std::cout << ">   " << result.name << ": not in baseline" << std::endl;
+			continue;
+		}
+
+		const BenchmarkResult& before = it->second;
+		if (before.msPerFrame <= 0.0)
+		{
+			std::cout << ">   " << result.name << ": no frame time in baseline" << std::endl;
+			continue;
+		}
+
+		double change = (result.msPerFrame / before.msPerFrame - 1.0) * 100.0;
+		bool regressed = change > tolerance;
+		regressions += regressed ? 1 : 0;
+
+		std::cout << ">   " << result.name << ": " << before.msPerFrame << "ms -> " << result.msPerFrame << "ms ("
+			<< (change >= 0.0 ? "+" : "") << change << "%)"
+			<< (regressed ? " REGRESSION" : "")
+			<< (result.imageHash != before.imageHash ? ", image changed" : "") << std::endl;
+	}
+
+	return regressions > 0 ? 2 : 0;
+}
@@ -0,0 +1,195 @@
+#include "Vibrato/Renderer.h"
+#include "Vibrato/SceneLoader.h"
+
+#include "Clef/Timer.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+// Renders a scene file on the CPU and writes the result to disk, no window or GPU needed.
+
+static void printUsage()
+{
+	std::cout << "Usage: VibratoHeadless <scene> [options]\n"
+		<< "  --width <pixels>         default 1280\n"
+		<< "  --height <pixels>        default 720\n"
+		<< "  --spp <samples>          samples per pixel, default 64\n"
+		<< "  --bounces <count>        default 10\n"
+		<< "  --threads <count>        0 uses every hardware thread, default 0\n"
+		<< "  --integrator <name>      megakernel or wavefront, default megakernel\n"
+		<< "  --nee <on|off>           sample lights directly, default on\n"
+		<< "  --sampler <name>         random, sobol or bluenoise, default sobol\n"
+		<< "  --filter <name>          box, tent or blackmanharris, default box\n"
+		<< "  --tonemap <name>         gamma, srgb or aces, default gamma\n"
+		<< "  --noise <threshold>      adaptive sampling, stops early once every pixel is below it\n"
+		<< "  --output <path>          png, bmp or jpg, default render.png\n";
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 2 || std::strcmp(argv[1], "--help") == 0)
+	{
+		printUsage();
+		return argc < 2 ? 1 : 0;
+	}
+
+	std::string scenePath = argv[1];
+	std::string outputPath = "render.png";
+	uint32_t width = 1280, height = 720;
+	int samples = 64;
+
+	Vibrato::Renderer renderer;
+	Vibrato::Renderer::Settings& settings = renderer.getSettings();
+
+	for (int i = 2; i < argc; i++)
+	{
+		std::string option = argv[i];
+		if (i + 1 >= argc)
+		{
+			std::cout << "> Missing value for " << option << std::endl;
+			return 1;
+		}
+
+		const char* value = argv[++i];
+		if (option == "--width")
+			width = (uint32_t)std::atoi(value);
+		else if (option == "--height")
+			height = (uint32_t)std::atoi(value);
+		else if (option == "--spp")
+			samples = std::atoi(value);
+		else if (option == "--bounces")
+			settings.bounces = std::atoi(value);
+		else if (option == "--threads")
+			settings.threadCount = std::atoi(value);
+		else if (option == "--integrator")
+		{
+			if (std::strcmp(value, "megakernel") == 0)
+				settings.integrator = Vibrato::Renderer::Integrator::MegaKernel;
+			else if (std::strcmp(value, "wavefront") == 0)
+				settings.integrator = Vibrato::Renderer::Integrator::Wavefront;
+			else
+			{
+				std::cout << "> Unknown integrator " << value << std::endl;
+				printUsage();
+				return 1;
+			}
+		}
+		else if (option == "--nee")
+			settings.lightSampling = std::strcmp(value, "off") != 0;
+		else if (option == "--sampler")
+		{
+			if (std::strcmp(value, "random") == 0)
+				settings.sampler = Vibrato::Sampler::Type::Random;
+			else if (std::strcmp(value, "sobol") == 0)
+				settings.sampler = Vibrato::Sampler::Type::Sobol;
+			else if (std::strcmp(value, "bluenoise") == 0)
+				settings.sampler = Vibrato::Sampler::Type::BlueNoise;
+			else
+			{
+				std::cout << "> Unknown sampler " << value << std::endl;
+				printUsage();
+				return 1;
+			}
+		}
+		else if (option == "--filter")
+		{
+			if (std::strcmp(value, "box") == 0)
+				settings.filter = Vibrato::Renderer::PixelFilter::Box;
+			else if (std::strcmp(value, "tent") == 0)
+				settings.filter = Vibrato::Renderer::PixelFilter::Tent;
+			else if (std::strcmp(value, "blackmanharris") == 0)
+				settings.filter = Vibrato::Renderer::PixelFilter::BlackmanHarris;
+			else
+			{
+				std::cout << "> Unknown filter " << value << std::endl;
+				printUsage();
+				return 1;
+			}
+		}
+		else if (option == "--tonemap")
+		{
+			if (std::strcmp(value, "gamma") == 0)
+				settings.tonemap = Vibrato::Tonemap::Gamma;
+			else if (std::strcmp(value, "srgb") == 0)
+				settings.tonemap = Vibrato::Tonemap::SRGB;
+			else if (std::strcmp(value, "aces") == 0)
+				settings.tonemap = Vibrato::Tonemap::ACES;
+			else
+			{
+				std::cout << "> Unknown tonemap " << value << std::endl;
+				printUsage();
+				return 1;
+			}
+		}
+		else if (option == "--noise")
+		{
+			settings.adaptiveSampling = true;
+			settings.noiseThreshold = (float)std::atof(value);
+		}
+		else if (option == "--output")
+			outputPath = value;
+		else
+		{
+			std::cout << "> Unknown option " << option << std::endl;
+			printUsage();
+			return 1;
+		}
+	}
+
+	if (width == 0 || height == 0 || samples <= 0)
+	{
+		std::cout << "> Width, height and spp must be positive" << std::endl;
+		return 1;
+	}
+
+	// Meshes load in parallel, a scene that failed to load fully is not rendered
+	Clef::Timer loadTimer;
+	Vibrato::Scene scene;
+	Vibrato::CameraDescription cameraDescription;
+	if (!Vibrato::loadScene(scenePath, scene, cameraDescription))
+		return 1;
+	std::cout << "> Loaded " << scenePath << " in " << loadTimer.elapsedMillis() << "ms" << std::endl;
+
+	scene.commit();
+	scene.bvh.printReport();
+
+	Vibrato::Camera camera(cameraDescription.verticalFOV, 0.1f, 100.0f);
+	camera.onResize(width, height);
+	camera.setView(cameraDescription.position, cameraDescription.direction);
+	camera.setLens(cameraDescription.aperture, cameraDescription.focusDistance);
+
+	renderer.onResize(width, height);
+
+	// One sample per frame, accumulated like the interactive viewport does.
+	settings.accumulate = true;
+	settings.samplesPerPixel = 1;
+
+	// With adaptive sampling, spp is the budget and the render ends once nothing is left to sample.
+	uint64_t rays = 0, sampleCount = 0;
+	int frames = 0;
+	Clef::Timer timer;
+	while (frames < samples && renderer.getActivePixelCount() > 0)
+	{
+		renderer.render(scene, camera);
+		rays += renderer.getTraversalStats().rays;
+		sampleCount += renderer.getSampleCount();
+		frames++;
+	}
+	float renderTime = timer.elapsedMillis();
+
+	if (settings.adaptiveSampling)
+		std::cout << "> Adaptive sampling: " << renderer.getActivePixelCount() << " pixels still active after " << frames << " frames" << std::endl;
+
+	// Converged pixels stop early and noisy ones take extra samples, so frames is not what a pixel got
+	double averageSamples = (double)sampleCount / ((uint64_t)width * height);
+	std::cout << "> Rendered " << averageSamples << " spp on average at " << width << "x" << height << " in " << renderTime << "ms ("
+		<< (rays / (renderTime * 1000.0)) << " Mrays/s)" << std::endl;
+
+	if (!renderer.saveImage(outputPath))
+		return 1;
+
+	std::cout << "> Saved " << outputPath << std::endl;
+	return 0;
+}
@@ -7,3 +7,5 @@ outputdir = "%{cfg.buildcfg}-%{cfg.system}-%{cfg.architecture}"
 
 include "ClefExternal.lua"
 include "Vibrato"
+include "VibratoHeadless"
+include "VibratoBenchmark"